@@ -0,0 +1,437 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <dirent.h>
+#include "zigbee.h"
+#include "sensor.h"
+#include "sensor_db.h"
+#include "history.h"
+#include "webcmd.h"
+#include "monotonic.h"
+
+/**
+ * Micro benchmarks of the hot paths, results in JSON on stdout:
+ * { "benchmarks": [ { "name", "iterations", "ns_per_op", "allocs_per_op" }, ... ] }
+ * Allocations are counted by wrapping malloc/calloc/realloc at link time (-Wl,--wrap),
+ * only the calls made by the project code are seen, not the ones inside the libc.
+ */
+
+#define BENCH_DEFAULT_MIN_TIME  (200) //in ms, per benchmark
+#define BENCH_BUFFER_SIZE       (128)
+#define BENCH_NB_FRAMES         (4)
+#define BENCH_NB_PAYLOADS       (4)
+#define BENCH_HISTORY_NODES     (8)
+#define BENCH_ROTATE_NODES      (1000) //more series than a segment holds
+#define BENCH_HISTORY_SEGMENTS  (4)
+
+typedef void (*bench_function)(uint64_t nbIterations, uint32_t param);
+
+typedef struct
+{
+  const char* name;
+  bench_function run;
+  void (*setup)(uint32_t param); //before the measure, not measured
+  uint32_t param;
+} bench_case;
+
+static uint64_t bench_nbAllocs;
+static volatile uint32_t bench_sink; //results are consumed, the calls can't be removed
+static uint8_t bench_frames[BENCH_NB_FRAMES][BENCH_BUFFER_SIZE];
+static uint16_t bench_frameSizes[BENCH_NB_FRAMES];
+static uint8_t bench_payloads[BENCH_NB_PAYLOADS][BENCH_BUFFER_SIZE];
+static char bench_historyDir[] = "/tmp/zb_bench.XXXXXX";
+
+extern void* __real_malloc(size_t size);
+extern void* __real_calloc(size_t nmemb, size_t size);
+extern void* __real_realloc(void* ptr, size_t size);
+
+void* __wrap_malloc(size_t size)
+{
+  bench_nbAllocs++;
+  return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t nmemb, size_t size)
+{
+  bench_nbAllocs++;
+  return __real_calloc(nmemb, size);
+}
+
+void* __wrap_realloc(void* ptr, size_t size)
+{
+  bench_nbAllocs++;
+  return __real_realloc(ptr, size);
+}
+
+static void bench_encodeATSet(uint64_t nbIterations, uint32_t param)
+{
+  uint8_t buffer[BENCH_BUFFER_SIZE];
+  zigbee_panID panID = { 0x2d, 0x56, 0x12, 0x58, 0xFF, 0xDE, 0xA0, 0x11 };
+
+  (void) param;
+  for (uint64_t i = 0; i < nbIterations; i++)
+  {
+    bench_sink += zigbee_encode_SetPanID(buffer, sizeof(buffer), (uint8_t) i, &panID);
+  }
+}
+
+static void bench_encodeATGet(uint64_t nbIterations, uint32_t param)
+{
+  uint8_t buffer[BENCH_BUFFER_SIZE];
+
+  (void) param;
+  for (uint64_t i = 0; i < nbIterations; i++)
+  {
+    bench_sink += zigbee_encode_getAssociationIndication(buffer, sizeof(buffer), (uint8_t) i);
+  }
+}
+
+static void bench_encodeNodeIdentifier(uint64_t nbIterations, uint32_t param)
+{
+  uint8_t buffer[BENCH_BUFFER_SIZE];
+
+  (void) param;
+  for (uint64_t i = 0; i < nbIterations; i++)
+  {
+    bench_sink += zigbee_encode_SetNodeIdentifier(buffer, sizeof(buffer), (uint8_t) i, "ZBC1");
+  }
+}
+
+static void bench_encodeBaudRate(uint64_t nbIterations, uint32_t param)
+{
+  uint8_t buffer[BENCH_BUFFER_SIZE];
+
+  (void) param;
+  for (uint64_t i = 0; i < nbIterations; i++)
+  {
+    bench_sink += zigbee_encode_setBaudRate(buffer, sizeof(buffer), (uint8_t) i, 460800);
+  }
+}
+
+static void bench_encodeTransmitRequest(uint64_t nbIterations, uint32_t param)
+{
+  uint8_t buffer[BENCH_BUFFER_SIZE];
+  uint8_t payload[BENCH_BUFFER_SIZE];
+  zigbee_64bDestAddr address = { 0x00, 0x13, 0xa2, 0x00, 0x40, 0xd9, 0x68, 0x9c };
+
+  memset(payload, 0x5A, sizeof(payload));
+  for (uint64_t i = 0; i < nbIterations; i++)
+  {
+    bench_sink += zigbee_encode_transmitRequest(buffer, sizeof(buffer), (uint8_t) i, &address,
+                  ZIGBEE_UNKNOWN_16B_ADDR, payload, param);
+  }
+}
+
+static void bench_checksum(uint64_t nbIterations, uint32_t param)
+{
+  uint8_t buffer[BENCH_BUFFER_SIZE];
+
+  for (uint32_t i = 0; i < sizeof(buffer); i++)
+  {
+    buffer[i] = i * 7;
+  }
+  for (uint64_t i = 0; i < nbIterations; i++)
+  {
+    bench_sink += zigbee_doChecksum(buffer, param);
+  }
+}
+
+static void bench_setupFrames(uint32_t param)
+{
+  //receive packet, AT response, transmit status and modem status, as received from the radio
+  static const uint8_t frames[BENCH_NB_FRAMES][32] =
+  {
+    {
+      0x90, 0x00, 0x13, 0xa2, 0x00, 0x40, 0xbd, 0x47, 0x18, 0xff, 0xfe, 0x01,
+      0x00, 0x08, 0x03, 0x01, 0x03, 0x16, 0x2d, 0x02, 0x03, 0x1d, 0xf0, 0x03, 0x00, 0x01, 0xd3
+    },
+    { 0x88, 0x01, 'A', 'I', 0x00, 0x00 },
+    { 0x8B, 0x02, 0xff, 0xfe, 0x00, 0x00, 0x00 },
+    { 0x8A, 0x06 },
+  };
+  static const uint16_t sizes[BENCH_NB_FRAMES] = { 27, 6, 7, 2 };
+
+  (void) param;
+  for (uint32_t i = 0; i < BENCH_NB_FRAMES; i++)
+  {
+    bench_frames[i][0] = ZIGBEE_START_DELIMITER;
+    bench_frames[i][1] = sizes[i] >> 8;
+    bench_frames[i][2] = sizes[i] & 0xFF;
+    memcpy(&bench_frames[i][ZIGBEE_HEADER_SIZE], frames[i], sizes[i]);
+    bench_frames[i][ZIGBEE_HEADER_SIZE + sizes[i]] = zigbee_doChecksum(&bench_frames[i][ZIGBEE_HEADER_SIZE], sizes[i]);
+    bench_frameSizes[i] = sizes[i] + ZIGBEE_ENCAPSULATION_SIZE;
+  }
+}
+
+static void bench_decodeFrame(uint64_t nbIterations, uint32_t param)
+{
+  zigbee_decodedFrame decoded;
+  uint32_t index;
+
+  (void) param;
+  for (uint64_t i = 0; i < nbIterations; i++)
+  {
+    index = i % BENCH_NB_FRAMES;
+    bench_sink += zigbee_decodeFrame(&bench_frames[index][ZIGBEE_HEADER_SIZE],
+                                     bench_frameSizes[index] - ZIGBEE_HEADER_SIZE, &decoded);
+  }
+}
+
+static void bench_webcmdDecode(uint64_t nbIterations, uint32_t param)
+{
+  static const char command[] = "xb@00:13:a2:00:40:d9:68:9c;3;ECO\n";
+  char message[sizeof(command)];
+  webmsg msg;
+
+  //the message is cut in place, the copy is part of the measure
+  (void) param;
+  for (uint64_t i = 0; i < nbIterations; i++)
+  {
+    memcpy(message, command, sizeof(command));
+    bench_sink += webcmd_decodeFrame(message, sizeof(command) - 1, &msg);
+  }
+}
+
+static void bench_setupPayloads(uint32_t param)
+{
+  //sensor.c payloads: data type, counter, number of sensors, then type/status/value (big endian)
+  static const uint8_t payloads[BENCH_NB_PAYLOADS][32] =
+  {
+    { 0x00, 0x01, 3, 0x01, 0x03, 0x16, 0x2d, 0x02, 0x03, 0x1d, 0xf0, 0x03, 0x03, 0x01, 0x30 },
+    { 0x00, 0x02, 4, 0x04, 0x03, 0x01, 0x2c, 0x05, 0x03, 0x0b, 0xb8, 0x06, 0x03, 0x27, 0x9c, 0x07, 0x03, 0x00, 0x0a },
+    { 0x00, 0x03, 1, 0x81, 0x03, 0x02, 0x03 },
+    { 0x01, 0x04, 0x11, 0x22, 0x33 },
+  };
+
+  (void) param;
+  memcpy(bench_payloads, payloads, sizeof(payloads));
+}
+
+static void bench_sensorReadData(uint64_t nbIterations, uint32_t param)
+{
+  (void) param;
+  for (uint64_t i = 0; i < nbIterations; i++)
+  {
+    sensor_readData((zb_payload_frame*) bench_payloads[i % BENCH_NB_PAYLOADS]);
+  }
+}
+
+static void bench_sensorBuildCommand(uint64_t nbIterations, uint32_t param)
+{
+  uint8_t buffer[BENCH_BUFFER_SIZE];
+  webmsg msg;
+
+  (void) param;
+  memset(&msg, 0, sizeof(msg));
+  msg.sensor_id = 3;
+  msg.command = ECO;
+  for (uint64_t i = 0; i < nbIterations; i++)
+  {
+    bench_sink += sensor_build_command(&msg, buffer, sizeof(buffer));
+  }
+}
+
+static void bench_makeAddress(uint32_t node, zigbee_64bDestAddr* address)
+{
+  (*address)[0] = 0x00;
+  (*address)[1] = 0x13;
+  (*address)[2] = 0xa2;
+  (*address)[3] = 0x00;
+  (*address)[4] = node >> 24;
+  (*address)[5] = node >> 16;
+  (*address)[6] = node >> 8;
+  (*address)[7] = node;
+}
+
+static void bench_setupSensorDb(uint32_t nbNodes)
+{
+  zigbee_64bDestAddr address;
+
+  sensor_db_clear();
+  for (uint32_t node = 0; node < nbNodes; node++)
+  {
+    bench_makeAddress(node, &address);
+    sensor_db_update(&address, 0);
+  }
+}
+
+static void bench_sensorDbUpdate(uint64_t nbIterations, uint32_t nbNodes)
+{
+  zigbee_64bDestAddr address;
+  uint32_t node;
+
+  //every node sends in turn, each frame is new
+  for (uint64_t i = 0; i < nbIterations; i++)
+  {
+    node = i % nbNodes;
+    bench_makeAddress(node, &address);
+    bench_sink += sensor_db_update(&address, (uint8_t) (i / nbNodes + 1));
+  }
+}
+
+static void bench_cleanHistory(void)
+{
+  char path[sizeof(bench_historyDir) + NAME_MAX + 1];
+  struct dirent* entry;
+  DIR* dir;
+
+  history_close();
+  dir = opendir(bench_historyDir);
+  if (dir == NULL)
+  {
+    return;
+  }
+  while ((entry = readdir(dir)) != NULL)
+  {
+    if (entry->d_name[0] != '.')
+    {
+      snprintf(path, sizeof(path), "%s/%s", bench_historyDir, entry->d_name);
+      unlink(path);
+    }
+  }
+  closedir(dir);
+  rmdir(bench_historyDir);
+}
+
+static void bench_setupHistory(uint32_t param)
+{
+  //a new directory for each case
+  bench_cleanHistory();
+  strcpy(&bench_historyDir[sizeof(bench_historyDir) - sizeof("XXXXXX")], "XXXXXX");
+  bench_setupPayloads(param);
+  if ((mkdtemp(bench_historyDir) == NULL) || (history_open(bench_historyDir, BENCH_HISTORY_SEGMENTS) == false))
+  {
+    fprintf(stderr, "no history in %s\n", bench_historyDir);
+  }
+}
+
+static void bench_historyCommit(uint64_t nbIterations, uint32_t param)
+{
+  zigbee_64bDestAddr address;
+  const history_record* records;
+  uint32_t nbRecords;
+
+  //segments rotate as in the daemon, the oldest ones being removed, on their series as well with many nodes
+  for (uint64_t i = 0; i < nbIterations; i++)
+  {
+    nbRecords = sensor_readData((zb_payload_frame*) bench_payloads[i % BENCH_NB_PAYLOADS]);
+    bench_makeAddress(i % param, &address);
+    records = history_commit(&address, i, nbRecords);
+    //read back as sensor.c does for the sink
+    for (uint32_t j = 0; j < nbRecords; j++)
+    {
+      bench_sink += records[j].id;
+    }
+  }
+}
+
+static const bench_case bench_cases[] =
+{
+  { "zigbee_encode_SetPanID", bench_encodeATSet, NULL, 0 },
+  { "zigbee_encode_getAssociationIndication", bench_encodeATGet, NULL, 0 },
+  { "zigbee_encode_SetNodeIdentifier", bench_encodeNodeIdentifier, NULL, 0 },
+  { "zigbee_encode_setBaudRate", bench_encodeBaudRate, NULL, 0 },
+  { "zigbee_encode_transmitRequest/8", bench_encodeTransmitRequest, NULL, 8 },
+  { "zigbee_encode_transmitRequest/72", bench_encodeTransmitRequest, NULL, 72 },
+  { "zigbee_doChecksum/16", bench_checksum, NULL, 16 },
+  { "zigbee_doChecksum/100", bench_checksum, NULL, 100 },
+  { "zigbee_decodeFrame/mixed", bench_decodeFrame, bench_setupFrames, 0 },
+  { "webcmd_decodeFrame", bench_webcmdDecode, NULL, 0 },
+  { "sensor_readData/mixed", bench_sensorReadData, bench_setupPayloads, 0 },
+  { "history_commit/mixed", bench_historyCommit, bench_setupHistory, BENCH_HISTORY_NODES },
+  { "history_commit/rotate", bench_historyCommit, bench_setupHistory, BENCH_ROTATE_NODES },
+  { "sensor_build_command", bench_sensorBuildCommand, NULL, 0 },
+  { "sensor_db_update/10", bench_sensorDbUpdate, bench_setupSensorDb, 10 },
+  { "sensor_db_update/100", bench_sensorDbUpdate, bench_setupSensorDb, 100 },
+  { "sensor_db_update/1000", bench_sensorDbUpdate, bench_setupSensorDb, 1000 },
+  { "sensor_db_update/10000", bench_sensorDbUpdate, bench_setupSensorDb, 10000 },
+};
+
+#define BENCH_NB_CASES  (sizeof(bench_cases) / sizeof(bench_cases[0]))
+
+static void bench_run(const bench_case* bench, uint64_t minTime, bool bFirst)
+{
+  uint64_t nbIterations;
+  uint64_t startTime;
+  uint64_t duration;
+  uint64_t nbAllocs;
+
+  if (bench->setup != NULL)
+  {
+    bench->setup(bench->param);
+  }
+
+  //the iteration count doubles until the run lasts long enough
+  nbIterations = 1;
+  while (true)
+  {
+    nbAllocs = bench_nbAllocs;
+    startTime = monotonic_getTimeNs();
+    bench->run(nbIterations, bench->param);
+    duration = monotonic_getTimeNs() - startTime;
+    nbAllocs = bench_nbAllocs - nbAllocs;
+    if (duration >= minTime)
+    {
+      break;
+    }
+    nbIterations *= 2;
+  }
+
+  printf("%s    { \"name\": \"%s\", \"iterations\": %llu, \"ns_per_op\": %.2f, \"allocs_per_op\": %.4f }",
+         bFirst ? "" : ",\n", bench->name, (unsigned long long) nbIterations,
+         (double) duration / nbIterations, (double) nbAllocs / nbIterations);
+  fflush(stdout);
+}
+
+int main(int argc, char* argv[])
+{
+  const char* filter;
+  uint64_t minTime;
+  bool bFirst;
+  int opt;
+
+  filter = NULL;
+  minTime = BENCH_DEFAULT_MIN_TIME * MONOTONIC_NS_PER_MS;
+
+  while ((opt = getopt(argc, argv, "hf:t:")) != -1)
+  {
+    switch (opt)
+    {
+      case 'f':
+        filter = optarg;
+        break;
+
+      case 't':
+        minTime = strtoull(optarg, NULL, 0) * MONOTONIC_NS_PER_MS;
+        break;
+
+      case 'h':
+      default:
+        fprintf(stderr, "usage : %s [-f <name filter>] [-t <min time per benchmark in ms, default %d>]\n",
+                argv[0], BENCH_DEFAULT_MIN_TIME);
+        exit(EXIT_FAILURE);
+    }
+  }
+
+  bFirst = true;
+  printf("{\n  \"benchmarks\": [\n");
+  for (uint32_t i = 0; i < BENCH_NB_CASES; i++)
+  {
+    if ((filter != NULL) && (strstr(bench_cases[i].name, filter) == NULL))
+    {
+      continue;
+    }
+    bench_run(&bench_cases[i], minTime, bFirst);
+    bFirst = false;
+  }
+  printf("\n  ]\n}\n");
+
+  sensor_db_clear();
+  bench_cleanHistory();
+  return EXIT_SUCCESS;
+}
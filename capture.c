@@ -0,0 +1,315 @@
+#include "capture.h"
+#include "monotonic.h"
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define CAPTURE_MIN_SIZE        (4096)
+#define CAPTURE_ALIGN_UP(x)     (((x) + CAPTURE_ALIGN - 1) & ~(CAPTURE_ALIGN - 1))
+
+static bool capture_isValid(capture_header* header, uint32_t ringSize);
+static void capture_reset(capture_header* header, uint32_t ringSize);
+static uint32_t capture_getFreeSpace(capture_header* header);
+static void capture_dropOldest(capture_ring* capture);
+
+bool capture_open(capture_ring* capture, const char* path, uint32_t size)
+{
+  struct stat st;
+  uint32_t ringSize;
+  uint32_t mapSize;
+
+  assert(capture != NULL);
+  assert(path != NULL);
+
+  capture->fd = -1;
+  capture->map = NULL;
+  capture->header = NULL;
+  capture->ring = NULL;
+  capture->bEnabled = false;
+
+  ringSize = size & ~(CAPTURE_ALIGN - 1);
+  if (ringSize < CAPTURE_MIN_SIZE)
+  {
+    ringSize = CAPTURE_MIN_SIZE;
+  }
+  mapSize = CAPTURE_HEADER_SIZE + ringSize;
+
+  capture->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (capture->fd < 0)
+  {
+    syslog(LOG_ERR, "unable to open capture file '%s', errno = %d", path, errno);
+    return false;
+  }
+
+  //the blocks are allocated now, a full disk can't fault the writer later
+  if ((fstat(capture->fd, &st) != 0) ||
+      ((st.st_size != mapSize) &&
+       ((ftruncate(capture->fd, 0) != 0) || (posix_fallocate(capture->fd, 0, mapSize) != 0))))
+  {
+    syslog(LOG_ERR, "unable to size capture file '%s' to %u bytes", path, mapSize);
+    capture_close(capture);
+    return false;
+  }
+
+  capture->map = mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, capture->fd, 0);
+  if (capture->map == MAP_FAILED)
+  {
+    syslog(LOG_ERR, "unable to map capture file '%s', errno = %d", path, errno);
+    capture->map = NULL;
+    capture_close(capture);
+    return false;
+  }
+
+  capture->mapSize = mapSize;
+  capture->header = (capture_header*) capture->map;
+  capture->ring = capture->map + CAPTURE_HEADER_SIZE;
+  if (capture_isValid(capture->header, ringSize) == false)
+  {
+    capture_reset(capture->header, ringSize);
+  }
+
+  syslog(LOG_INFO, "capture file '%s', %u bytes ring, %llu frames already recorded", path, ringSize,
+         (unsigned long long) capture->header->nbRecords);
+  return true;
+}
+
+bool capture_openReadOnly(capture_ring* capture, const char* path)
+{
+  struct stat st;
+
+  assert(capture != NULL);
+  assert(path != NULL);
+
+  capture->map = NULL;
+  capture->header = NULL;
+  capture->ring = NULL;
+  capture->bEnabled = false;
+
+  capture->fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (capture->fd < 0)
+  {
+    syslog(LOG_ERR, "unable to open capture file '%s', errno = %d", path, errno);
+    return false;
+  }
+
+  if ((fstat(capture->fd, &st) != 0) || (st.st_size < (CAPTURE_HEADER_SIZE + CAPTURE_MIN_SIZE)))
+  {
+    syslog(LOG_ERR, "'%s' is not a capture file", path);
+    capture_close(capture);
+    return false;
+  }
+
+  capture->map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, capture->fd, 0);
+  if (capture->map == MAP_FAILED)
+  {
+    syslog(LOG_ERR, "unable to map capture file '%s', errno = %d", path, errno);
+    capture->map = NULL;
+    capture_close(capture);
+    return false;
+  }
+
+  capture->mapSize = st.st_size;
+  capture->header = (capture_header*) capture->map;
+  capture->ring = capture->map + CAPTURE_HEADER_SIZE;
+  if ((capture->mapSize != (CAPTURE_HEADER_SIZE + capture->header->ringSize)) ||
+      (capture_isValid(capture->header, capture->header->ringSize) == false))
+  {
+    syslog(LOG_ERR, "'%s' is not a valid capture file", path);
+    capture_close(capture);
+    return false;
+  }
+
+  return true;
+}
+
+const capture_record* capture_getNext(capture_ring* capture, uint32_t* offset)
+{
+  const capture_record* record;
+  uint32_t ringSize;
+  uint32_t head;
+  uint32_t remaining;
+  uint32_t length;
+
+  assert(capture != NULL);
+  assert(offset != NULL);
+
+  //the file may be truncated or rewritten while read: the mapping is the limit, not the header
+  ringSize = capture->mapSize - CAPTURE_HEADER_SIZE;
+  head = capture->header->head;
+  if (*offset == head)
+  {
+    return NULL;
+  }
+
+  if ((*offset > (ringSize - sizeof(capture_record))) || ((*offset % CAPTURE_ALIGN) != 0) || (head >= ringSize))
+  {
+    syslog(LOG_ERR, "capture record offset %d out of the ring", *offset);
+    return NULL;
+  }
+
+  //bytes up to the newest record: each record read gets closer to it, the walk always ends
+  remaining = (head + ringSize - *offset) % ringSize;
+  record = (const capture_record*) &capture->ring[*offset];
+  if ((record->direction == CAPTURE_DIR_PAD) && (*offset != 0) && ((ringSize - *offset) <= remaining))
+  {
+    *offset = 0;
+    return capture_getNext(capture, offset);
+  }
+
+  //same limits as capture_frame()
+  length = CAPTURE_ALIGN_UP(sizeof(capture_record) + record->size);
+  if (((record->direction != CAPTURE_DIR_RX) && (record->direction != CAPTURE_DIR_TX)) ||
+      (length > (ringSize / 2)) || (length > remaining) || ((*offset + length) > ringSize))
+  {
+    syslog(LOG_ERR, "invalid capture record at offset %d", *offset);
+    return NULL;
+  }
+
+  *offset += length;
+  if (*offset >= ringSize)
+  {
+    *offset = 0;
+  }
+  return record;
+}
+
+void capture_close(capture_ring* capture)
+{
+  assert(capture != NULL);
+
+  capture->bEnabled = false;
+  if (capture->map != NULL)
+  {
+    munmap(capture->map, capture->mapSize);
+    capture->map = NULL;
+    capture->header = NULL;
+    capture->ring = NULL;
+  }
+  if (capture->fd >= 0)
+  {
+    close(capture->fd);
+    capture->fd = -1;
+  }
+}
+
+void capture_setEnabled(capture_ring* capture, bool bEnabled)
+{
+  assert(capture != NULL);
+
+  //without a mapped file, there is nothing to enable
+  capture->bEnabled = (bEnabled == true) && (capture->map != NULL);
+  syslog(LOG_INFO, "frame capture %s", capture->bEnabled ? "enabled" : "disabled");
+}
+
+void capture_frame(capture_ring* capture, uint8_t direction, const uint8_t* frame, uint32_t size)
+{
+  capture_header* header;
+  capture_record* record;
+  uint32_t length;
+  uint32_t needed;
+
+  if ((capture == NULL) || (capture->bEnabled == false))
+  {
+    return;
+  }
+
+  header = capture->header;
+  length = CAPTURE_ALIGN_UP(sizeof(capture_record) + size);
+  if ((size > UINT16_MAX) || (length > (header->ringSize / 2)))
+  {
+    return;
+  }
+
+  //a record never wraps, the end of the ring is padded instead
+  needed = length;
+  if ((header->head + length) > header->ringSize)
+  {
+    needed += header->ringSize - header->head;
+  }
+
+  //head never reaches tail, head == tail means an empty ring
+  while (capture_getFreeSpace(header) <= needed)
+  {
+    capture_dropOldest(capture);
+  }
+
+  if (needed != length)
+  {
+    record = (capture_record*) &capture->ring[header->head];
+    record->timestamp = 0;
+    record->size = 0;
+    record->direction = CAPTURE_DIR_PAD;
+    header->head = 0;
+  }
+
+  record = (capture_record*) &capture->ring[header->head];
+  record->timestamp = monotonic_getTimeNs();
+  record->size = size;
+  record->direction = direction;
+  record->reserved = 0;
+  record->reserved2 = 0;
+  memcpy(&record[1], frame, size);
+
+  //the header is updated last, a reader never sees a half written record
+  header->head += length;
+  if (header->head >= header->ringSize)
+  {
+    header->head = 0;
+  }
+  header->nbRecords++;
+}
+
+static bool capture_isValid(capture_header* header, uint32_t ringSize)
+{
+  return ((memcmp(header->magic, CAPTURE_MAGIC, sizeof(header->magic)) == 0) &&
+          (header->version == CAPTURE_VERSION) &&
+          (header->headerSize == CAPTURE_HEADER_SIZE) &&
+          (header->ringSize == ringSize) &&
+          (header->head < ringSize) && ((header->head % CAPTURE_ALIGN) == 0) &&
+          (header->tail < ringSize) && ((header->tail % CAPTURE_ALIGN) == 0));
+}
+
+static void capture_reset(capture_header* header, uint32_t ringSize)
+{
+  memset(header, 0, CAPTURE_HEADER_SIZE);
+  memcpy(header->magic, CAPTURE_MAGIC, sizeof(header->magic));
+  header->version = CAPTURE_VERSION;
+  header->headerSize = CAPTURE_HEADER_SIZE;
+  header->ringSize = ringSize;
+}
+
+static uint32_t capture_getFreeSpace(capture_header* header)
+{
+  if (header->tail == header->head)
+  {
+    return header->ringSize;
+  }
+
+  return (header->tail + header->ringSize - header->head) % header->ringSize;
+}
+
+static void capture_dropOldest(capture_ring* capture)
+{
+  capture_header* header;
+  capture_record* record;
+
+  header = capture->header;
+  record = (capture_record*) &capture->ring[header->tail];
+  if (record->direction == CAPTURE_DIR_PAD)
+  {
+    header->tail = 0;
+    return;
+  }
+
+  header->tail += CAPTURE_ALIGN_UP(sizeof(capture_record) + record->size);
+  if (header->tail >= header->ringSize)
+  {
+    header->tail = 0;
+  }
+  header->nbOverwritten++;
+}
@@ -0,0 +1,98 @@
+#ifndef __CAPTURE_H__
+#define __CAPTURE_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * Capture of the API frames exchanged with the radio, in a memory mapped ring file.
+ * Recording a frame is a memcpy in the page cache, no system call: the capture can
+ * stay on at full traffic, and the file is still complete when the daemon crashes.
+ *
+ * File format, all fields in host byte order (little endian on the supported targets):
+ *
+ *   offset 0, header (capture_header, CAPTURE_HEADER_SIZE bytes)
+ *     magic       8 bytes  "ZBCAPTUR"
+ *     version     uint32   CAPTURE_VERSION
+ *     headerSize  uint32   offset of the ring, CAPTURE_HEADER_SIZE
+ *     ringSize    uint32   size of the ring in bytes, multiple of CAPTURE_ALIGN
+ *     head        uint32   ring offset where the next record will be written
+ *     tail        uint32   ring offset of the oldest record, equal to head when empty
+ *     reserved    uint32
+ *     nbRecords   uint64   frames recorded since the file creation
+ *     nbOverwritten uint64 frames lost because the ring wrapped
+ *     padding up to CAPTURE_HEADER_SIZE
+ *
+ *   offset headerSize, ring of records, from tail to head (wrapping at ringSize):
+ *     timestamp   uint64   CLOCK_MONOTONIC, in ns
+ *     size        uint16   frame size in bytes, delimiter and checksum included
+ *     direction   uint8    CAPTURE_DIR_xxx
+ *     reserved    uint8
+ *     reserved    uint32
+ *     frame       size bytes, unescaped API frame
+ *     padding up to the next CAPTURE_ALIGN boundary
+ *
+ * A record never wraps: when it doesn't fit before the end of the ring, a CAPTURE_DIR_PAD
+ * record (size 0) fills the rest and the record starts at offset 0.
+ */
+
+#define CAPTURE_MAGIC           "ZBCAPTUR"
+#define CAPTURE_VERSION         (1)
+#define CAPTURE_HEADER_SIZE     (64)
+#define CAPTURE_ALIGN           (16)
+#define CAPTURE_DEFAULT_SIZE    (1024 * 1024)
+
+#define CAPTURE_DIR_RX          (0)
+#define CAPTURE_DIR_TX          (1)
+#define CAPTURE_DIR_PAD         (0xFF) //end of ring, the next record is at offset 0
+
+typedef struct
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t headerSize;
+  uint32_t ringSize;
+  uint32_t head;
+  uint32_t tail;
+  uint32_t reserved;
+  uint64_t nbRecords;
+  uint64_t nbOverwritten;
+} capture_header;
+
+typedef struct
+{
+  uint64_t timestamp;
+  uint16_t size;
+  uint8_t direction;
+  uint8_t reserved;
+  uint32_t reserved2;
+} capture_record;
+
+typedef struct
+{
+  int32_t fd;
+  uint8_t* map;
+  uint32_t mapSize;
+  capture_header* header;
+  uint8_t* ring;
+  bool bEnabled;
+} capture_ring;
+
+/**
+ * map the capture file, created with the given size when it doesn't exist or doesn't match.
+ * An existing capture of the same size is continued. The capture starts disabled.
+ */
+extern bool capture_open(capture_ring* capture, const char* path, uint32_t size);
+extern void capture_close(capture_ring* capture);
+extern void capture_setEnabled(capture_ring* capture, bool bEnabled);
+extern void capture_frame(capture_ring* capture, uint8_t direction, const uint8_t* frame, uint32_t size);
+
+/**
+ * Reading side: map an existing capture read only, then walk the records from the oldest one,
+ * offset starts at header->tail. capture_getNext() returns NULL after the newest record,
+ * the frame follows its record header.
+ */
+extern bool capture_openReadOnly(capture_ring* capture, const char* path);
+extern const capture_record* capture_getNext(capture_ring* capture, uint32_t* offset);
+
+#endif /* __CAPTURE_H__ */
@@ -7,8 +7,19 @@
 #include <string.h>
 #include <stdlib.h>
 #include "zigbee.h"
+#include "sink.h"
 
 char* config_scriptName;
+bool config_script_persistent;
+uint32_t config_sink_workers;
+uint32_t config_sink_queue_size;
+uint8_t config_sink_overflow;
+uint32_t config_sink_batch_max;
+uint32_t config_sink_batch_delay;
+char* config_spool_dir;
+uint32_t config_spool_max_size;
+char* config_history_dir;
+uint32_t config_history_max_segments;
 char* config_ttydevice;
 char* config_gpio_reset;
 char* config_device;
@@ -19,6 +30,15 @@ char* config_fifo_name;
 uint16_t config_scan_channel;
 char* config_gpio_ctrl_name;
 uint32_t config_gpio_line;
+uint32_t config_baudrate;
+bool config_rtscts;
+uint8_t config_api_mode;
+char* config_capture_file;
+uint32_t config_capture_size;
+bool config_capture;
+char* config_metrics_file;
+uint32_t config_metrics_period;
+char* config_metrics_socket;
 
 static int32_t configfile_doRead(FILE* f);
 static int32_t configfile_decodeLine(char line[]);
@@ -265,6 +285,128 @@ static int32_t configfile_createConfig(char key[], char value[])
     assert(config_scriptName != NULL);
     strcpy(config_scriptName, value);
   }
+  else if (strcmp(key, "script_persistent") == 0)
+  {
+    uint32_t v;
+    v = strtoul(value, &endConversion, 0);
+    if (*endConversion == '\0')
+    {
+      config_script_persistent = (v != 0);
+    }
+    else
+    {
+      rc = -1;
+    }
+  }
+  else if (strcmp(key, "sink_workers") == 0)
+  {
+    uint32_t v;
+    v = strtoul(value, &endConversion, 0);
+    if (*endConversion == '\0')
+    {
+      config_sink_workers = v;
+    }
+    else
+    {
+      rc = -1;
+    }
+  }
+  else if (strcmp(key, "sink_queue_size") == 0)
+  {
+    uint32_t v;
+    v = strtoul(value, &endConversion, 0);
+    if ((*endConversion == '\0') && (v != 0))
+    {
+      config_sink_queue_size = v;
+    }
+    else
+    {
+      rc = -1;
+    }
+  }
+  else if (strcmp(key, "sink_overflow") == 0)
+  {
+    if (strcmp(value, "drop_oldest") == 0)
+    {
+      config_sink_overflow = SINK_OVERFLOW_DROP_OLDEST;
+    }
+    else if (strcmp(value, "drop_newest") == 0)
+    {
+      config_sink_overflow = SINK_OVERFLOW_DROP_NEWEST;
+    }
+    else if (strcmp(value, "block") == 0)
+    {
+      config_sink_overflow = SINK_OVERFLOW_BLOCK;
+    }
+    else
+    {
+      rc = -1;
+    }
+  }
+  else if (strcmp(key, "sink_batch_max") == 0)
+  {
+    uint32_t v;
+    v = strtoul(value, &endConversion, 0);
+    if (*endConversion == '\0')
+    {
+      config_sink_batch_max = v;
+    }
+    else
+    {
+      rc = -1;
+    }
+  }
+  else if (strcmp(key, "sink_batch_delay") == 0)
+  {
+    uint32_t v;
+    v = strtoul(value, &endConversion, 0);
+    if ((*endConversion == '\0') && (v != 0))
+    {
+      config_sink_batch_delay = v;
+    }
+    else
+    {
+      rc = -1;
+    }
+  }
+  else if (strcmp(key, "spool_dir") == 0)
+  {
+    config_spool_dir = malloc(strlen(value) + 1);
+    assert(config_spool_dir != NULL);
+    strcpy(config_spool_dir, value);
+  }
+  else if (strcmp(key, "spool_max_size") == 0)
+  {
+    uint32_t v;
+    v = strtoul(value, &endConversion, 0);
+    if ((*endConversion == '\0') && (v != 0))
+    {
+      config_spool_max_size = v;
+    }
+    else
+    {
+      rc = -1;
+    }
+  }
+  else if (strcmp(key, "history_dir") == 0)
+  {
+    config_history_dir = malloc(strlen(value) + 1);
+    assert(config_history_dir != NULL);
+    strcpy(config_history_dir, value);
+  }
+  else if (strcmp(key, "history_max_segments") == 0)
+  {
+    uint32_t v;
+    v = strtoul(value, &endConversion, 0);
+    if ((*endConversion == '\0') && (v != 0))
+    {
+      config_history_max_segments = v;
+    }
+    else
+    {
+      rc = -1;
+    }
+  }
   else if (strcmp(key, "ttydevice") == 0)
   {
     config_ttydevice = malloc(strlen(value) + 1);
@@ -330,6 +472,102 @@ static int32_t configfile_createConfig(char key[], char value[])
       config_scan_channel = ZIGGEE_DEFAULT_BITMASK;
     }
   }
+  else if (strcmp(key, "rtscts") == 0)
+  {
+    uint32_t v;
+    v = strtoul(value, &endConversion, 0);
+    if (*endConversion == '\0')
+    {
+      config_rtscts = (v != 0);
+    }
+    else
+    {
+      rc = -1;
+    }
+  }
+  else if (strcmp(key, "baudrate") == 0)
+  {
+    uint32_t v;
+    v = strtoul(value, &endConversion, 0);
+    if (*endConversion == '\0')
+    {
+      config_baudrate = v;
+    }
+    else
+    {
+      rc = -1;
+    }
+  }
+  else if (strcmp(key, "api_mode") == 0)
+  {
+    uint32_t v;
+    v = strtoul(value, &endConversion, 0);
+    if ((*endConversion == '\0') && ((v == 1) || (v == 2)))
+    {
+      config_api_mode = (uint8_t) v;
+    }
+    else
+    {
+      rc = -1;
+    }
+  }
+  else if (strcmp(key, "capture_file") == 0)
+  {
+    config_capture_file = malloc(strlen(value) + 1);
+    assert(config_capture_file != NULL);
+    strcpy(config_capture_file, value);
+  }
+  else if (strcmp(key, "capture_size") == 0)
+  {
+    uint32_t v;
+    v = strtoul(value, &endConversion, 0);
+    if (*endConversion == '\0')
+    {
+      config_capture_size = v;
+    }
+    else
+    {
+      rc = -1;
+    }
+  }
+  else if (strcmp(key, "capture") == 0)
+  {
+    uint32_t v;
+    v = strtoul(value, &endConversion, 0);
+    if (*endConversion == '\0')
+    {
+      config_capture = (v != 0);
+    }
+    else
+    {
+      rc = -1;
+    }
+  }
+  else if (strcmp(key, "metrics_file") == 0)
+  {
+    config_metrics_file = malloc(strlen(value) + 1);
+    assert(config_metrics_file != NULL);
+    strcpy(config_metrics_file, value);
+  }
+  else if (strcmp(key, "metrics_period") == 0)
+  {
+    uint32_t v;
+    v = strtoul(value, &endConversion, 0);
+    if ((*endConversion == '\0') && (v != 0))
+    {
+      config_metrics_period = v;
+    }
+    else
+    {
+      rc = -1;
+    }
+  }
+  else if (strcmp(key, "metrics_socket") == 0)
+  {
+    config_metrics_socket = malloc(strlen(value) + 1);
+    assert(config_metrics_socket != NULL);
+    strcpy(config_metrics_socket, value);
+  }
   else
   {
     rc = -1;
@@ -4,8 +4,19 @@
 #define __CONFIGFILE_H__
 
 #include <stdint.h>
+#include <stdbool.h>
 
 extern char* config_scriptName;
+extern bool config_script_persistent;
+extern uint32_t config_sink_workers;
+extern uint32_t config_sink_queue_size;
+extern uint8_t config_sink_overflow;
+extern uint32_t config_sink_batch_max;
+extern uint32_t config_sink_batch_delay;
+extern char* config_spool_dir;
+extern uint32_t config_spool_max_size;
+extern char* config_history_dir;
+extern uint32_t config_history_max_segments;
 extern uint8_t* config_panID;
 extern uint32_t config_nbPanID;
 extern char* config_ttydevice;
@@ -16,6 +27,15 @@ extern char* config_fifo_name;
 extern uint16_t config_scan_channel;
 extern char* config_gpio_ctrl_name;
 extern uint32_t config_gpio_line;
+extern uint32_t config_baudrate;
+extern bool config_rtscts;
+extern uint8_t config_api_mode;
+extern char* config_capture_file;
+extern uint32_t config_capture_size;
+extern bool config_capture;
+extern char* config_metrics_file;
+extern uint32_t config_metrics_period;
+extern char* config_metrics_socket;
 
 extern int32_t configfile_read(const char filename[]);
 
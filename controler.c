@@ -18,16 +18,39 @@
 #include "daemonize.h"
 #include "unused.h"
 #include "webcmd.h"
-
-static int32_t configure(zigbee_obj* zigbee, zigbee_panID* panID, uint16_t scan_channel, bool bWriteData);
-static void read_hardware_data(zigbee_obj* obj);
+#include "capture.h"
+#include "latency.h"
+#include "metrics.h"
+#include "sink.h"
+#include "spool.h"
+#include "history.h"
+#include <errno.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+#include "monotonic.h"
+
+static void fill_config(zigbee_config* config, zigbee_panID* panID, uint16_t scan_channel, bool bWriteData);
+static bool warm_start(zigbee_obj* zigbee, zigbee_config* config);
+static bool detect_radio(zigbee_obj* zigbee, zigbee_config* config);
+static void reset_radio(zigbee_obj* zigbee);
+static int32_t configure(zigbee_obj* zigbee, zigbee_config* config);
+static void log_hardware_data(zigbee_hwInfo* hwInfo);
 static void run(zigbee_obj* zigbee);
+static void sendWebCommand(zigbee_obj* zigbee, webmsg* commandToSend);
+static int32_t createSignalFd(void);
+static bool handleSignal(int32_t signalFd);
+static void armTimer(int32_t timerFd, uint64_t deadline, uint64_t* armedDeadline);
+static void updateSerialEvents(int32_t epollFd, zigbee_obj* zigbee, uint32_t* serialEvents);
 static void traceRFStrength(zb_handle_status statusH);
 static void onDataCallBack(zigbee_obj* obj, zigbee_decodedFrame* pFrame);
 
 #define ZB_BUFFER_SIZE      (100)
 
 static uint8_t zb_buffer[ZB_BUFFER_SIZE];
+static capture_ring zb_capture; //toggled by SIGUSR1
+static bool zb_bCaptureOpened = false;
 
 
 int main(int argc, char* argv[])
@@ -39,15 +62,20 @@ int main(int argc, char* argv[])
   char* configFile;
   bool bAsDaemon;
   bool bWriteConfig;
+  bool bColdStart;
+  bool bJoined;
   int32_t baudRate;
+  uint64_t startTime;
+  zigbee_config config;
 
   int opt;
   bAsDaemon = false;
   configFile = NULL;
   bWriteConfig = false;
-  baudRate = 115200; //by default if device already configurated set to 115200
+  bColdStart = false;
+  baudRate = ZIGBEE_DEFAULT_SERIAL_SPEED; //by default if device already configurated set to 115200
 
-  while ((opt = getopt(argc, argv, "whdc:b:")) != -1)
+  while ((opt = getopt(argc, argv, "whfdc:b:")) != -1)
   {
     switch (opt)
     {
@@ -63,6 +91,10 @@ int main(int argc, char* argv[])
         bWriteConfig = true;
         break;
 
+      case 'f':
+        bColdStart = true;
+        break;
+
       case 'b':
         baudRate = atoi(optarg); // Note: default speed of zigbee device is 9600
         break;
@@ -70,7 +102,7 @@ int main(int argc, char* argv[])
       case 'h':
       default:
         fprintf(stderr,
-                "usage : %s -c <config file> (-d -> for daemonize) -w --> write data on zb -b <initial serial speed, default:115200> \n",
+                "usage : %s -c <config file> (-d -> for daemonize) -w --> write data on zb -f --> force reset and configuration -b <first serial speed tried, default:115200> \n",
                 argv[0]);
         exit(EXIT_FAILURE);
     }
@@ -109,27 +141,25 @@ int main(int argc, char* argv[])
   openlog("zb_controler", 0, LOG_USER);
   syslog(LOG_INFO, "starting...");
 
-  //first, start by reset the zb component
 #ifdef GPIO_OLD_API
   if (config_gpio_reset == NULL)
-  {
-    fprintf(stderr, "config file (gpio) is not complete\n");
-    exit(EXIT_FAILURE);
-  }
-  gpio_reset(config_gpio_reset);
 #else
   if (config_gpio_ctrl_name == NULL)
+#endif /* GPIO_OLD_API */
   {
     fprintf(stderr, "config file (gpio) is not complete\n");
     exit(EXIT_FAILURE);
   }
+
+#ifndef GPIO_OLD_API
   gpio_init();
-  int32_t fd_gpio;
-  fd_gpio = gpio_configure_output(config_gpio_ctrl_name, config_gpio_line, 0);
-  gpio_perform_reset(fd_gpio);
 #endif /* GPIO_OLD_API */
 
-  fd = serial_setup(config_ttydevice, baudRate, SERIAL_PARITY_OFF, SERIAL_RTSCTS_OFF, SERIAL_STOPNB_1);
+  //the restart downtime is measured from here
+  startTime = monotonic_getTimeNs();
+
+  fd = serial_setup(config_ttydevice, baudRate, SERIAL_PARITY_OFF,
+                    config_rtscts ? SERIAL_RTSCTS_ON : SERIAL_RTSCTS_OFF, SERIAL_STOPNB_1);
   if (fd < 0)
   {
     syslog(LOG_EMERG, "not possible to configurate serial line '%s'", config_ttydevice);
@@ -143,36 +173,94 @@ int main(int argc, char* argv[])
     exit(EXIT_FAILURE);
   }
 
-  zigbee_protocol_initialize(&zigbee, fd, zb_buffer, ZB_BUFFER_SIZE, onDataCallBack);
-  read_hardware_data(&zigbee);
+  zigbee_protocol_initialize(&zigbee, fd, baudRate, zb_buffer, ZB_BUFFER_SIZE, onDataCallBack);
+  zigbee_protocol_setFlowControl(&zigbee, config_rtscts);
+  fill_config(&config, &panID, config_scan_channel, bWriteConfig);
+  zigbee_protocol_setApiMode(&zigbee, config.apiMode);
 
-  status = configure(&zigbee, &panID, config_scan_channel, bWriteConfig);
-  if (status == 0)
+  if (config_capture_file != NULL)
   {
-    status = zigbee_protocol_setNodeIdentifier(&zigbee, "ZBC1");
+    zb_bCaptureOpened = capture_open(&zb_capture, config_capture_file,
+                                     (config_capture_size != 0) ? config_capture_size : CAPTURE_DEFAULT_SIZE);
+    if (zb_bCaptureOpened == true)
+    {
+      zigbee_protocol_setCapture(&zigbee, &zb_capture);
+      capture_setEnabled(&zb_capture, config_capture);
+    }
   }
 
-  if (status == 0)
+  //the radio keeps its configuration and its association over a daemon restart
+  bJoined = false;
+  if ((bColdStart == false) && (bWriteConfig == false) && (detect_radio(&zigbee, &config) == true) &&
+      (zigbee.baudRate == config.baudRate) && (zigbee.apiMode == config.apiMode))
   {
-    status = zigbee_protocol_startJoinNetwork(&zigbee, ZIGBEE_JOINING_ALWAYS_ACTIVATED);
+    bJoined = warm_start(&zigbee, &config);
   }
 
-  if (status == 0)
+  status = 0;
+  indicationStatus = 0;
+  if (bJoined == false)
   {
-    syslog(LOG_INFO, "Network activated, wait for end of scanning");
-    status = zigbee_protocol_waitEndOfAssociation(&zigbee, &indicationStatus);
-    syslog(LOG_INFO, "Network association activated status = 0x%x, joining status = 0x%x", status, indicationStatus);
+    //after a reset, the radio runs at the speed saved in its flash
+    reset_radio(&zigbee);
+    if (detect_radio(&zigbee, &config) == false)
+    {
+      syslog(LOG_EMERG, "no answer from the radio on '%s'", config_ttydevice);
+      exit(EXIT_FAILURE);
+    }
+
+    status = configure(&zigbee, &config);
+    if (status == 0)
+    {
+      syslog(LOG_INFO, "Network activated, wait for end of scanning");
+      status = zigbee_protocol_waitEndOfAssociation(&zigbee, &indicationStatus);
+      syslog(LOG_INFO, "Network association activated status = 0x%x, joining status = 0x%x", status, indicationStatus);
+    }
   }
 
   if ((status == 0) && (indicationStatus == 0))
   {
+    syslog(LOG_INFO, "joined %llu ms after start (%s)",
+           (unsigned long long) ((monotonic_getTimeNs() - startTime) / MONOTONIC_NS_PER_MS),
+           bJoined ? "warm start" : "cold start");
+
+    if (config_spool_dir != NULL)
+    {
+      spool_open(config_spool_dir,
+                 ((uint64_t) ((config_spool_max_size != 0) ? config_spool_max_size : SPOOL_DEFAULT_MAX_SIZE)) * 1024);
+    }
+    if (config_history_dir != NULL)
+    {
+      history_open(config_history_dir,
+                   (config_history_max_segments != 0) ? config_history_max_segments : HISTORY_DEFAULT_MAX_SEGMENTS);
+    }
+    sink_init(config_scriptName, config_script_persistent);
+    if (config_sink_batch_max != 0)
+    {
+      sink_setBatching(config_sink_batch_max,
+                       (config_sink_batch_delay != 0) ? config_sink_batch_delay : SINK_DEFAULT_BATCH_DELAY);
+    }
+    if (config_sink_workers != 0)
+    {
+      sink_startWorkers(config_sink_workers,
+                        (config_sink_queue_size != 0) ? config_sink_queue_size : SINK_DEFAULT_QUEUE,
+                        (sink_overflowPolicy) config_sink_overflow);
+    }
     run(&zigbee);
+    sink_close();
+    spool_close();
+    history_close();
   }
   else
   {
     syslog(LOG_EMERG, "configuration error %s", zigbee_get_indicationError(indicationStatus));
   }
 
+  if (zb_bCaptureOpened == true)
+  {
+    capture_close(&zb_capture);
+  }
+
   closelog();
 
 #ifndef GPIO_OLD_API
@@ -183,6 +271,16 @@ int main(int argc, char* argv[])
 }
 
 #define MAX_SIZE_FRAME (50)
+#define MAX_EVENTS     (8)
+
+typedef enum
+{
+  EVENT_SERIAL,
+  EVENT_WEBCMD,
+  EVENT_TIMER,
+  EVENT_SIGNAL,
+  EVENT_METRICS
+} event_source;
 
 static void run(zigbee_obj* zigbee)
 {
@@ -191,8 +289,21 @@ static void run(zigbee_obj* zigbee)
   zigbee_panID currentPanID;
   uint8_t operatingChannel;
   webmsg commandToSend;
-  bool hasReceivedCommand;
-  uint8_t zbPayload[MAX_SIZE_FRAME];
+  struct epoll_event event;
+  struct epoll_event events[MAX_EVENTS];
+  int32_t epollFd;
+  int32_t timerFd;
+  int32_t signalFd;
+  int32_t metricsFd;
+  int32_t nbEvents;
+  int32_t i;
+  uint64_t expirations;
+  uint64_t armedDeadline;
+  uint64_t deadline;
+  uint64_t metricsDeadline; //0 when no metrics file
+  uint64_t metricsPeriod;
+  uint32_t serialEvents;
+  bool bRunning;
 
   status = zigbee_protocol_getPanID(zigbee, &currentPanID);
   if (status == 0)
@@ -211,37 +322,271 @@ static void run(zigbee_obj* zigbee)
     syslog(LOG_INFO, "operatingChannel = %d", operatingChannel);
   }
 
+  epollFd = epoll_create1(EPOLL_CLOEXEC);
+  timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  signalFd = createSignalFd();
+  if ((epollFd < 0) || (timerFd < 0) || (signalFd < 0))
+  {
+    syslog(LOG_EMERG, "unable to create event loop (errno = %d)", errno);
+    return;
+  }
+
+  memset(&event, 0, sizeof(event));
+  event.events = EPOLLIN;
+  event.data.u32 = EVENT_SERIAL;
+  epoll_ctl(epollFd, EPOLL_CTL_ADD, zigbee->fd, &event);
+  event.data.u32 = EVENT_WEBCMD;
+  epoll_ctl(epollFd, EPOLL_CTL_ADD, webcmd_getFd(), &event);
+  event.data.u32 = EVENT_TIMER;
+  epoll_ctl(epollFd, EPOLL_CTL_ADD, timerFd, &event);
+  event.data.u32 = EVENT_SIGNAL;
+  epoll_ctl(epollFd, EPOLL_CTL_ADD, signalFd, &event);
+
+  metricsFd = -1;
+  if (config_metrics_socket != NULL)
+  {
+    metricsFd = metrics_openSocket(config_metrics_socket);
+    if (metricsFd >= 0)
+    {
+      event.data.u32 = EVENT_METRICS;
+      epoll_ctl(epollFd, EPOLL_CTL_ADD, metricsFd, &event);
+    }
+  }
+
+  metricsPeriod = ((config_metrics_period != 0) ? config_metrics_period : METRICS_DEFAULT_PERIOD) *
+                  MONOTONIC_NS_PER_S;
+  //first file written right away
+  metricsDeadline = (config_metrics_file != NULL) ? monotonic_getTimeNs() : 0;
+
+  armedDeadline = 0;
+  serialEvents = EPOLLIN;
+  bRunning = true;
+
   syslog(LOG_INFO, "Ready, waiting for data reception");
-  while (1)
+  while (bRunning)
   {
-    statusH = zigbee_handle(zigbee);
-    traceRFStrength(statusH);
-    hasReceivedCommand = webcmd_checkMsg(&commandToSend);
-    if (hasReceivedCommand)
+    //no deadline means no timer, an idle daemon stays asleep
+    deadline = zigbee_getNextTimeout(zigbee);
+    if ((sink_getNextTimeout() != 0) && ((deadline == 0) || (sink_getNextTimeout() < deadline)))
     {
-      //send command to xb device.
-      syslog(LOG_INFO, "Command received from web serveur (%x,%x,%x,%x,%x,%x,%x,%x):%d:%d",
-             commandToSend.zbAddress[0], commandToSend.zbAddress[1], commandToSend.zbAddress[2],
-             commandToSend.zbAddress[3], commandToSend.zbAddress[4], commandToSend.zbAddress[5],
-             commandToSend.zbAddress[6], commandToSend.zbAddress[7],
-             commandToSend.sensor_id, commandToSend.command);
-
-      uint32_t size;
-      size = sensor_build_command(&commandToSend, zbPayload, MAX_SIZE_FRAME);
-      if (size != 0)
+      deadline = sink_getNextTimeout();
+    }
+    if ((metricsDeadline != 0) && ((deadline == 0) || (metricsDeadline < deadline)))
+    {
+      deadline = metricsDeadline;
+    }
+    armTimer(timerFd, deadline, &armedDeadline);
+    //only watch writability while frames are queued
+    updateSerialEvents(epollFd, zigbee, &serialEvents);
+
+    nbEvents = epoll_wait(epollFd, events, MAX_EVENTS, -1);
+    if (nbEvents < 0)
+    {
+      if (errno != EINTR)
       {
-        zigbee_protocol_sendData(zigbee,
-                                 &commandToSend.zbAddress,
-                                 ZIGBEE_UNKNOWN_16B_ADDR,
-                                 zbPayload,
-                                 size);
+        syslog(LOG_EMERG, "epoll_wait failed (errno = %d)", errno);
+        bRunning = false;
       }
-      else
+      continue;
+    }
+
+    for (i = 0; i < nbEvents; i++)
+    {
+      switch (events[i].data.u32)
       {
-        syslog(LOG_INFO, "can't send data 'sensor_build_command' returns 0");
+        case EVENT_SERIAL:
+          if (events[i].events & EPOLLOUT)
+          {
+            zigbee_handleOutput(zigbee);
+          }
+          if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+          {
+            statusH = zigbee_handleInput(zigbee);
+            traceRFStrength(statusH);
+          }
+          break;
+
+        case EVENT_WEBCMD:
+          webcmd_handleInput();
+          while (webcmd_getMessage(&commandToSend))
+          {
+            sendWebCommand(zigbee, &commandToSend);
+          }
+          break;
+
+        case EVENT_TIMER:
+          if (read(timerFd, &expirations, sizeof(expirations)) > 0)
+          {
+            armedDeadline = 0;
+            zigbee_handleTimeout(zigbee);
+            sink_handleTimeout();
+          }
+          if ((metricsDeadline != 0) && (monotonic_getTimeNs() >= metricsDeadline))
+          {
+            metrics_writeFile(zigbee, config_metrics_file);
+            metricsDeadline = monotonic_getTimeNs() + metricsPeriod;
+          }
+          break;
+
+        case EVENT_SIGNAL:
+          bRunning = handleSignal(signalFd);
+          break;
+
+        case EVENT_METRICS:
+          metrics_handleConnection(metricsFd, zigbee);
+          break;
+
+        default:
+          assert(false);
+          break;
       }
     }
   }
+
+  syslog(LOG_INFO, "%d frames sent in %d writes, %d partial writes, %d busy line, %d CTS stalls (%llu ms)",
+         zigbee->txStats.nbFrames, zigbee->txStats.nbWrites, zigbee->txStats.nbPartialWrites,
+         zigbee->txStats.nbWouldBlock,
+         zigbee->txStats.nbStalls, (unsigned long long) (zigbee->txStats.stallTime / MONOTONIC_NS_PER_MS));
+
+  if (metricsFd >= 0)
+  {
+    metrics_closeSocket(metricsFd, config_metrics_socket);
+  }
+  close(signalFd);
+  close(timerFd);
+  close(epollFd);
+}
+
+static void sendWebCommand(zigbee_obj* zigbee, webmsg* commandToSend)
+{
+  uint8_t zbPayload[MAX_SIZE_FRAME];
+  uint32_t size;
+
+  //send command to xb device.
+  syslog(LOG_INFO, "Command received from web serveur (%x,%x,%x,%x,%x,%x,%x,%x):%d:%d",
+         commandToSend->zbAddress[0], commandToSend->zbAddress[1], commandToSend->zbAddress[2],
+         commandToSend->zbAddress[3], commandToSend->zbAddress[4], commandToSend->zbAddress[5],
+         commandToSend->zbAddress[6], commandToSend->zbAddress[7],
+         commandToSend->sensor_id, commandToSend->command);
+
+  size = sensor_build_command(commandToSend, zbPayload, MAX_SIZE_FRAME);
+  if (size != 0)
+  {
+    zigbee_protocol_sendData(zigbee,
+                             &commandToSend->zbAddress,
+                             ZIGBEE_UNKNOWN_16B_ADDR,
+                             zbPayload,
+                             size);
+  }
+  else
+  {
+    syslog(LOG_INFO, "can't send data 'sensor_build_command' returns 0");
+  }
+}
+
+static int32_t createSignalFd(void)
+{
+  sigset_t mask;
+
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGINT);
+  sigaddset(&mask, SIGTERM);
+  sigaddset(&mask, SIGHUP);
+  sigaddset(&mask, SIGUSR1);
+  sigaddset(&mask, SIGUSR2);
+  sigaddset(&mask, SIGCHLD);
+  if (sigprocmask(SIG_BLOCK, &mask, NULL) != 0)
+  {
+    return -1;
+  }
+
+  return signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+}
+
+static bool handleSignal(int32_t signalFd)
+{
+  struct signalfd_siginfo info;
+  bool bContinue;
+
+  bContinue = true;
+  while (read(signalFd, &info, sizeof(info)) == sizeof(info))
+  {
+    switch (info.ssi_signo)
+    {
+      case SIGINT:
+      case SIGTERM:
+        syslog(LOG_INFO, "signal %d received, stopping...", info.ssi_signo);
+        bContinue = false;
+        break;
+
+      case SIGUSR1:
+        if (zb_bCaptureOpened == true)
+        {
+          capture_setEnabled(&zb_capture, !zb_capture.bEnabled);
+        }
+        else
+        {
+          syslog(LOG_INFO, "no capture file configured, SIGUSR1 ignored");
+        }
+        break;
+
+      case SIGUSR2:
+        latency_dump();
+        break;
+
+      case SIGCHLD:
+        sink_checkChild();
+        break;
+
+      default:
+        syslog(LOG_INFO, "signal %d received, ignored", info.ssi_signo);
+        break;
+    }
+  }
+
+  return bContinue;
+}
+
+static void armTimer(int32_t timerFd, uint64_t deadline, uint64_t* armedDeadline)
+{
+  struct itimerspec timerValue;
+
+  if (deadline == *armedDeadline)
+  {
+    return;
+  }
+
+  //deadline == 0 disarms the timer
+  memset(&timerValue, 0, sizeof(timerValue));
+  timerValue.it_value.tv_sec = deadline / MONOTONIC_NS_PER_S;
+  timerValue.it_value.tv_nsec = deadline % MONOTONIC_NS_PER_S;
+  if (timerfd_settime(timerFd, TFD_TIMER_ABSTIME, &timerValue, NULL) == 0)
+  {
+    *armedDeadline = deadline;
+  }
+}
+
+static void updateSerialEvents(int32_t epollFd, zigbee_obj* zigbee, uint32_t* serialEvents)
+{
+  struct epoll_event event;
+  uint32_t wantedEvents;
+
+  wantedEvents = EPOLLIN;
+  if (zigbee_hasPendingOutput(zigbee))
+  {
+    wantedEvents |= EPOLLOUT;
+  }
+
+  if (wantedEvents != *serialEvents)
+  {
+    memset(&event, 0, sizeof(event));
+    event.events = wantedEvents;
+    event.data.u32 = EVENT_SERIAL;
+    if (epoll_ctl(epollFd, EPOLL_CTL_MOD, zigbee->fd, &event) == 0)
+    {
+      *serialEvents = wantedEvents;
+    }
+  }
 }
 
 static void traceRFStrength(zb_handle_status statusH)
@@ -265,30 +610,103 @@ void onDataCallBack(zigbee_obj* obj, zigbee_decodedFrame* pFrame)
 }
 
 
-static int32_t configure(zigbee_obj* zigbee, zigbee_panID* panID, uint16_t scan_channel, bool bWriteData)
+static void fill_config(zigbee_config* config, zigbee_panID* panID, uint16_t scan_channel, bool bWriteData)
 {
-  zigbee_config config;
+  memcpy(&config->panID, panID, sizeof(zigbee_panID));
+  config->baudRate = (config_baudrate != 0) ? config_baudrate : ZIGBEE_DEFAULT_SERIAL_SPEED;
+  config->rtscts = config_rtscts;
+  config->apiMode = (config_api_mode != 0) ? config_api_mode : ZIGBEE_API_MODE_UNESCAPED;
+  config->channelBitMask = scan_channel;
+  config->scanDuration = ZIGBEE_DEFAULT_SCAN_DURATION_EXPONENT;
+  config->stackProfile = ZIGBEE_DEFAULT_STACK_PROFILE;
+  config->encryption = false;
+  memcpy(&config->networkKey, zigbee_randomEncryptionKey, sizeof(zigbee_encryptionKey));
+  memcpy(&config->linkKey, zigbee_noLinkKey, sizeof(zigbee_linkKey));
+
+  config->sleepPeriod = 0xA08; //25,6s
+  config->nbSleepPeriod = 12; //12*25.6 = 308s -~> 5mn
+  config->nodeIdentifier = "ZBC1";
+  config->joinTime = ZIGBEE_JOINING_ALWAYS_ACTIVATED;
+  config->writeData = bWriteData;
+
+  //   config->sleepPeriod = 0xAF0; //28s
+  //   config->nbSleepPeriod = 11; //11*28 = 308s -~> 5mn
+}
+
+static bool warm_start(zigbee_obj* zigbee, zigbee_config* config)
+{
+  zigbee_hwInfo hwInfo;
   zb_status status;
-  int32_t rc;
+  bool bUpToDate;
+  uint8_t indicationStatus;
 
-  memcpy(&config.panID, panID, sizeof(zigbee_panID));
-  config.channelBitMask = scan_channel;
-  config.scanDuration = ZIGBEE_DEFAULT_SCAN_DURATION_EXPONENT;
-  config.stackProfile = ZIGBEE_DEFAULT_STACK_PROFILE;
-  config.encryption = false;
-  memcpy(&config.networkKey, zigbee_randomEncryptionKey, sizeof(zigbee_encryptionKey));
-  memcpy(&config.linkKey, zigbee_noLinkKey, sizeof(zigbee_linkKey));
+  status = zigbee_protocol_checkConfiguration(zigbee, config, &hwInfo, &bUpToDate, &indicationStatus);
+  if (status != ZB_CMD_SUCCESS)
+  {
+    syslog(LOG_INFO, "radio doesn't answer (status = %d), cold start", status);
+    return false;
+  }
 
-  config.sleepPeriod = 0xA08; //25,6s
-  config.nbSleepPeriod = 12; //12*25.6 = 308s -~> 5mn
-  config.writeData = bWriteData;
+  if (bUpToDate == false)
+  {
+    syslog(LOG_INFO, "radio configuration differs, cold start");
+    return false;
+  }
 
-  //   config.sleepPeriod = 0xAF0; //28s
-  //   config.nbSleepPeriod = 11; //11*28 = 308s -~> 5mn
+  if (indicationStatus != 0)
+  {
+    syslog(LOG_INFO, "radio not associated (%s), cold start", zigbee_get_indicationError(indicationStatus));
+    return false;
+  }
 
-  status = zigbee_protocol_configure(zigbee, &config);
+  log_hardware_data(&hwInfo);
+  syslog(LOG_INFO, "radio already configured and associated, warm start");
+  return true;
+}
+
+static bool detect_radio(zigbee_obj* zigbee, zigbee_config* config)
+{
+  uint32_t preferred[2];
+
+  //the current speed (-b option at startup), then the configured one
+  preferred[0] = zigbee->baudRate;
+  preferred[1] = config->baudRate;
+  if (zigbee_protocol_detectBaudRate(zigbee, preferred, 2) == ZB_CMD_SUCCESS)
+  {
+    return true;
+  }
+
+  //a frame with special bytes is lost when the framing differs, the radio may still use the other mode
+  zigbee_protocol_setApiMode(zigbee, (zigbee->apiMode == ZIGBEE_API_MODE_ESCAPED) ?
+                             ZIGBEE_API_MODE_UNESCAPED : ZIGBEE_API_MODE_ESCAPED);
+  return (zigbee_protocol_detectBaudRate(zigbee, preferred, 2) == ZB_CMD_SUCCESS);
+}
+
+static void reset_radio(zigbee_obj* zigbee)
+{
+  zigbee_protocol_armHardwareReset(zigbee);
+#ifdef GPIO_OLD_API
+  gpio_reset_pulse(config_gpio_reset);
+#else
+  int32_t fd_gpio;
+  fd_gpio = gpio_configure_output(config_gpio_ctrl_name, config_gpio_line, 0);
+  gpio_perform_reset_pulse(fd_gpio);
+#endif /* GPIO_OLD_API */
+
+  //the boot time is only a bound, the radio tells when it is ready
+  zigbee_protocol_waitHardwareReset(zigbee, GPIO_RESET_WAKE_TIME_MS);
+}
+
+static int32_t configure(zigbee_obj* zigbee, zigbee_config* config)
+{
+  zigbee_hwInfo hwInfo;
+  zb_status status;
+  int32_t rc;
+
+  status = zigbee_protocol_configure(zigbee, config, &hwInfo);
   if (status == ZB_CMD_SUCCESS)
   {
+    log_hardware_data(&hwInfo);
     syslog(LOG_INFO, "Configuration done");
   }
   else
@@ -308,29 +726,9 @@ static int32_t configure(zigbee_obj* zigbee, zigbee_panID* panID, uint16_t scan_
   return rc;
 }
 
-static void read_hardware_data(zigbee_obj* obj)
+static void log_hardware_data(zigbee_hwInfo* hwInfo)
 {
-  uint32_t status;
-  uint16_t hwVersion;
-  uint16_t fwVersion;
-  uint32_t serialHigh;
-  uint32_t serialLow;
-
-  status = zigbee_protocol_retrieveHwVersion(obj, &hwVersion);
-  if (status == 0)
-  {
-    syslog(LOG_INFO, "hardware version = %.2x", hwVersion);
-  }
-
-  status = zigbee_protocol_retrieveFwVersion(obj, &fwVersion);
-  if (status == 0)
-  {
-    syslog(LOG_INFO, "firmware version  = %.2x", fwVersion);
-  }
-
-  status = zigbee_protocol_retrieveSerial(obj, &serialLow, &serialHigh);
-  if (status == 0)
-  {
-    syslog(LOG_INFO, "serial number  (%.4x,%.4x)", serialHigh, serialLow);
-  }
+  syslog(LOG_INFO, "hardware version = %.2x", hwInfo->hwVersion);
+  syslog(LOG_INFO, "firmware version  = %.2x", hwInfo->fwVersion);
+  syslog(LOG_INFO, "serial number  (%.4x,%.4x)", hwInfo->serialHigh, hwInfo->serialLow);
 }
@@ -16,12 +16,12 @@
 #endif /* GPIO_OLD_API */
 
 #define RESET_WAIT_TIME      (200000) //200ns is the minimal time of reset pulse for zb device
-#define RESET_WAKE_TIME   (500000000) //200ns is the minimal time of reset pulse for zb device
+#define RESET_WAKE_TIME   (GPIO_RESET_WAKE_TIME_MS * 1000000) //time needed by zb device to accept commands
 
 #ifdef GPIO_OLD_API
 
 ///\a deprecated
-void gpio_reset(const char* gpio_name)
+void gpio_reset_pulse(const char* gpio_name)
 {
   int32_t fd;
   struct timespec resetWaitTime;
@@ -39,13 +39,21 @@ void gpio_reset(const char* gpio_name)
     write(fd, "0", 2);
     nanosleep(&resetWaitTime, NULL);
     write(fd, "1", 2);
-    resetWaitTime.tv_sec = 0;
-    resetWaitTime.tv_nsec = RESET_WAKE_TIME;
-    nanosleep(&resetWaitTime, NULL);
     close(fd);
   }
 }
 
+///\a deprecated
+void gpio_reset(const char* gpio_name)
+{
+  struct timespec resetWaitTime;
+
+  gpio_reset_pulse(gpio_name);
+  resetWaitTime.tv_sec = 0;
+  resetWaitTime.tv_nsec = RESET_WAKE_TIME;
+  nanosleep(&resetWaitTime, NULL);
+}
+
 #else
 
 typedef struct
@@ -127,7 +135,7 @@ int32_t gpio_configure_output(const char* gpio_ctrl_name, int32_t no_line, uint8
   return my_fd;
 }
 
-int32_t gpio_perform_reset(int32_t fd_output)
+int32_t gpio_perform_reset_pulse(int32_t fd_output)
 {
   int32_t rc = 0;
   struct gpiohandle_data output_values;
@@ -143,6 +151,16 @@ int32_t gpio_perform_reset(int32_t fd_output)
 
   output_values.values[0] = 1;
   rc |= ioctl(gpio_list_fd[fd_output].output_request.fd, GPIOHANDLE_SET_LINE_VALUES_IOCTL, &output_values);
+
+  return rc;
+}
+
+int32_t gpio_perform_reset(int32_t fd_output)
+{
+  int32_t rc;
+  struct timespec resetWaitTime;
+
+  rc = gpio_perform_reset_pulse(fd_output);
   resetWaitTime.tv_sec = 0;
   resetWaitTime.tv_nsec = RESET_WAKE_TIME;
   nanosleep(&resetWaitTime, NULL);
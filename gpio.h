@@ -3,15 +3,19 @@
 
 #include <stdint.h>
 
+#define GPIO_RESET_WAKE_TIME_MS   (500) //upper bound of the zb device boot time
+
 #ifdef GPIO_OLD_API
 
 extern void gpio_reset(const char* gpio_name);
+extern void gpio_reset_pulse(const char* gpio_name); //no wait for the device boot
 
 #else
 
 extern int32_t gpio_init(void);
 extern int32_t gpio_configure_output(const char* gpio_ctrl_name, int32_t no_line, uint8_t initial_value);
 extern int32_t gpio_perform_reset(int32_t fd_output);
+extern int32_t gpio_perform_reset_pulse(int32_t fd_output); //no wait for the device boot
 extern void gpio_close_all(void);
 
 #endif /* GPIO_OLD_API */
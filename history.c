@@ -0,0 +1,537 @@
+#include "history.h"
+#include "monotonic.h"
+#include <assert.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#define HISTORY_SEGMENT_SUFFIX  ".hist"
+#define HISTORY_DIR_SIZE        (PATH_MAX - sizeof("/0000000000" HISTORY_SEGMENT_SUFFIX)) //room for a segment name
+#define HISTORY_INDEX_BITS      (9)
+#define HISTORY_INDEX_SIZE      (1 << HISTORY_INDEX_BITS) //twice the series, short probes
+#define HISTORY_MAX_RECORDS     ((HISTORY_SEGMENT_SIZE - HISTORY_RECORDS_OFFSET) / sizeof(history_record))
+
+typedef struct
+{
+  char dir[HISTORY_DIR_SIZE];
+  uint32_t maxSegments;
+  bool bOpened;
+  uint32_t firstSeq; //segments on disk: firstSeq to nextSeq - 1
+  uint32_t nextSeq;
+  int32_t fd;
+  history_header* header; //current segment, NULL when not opened
+  history_record* records;
+  uint16_t index[HISTORY_INDEX_SIZE]; //series + 1, 0 when free
+  uint64_t retryDeadline; //next segment creation when the last one failed
+  uint32_t backoff; //in ms
+} history_store;
+
+static history_store history = { .fd = -1, .backoff = HISTORY_RETRY_MIN };
+static history_record history_scratch[HISTORY_MAX_BATCH];
+static history_stats history_statistics;
+
+static bool history_continueSegment(void);
+static bool history_startSegment(void);
+static bool history_rotate(void);
+static void history_closeSegment(void);
+static void history_recover(void);
+static void history_buildIndex(void);
+static bool history_hasRoom(const zigbee_64bDestAddr* address, uint32_t nbRecords);
+static uint32_t history_findSeries(const zigbee_64bDestAddr* address, uint8_t id, uint8_t type, uint32_t* slot);
+static uint32_t history_addSeries(const zigbee_64bDestAddr* address, uint8_t id, uint8_t type, uint32_t slot);
+static uint32_t history_hash(const zigbee_64bDestAddr* address, uint8_t id, uint8_t type);
+static void history_getSegmentPath(uint32_t seq, char* path);
+
+bool history_open(const char* dir, uint32_t maxSegments)
+{
+  struct dirent* dirEntry;
+  uint32_t seq;
+  char* end;
+  DIR* d;
+  bool bFound;
+
+  if (strlen(dir) >= HISTORY_DIR_SIZE)
+  {
+    syslog(LOG_ERR, "history directory '%s' too long", dir);
+    return false;
+  }
+
+  if ((mkdir(dir, 0755) != 0) && (errno != EEXIST))
+  {
+    syslog(LOG_ERR, "unable to create history directory '%s', errno = %d", dir, errno);
+    return false;
+  }
+
+  d = opendir(dir);
+  if (d == NULL)
+  {
+    syslog(LOG_ERR, "unable to open history directory '%s', errno = %d", dir, errno);
+    return false;
+  }
+
+  strcpy(history.dir, dir);
+  history.maxSegments = (maxSegments != 0) ? maxSegments : 1;
+  history.firstSeq = 0;
+  history.nextSeq = 0;
+  bFound = false;
+  while ((dirEntry = readdir(d)) != NULL)
+  {
+    seq = strtoul(dirEntry->d_name, &end, 10);
+    if ((end == dirEntry->d_name) || (strcmp(end, HISTORY_SEGMENT_SUFFIX) != 0))
+    {
+      continue;
+    }
+
+    if ((bFound == false) || (seq < history.firstSeq))
+    {
+      history.firstSeq = seq;
+    }
+    if ((bFound == false) || (seq >= history.nextSeq))
+    {
+      history.nextSeq = seq + 1;
+    }
+    bFound = true;
+  }
+  closedir(d);
+
+  if (((bFound == false) || (history_continueSegment() == false)) && (history_startSegment() == false))
+  {
+    return false;
+  }
+
+  history.bOpened = true;
+  history.retryDeadline = 0;
+  history.backoff = HISTORY_RETRY_MIN;
+  syslog(LOG_INFO, "history '%s': segment %d, %d readings, %d series", dir, history.nextSeq - 1,
+         history.header->nbRecords, history.header->nbSeries);
+  return true;
+}
+
+void history_close(void)
+{
+  if (history.header != NULL)
+  {
+    msync(history.header, HISTORY_SEGMENT_SIZE, MS_SYNC);
+    history_closeSegment();
+  }
+  history.bOpened = false;
+}
+
+history_record* history_reserve(void)
+{
+  //a new segment before the frame, its readings are never split
+  if (history.header != NULL)
+  {
+    if ((history.header->nbRecords + HISTORY_MAX_BATCH) > history.header->maxRecords)
+    {
+      history_rotate();
+    }
+  }
+  else if ((history.bOpened == true) && (monotonic_getTimeNs() >= history.retryDeadline))
+  {
+    history_rotate();
+  }
+
+  if (history.header == NULL)
+  {
+    return history_scratch;
+  }
+
+  return &history.records[history.header->nbRecords];
+}
+
+history_record* history_commit(const zigbee_64bDestAddr* address, uint64_t timestamp, uint32_t nbRecords)
+{
+  history_header* header;
+  history_series* series;
+  history_record* record;
+  history_record* first;
+  uint32_t index;
+  uint32_t seriesIndex;
+  uint32_t slot;
+  uint32_t i;
+
+  assert(nbRecords <= HISTORY_MAX_BATCH);
+  header = history.header;
+  if (header == NULL)
+  {
+    if (history.bOpened == true)
+    {
+      history_statistics.nbDropped += nbRecords;
+    }
+    return history_scratch;
+  }
+
+  //not enough series left in this segment, the frame goes to the next one, the old one is unmapped
+  if (history_hasRoom(address, nbRecords) == false)
+  {
+    memcpy(history_scratch, &history.records[header->nbRecords], nbRecords * sizeof(history_record));
+    if (history_rotate() == false)
+    {
+      history_statistics.nbDropped += nbRecords;
+      return history_scratch;
+    }
+    header = history.header;
+    memcpy(history.records, history_scratch, nbRecords * sizeof(history_record));
+  }
+
+  for (i = 0; i < nbRecords; i++)
+  {
+    index = header->nbRecords + i;
+    record = &history.records[index];
+    seriesIndex = history_findSeries(address, record->id, record->type, &slot);
+    if (seriesIndex == HISTORY_NONE)
+    {
+      seriesIndex = history_addSeries(address, record->id, record->type, slot);
+    }
+
+    series = &header->series[seriesIndex];
+    record->timestamp = timestamp;
+    record->series = seriesIndex;
+    record->prev = series->last;
+    if (series->nbRecords == 0)
+    {
+      series->first = index;
+      series->firstTime = timestamp;
+    }
+    series->last = index;
+    series->lastTime = timestamp;
+    series->nbRecords++;
+  }
+
+  if (header->nbRecords == 0)
+  {
+    header->firstTime = timestamp;
+  }
+  header->lastTime = timestamp;
+  //published once indexed, a reader of the mapping sees the whole frame or nothing
+  first = &history.records[header->nbRecords];
+  __atomic_store_n(&header->nbRecords, header->nbRecords + nbRecords, __ATOMIC_RELEASE);
+  history_statistics.nbRecords += nbRecords;
+
+  return first;
+}
+
+const history_stats* history_getStats(void)
+{
+  history_statistics.nbSeries = (history.header != NULL) ? history.header->nbSeries : 0;
+  history_statistics.nbSegments = history.nextSeq - history.firstSeq;
+  return &history_statistics;
+}
+
+const history_header* history_mapSegment(const char* path)
+{
+  history_header* header;
+  struct stat fileStat;
+  int32_t fd;
+
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+  {
+    return NULL;
+  }
+
+  header = MAP_FAILED;
+  if ((fstat(fd, &fileStat) == 0) && (fileStat.st_size == HISTORY_SEGMENT_SIZE))
+  {
+    header = mmap(NULL, HISTORY_SEGMENT_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+
+  if (header == MAP_FAILED)
+  {
+    return NULL;
+  }
+
+  if ((header->magic != HISTORY_MAGIC) || (header->version != HISTORY_VERSION) ||
+      (header->recordSize != sizeof(history_record)) || (header->maxSeries != HISTORY_MAX_SERIES) ||
+      (header->maxRecords != HISTORY_MAX_RECORDS) || (header->nbRecords > header->maxRecords))
+  {
+    munmap(header, HISTORY_SEGMENT_SIZE);
+    return NULL;
+  }
+
+  return header;
+}
+
+void history_unmapSegment(const history_header* header)
+{
+  munmap((void*) header, HISTORY_SEGMENT_SIZE);
+}
+
+///the last segment of a previous run, if valid
+static bool history_continueSegment(void)
+{
+  char path[PATH_MAX];
+  history_header* header;
+  int32_t fd;
+
+  history_getSegmentPath(history.nextSeq - 1, path);
+  header = (history_header*) history_mapSegment(path);
+  if (header == NULL)
+  {
+    return false;
+  }
+  history_unmapSegment(header);
+
+  fd = open(path, O_RDWR | O_CLOEXEC);
+  if (fd < 0)
+  {
+    return false;
+  }
+
+  header = mmap(NULL, HISTORY_SEGMENT_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (header == MAP_FAILED)
+  {
+    close(fd);
+    return false;
+  }
+
+  history.fd = fd;
+  history.header = header;
+  history.records = HISTORY_RECORDS(header);
+  history_recover();
+  history_buildIndex();
+
+  return true;
+}
+
+static bool history_startSegment(void)
+{
+  char path[PATH_MAX];
+  history_header* header;
+  int32_t fd;
+  int rc;
+
+  history_getSegmentPath(history.nextSeq, path);
+  fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0)
+  {
+    syslog(LOG_ERR, "unable to create history segment '%s', errno = %d", path, errno);
+    history_closeSegment();
+    return false;
+  }
+
+  //allocated now, a write in the mapping can't hit a full disk (SIGBUS)
+  rc = posix_fallocate(fd, 0, HISTORY_SEGMENT_SIZE);
+  header = MAP_FAILED;
+  if (rc == 0)
+  {
+    header = mmap(NULL, HISTORY_SEGMENT_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    rc = errno;
+  }
+
+  if (header == MAP_FAILED)
+  {
+    syslog(LOG_ERR, "unable to allocate history segment '%s', errno = %d", path, rc);
+    close(fd);
+    unlink(path);
+    history_closeSegment();
+    return false;
+  }
+
+  if (history.header != NULL)
+  {
+    //complete, written back in the background
+    msync(history.header, HISTORY_SEGMENT_SIZE, MS_ASYNC);
+  }
+  history_closeSegment();
+
+  header->magic = HISTORY_MAGIC;
+  header->version = HISTORY_VERSION;
+  header->recordSize = sizeof(history_record);
+  header->maxSeries = HISTORY_MAX_SERIES;
+  header->maxRecords = HISTORY_MAX_RECORDS;
+  history.fd = fd;
+  history.header = header;
+  history.records = HISTORY_RECORDS(header);
+  memset(history.index, 0, sizeof(history.index));
+  history.nextSeq++;
+
+  while ((history.nextSeq - history.firstSeq) > history.maxSegments)
+  {
+    history_getSegmentPath(history.firstSeq, path);
+    unlink(path);
+    history.firstSeq++;
+  }
+
+  return true;
+}
+
+///next segment, on failure the readings are dropped until the retry deadline
+static bool history_rotate(void)
+{
+  if (history_startSegment() == true)
+  {
+    if (history.backoff != HISTORY_RETRY_MIN)
+    {
+      syslog(LOG_INFO, "history restarted, segment %d", history.nextSeq - 1);
+    }
+    history.backoff = HISTORY_RETRY_MIN;
+    return true;
+  }
+
+  history.retryDeadline = monotonic_getTimeNs() + ((uint64_t) history.backoff) * MONOTONIC_NS_PER_MS;
+  syslog(LOG_ERR, "history stopped, next try in %d ms", history.backoff);
+  history.backoff *= 2;
+  if (history.backoff > HISTORY_RETRY_MAX)
+  {
+    history.backoff = HISTORY_RETRY_MAX;
+  }
+  return false;
+}
+
+static void history_closeSegment(void)
+{
+  if (history.header != NULL)
+  {
+    munmap(history.header, HISTORY_SEGMENT_SIZE);
+    close(history.fd);
+    history.header = NULL;
+    history.records = NULL;
+    history.fd = -1;
+  }
+}
+
+///readings indexed by a series but not counted when the daemon stopped
+static void history_recover(void)
+{
+  history_header* header;
+  history_series* series;
+  uint32_t i;
+
+  header = history.header;
+  if (header->nbSeries > HISTORY_MAX_SERIES)
+  {
+    header->nbSeries = HISTORY_MAX_SERIES;
+  }
+
+  for (i = 0; i < header->nbSeries; i++)
+  {
+    series = &header->series[i];
+    while ((series->nbRecords != 0) && (series->last >= header->nbRecords))
+    {
+      series->last = (series->last < header->maxRecords) ? history.records[series->last].prev : HISTORY_NONE;
+      series->nbRecords--;
+    }
+
+    if (series->nbRecords == 0)
+    {
+      series->first = HISTORY_NONE;
+      series->last = HISTORY_NONE;
+    }
+    else
+    {
+      series->lastTime = history.records[series->last].timestamp;
+    }
+  }
+}
+
+static void history_buildIndex(void)
+{
+  history_series* series;
+  uint32_t slot;
+  uint32_t i;
+
+  memset(history.index, 0, sizeof(history.index));
+  for (i = 0; i < history.header->nbSeries; i++)
+  {
+    series = &history.header->series[i];
+    slot = history_hash(&series->address, series->id, series->type);
+    while (history.index[slot] != 0)
+    {
+      slot = (slot + 1) & (HISTORY_INDEX_SIZE - 1);
+    }
+    history.index[slot] = i + 1;
+  }
+}
+
+///the series of the frame can be added to the current segment
+static bool history_hasRoom(const zigbee_64bDestAddr* address, uint32_t nbRecords)
+{
+  uint32_t nbMissing;
+  uint32_t slot;
+  uint32_t i;
+
+  if ((history.header->nbSeries + nbRecords) <= HISTORY_MAX_SERIES)
+  {
+    return true;
+  }
+
+  nbMissing = 0;
+  for (i = 0; i < nbRecords; i++)
+  {
+    if (history_findSeries(address, history.records[history.header->nbRecords + i].id,
+                           history.records[history.header->nbRecords + i].type, &slot) == HISTORY_NONE)
+    {
+      nbMissing++;
+    }
+  }
+
+  return (history.header->nbSeries + nbMissing) <= HISTORY_MAX_SERIES;
+}
+
+///index of the series in the current segment, HISTORY_NONE and the free slot of the index if not found
+static uint32_t history_findSeries(const zigbee_64bDestAddr* address, uint8_t id, uint8_t type, uint32_t* slot)
+{
+  history_series* series;
+  uint32_t i;
+
+  *slot = history_hash(address, id, type);
+  while (history.index[*slot] != 0)
+  {
+    i = history.index[*slot] - 1;
+    series = &history.header->series[i];
+    if ((series->id == id) && (series->type == type) && (memcmp(series->address, address, sizeof(*address)) == 0))
+    {
+      return i;
+    }
+    *slot = (*slot + 1) & (HISTORY_INDEX_SIZE - 1);
+  }
+
+  return HISTORY_NONE;
+}
+
+static uint32_t history_addSeries(const zigbee_64bDestAddr* address, uint8_t id, uint8_t type, uint32_t slot)
+{
+  history_series* series;
+  uint32_t i;
+
+  i = history.header->nbSeries;
+  series = &history.header->series[i];
+  memcpy(series->address, address, sizeof(*address));
+  series->id = id;
+  series->type = type;
+  series->nbRecords = 0;
+  series->first = HISTORY_NONE;
+  series->last = HISTORY_NONE;
+  history.header->nbSeries++;
+  history.index[slot] = i + 1;
+
+  return i;
+}
+
+static uint32_t history_hash(const zigbee_64bDestAddr* address, uint8_t id, uint8_t type)
+{
+  uint64_t key;
+
+  memcpy(&key, address, sizeof(key));
+  key ^= ((uint64_t) id << 8) | type;
+  key *= 0x9e3779b97f4a7c15ULL;
+
+  return key >> (64 - HISTORY_INDEX_BITS);
+}
+
+static void history_getSegmentPath(uint32_t seq, char* path)
+{
+  snprintf(path, PATH_MAX, "%s/%010u" HISTORY_SEGMENT_SUFFIX, history.dir, seq);
+}
@@ -0,0 +1,105 @@
+#ifndef __HISTORY_H__
+#define __HISTORY_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "zigbee.h"
+
+/**
+ * Append-only store of the decoded readings, in memory mapped segment files
+ * ("<dir>/0000000012.hist") of HISTORY_SEGMENT_SIZE bytes:
+ *  - a header, nbRecords being updated last: a reading is in the history once counted;
+ *  - the series (node address, sensor id, sensor type) with their number of readings,
+ *    first and last reading and timestamps;
+ *  - the readings, fixed size, each one linked to the previous reading of its series:
+ *    the history of a series is read from its last reading, without scanning the segment.
+ *
+ * sensor_readData() decodes a frame straight into the slots returned by history_reserve()
+ * and history_commit() indexes them: no copy and no system call by reading. A new segment
+ * is started when a frame doesn't fit anymore, the oldest ones beyond maxSegments are
+ * removed. The space of a segment is allocated when it is created, a full disk can't
+ * fault a write. When a segment can't be created (disk full, I/O error), the readings are
+ * dropped and the creation is retried from history_reserve(), HISTORY_RETRY_MIN to
+ * HISTORY_RETRY_MAX ms apart, doubled on each failure. Nothing is lost when the daemon
+ * crashes, the last segment is continued on the next start. msync() is only done when a
+ * segment is complete and on history_close(): after a power loss, the readings of the
+ * last seconds may be missing.
+ *
+ * Without history_open(), the slots are a scratch buffer and nothing is stored.
+ * zb_history (history_dump.c) lists the series and readings of segment files.
+ */
+
+#define HISTORY_SEGMENT_SIZE          (4194304) //in bytes
+#define HISTORY_MAX_SERIES            (256) //by segment
+#define HISTORY_MAX_BATCH             (100) //readings by frame
+#define HISTORY_DEFAULT_MAX_SEGMENTS  (16)
+#define HISTORY_RETRY_MIN             (1000)  //in ms
+#define HISTORY_RETRY_MAX             (60000) //in ms
+#define HISTORY_MAGIC                 (0x5348425a) //"ZBHS"
+#define HISTORY_VERSION               (1)
+#define HISTORY_NONE                  (UINT32_MAX)
+
+typedef struct
+{
+  uint64_t timestamp; //CLOCK_REALTIME, in ns, frame reception
+  double value; //heater mode for ACT_HEATER
+  uint32_t prev; //previous reading of the series, HISTORY_NONE for its first one
+  uint16_t series;
+  uint8_t id;
+  uint8_t type; //sensor type in the payload
+} history_record;
+
+typedef struct
+{
+  zigbee_64bDestAddr address;
+  uint8_t id;
+  uint8_t type;
+  uint16_t reserved;
+  uint32_t nbRecords;
+  uint32_t first;
+  uint32_t last;
+  uint64_t firstTime;
+  uint64_t lastTime;
+} history_series;
+
+typedef struct
+{
+  uint32_t magic;
+  uint16_t version;
+  uint16_t recordSize;
+  uint32_t maxSeries;
+  uint32_t maxRecords;
+  uint32_t nbSeries;
+  uint32_t nbRecords;
+  uint64_t firstTime;
+  uint64_t lastTime;
+  history_series series[HISTORY_MAX_SERIES];
+} history_header;
+
+//readings on their own pages, after the header
+#define HISTORY_RECORDS_OFFSET  ((sizeof(history_header) + 4095) & ~((size_t) 4095))
+#define HISTORY_RECORDS(header) ((history_record*) ((uint8_t*) (header) + HISTORY_RECORDS_OFFSET))
+
+typedef struct
+{
+  uint32_t nbRecords; //stored since the start
+  uint32_t nbDropped; //no segment available, until the next retry
+  uint32_t nbSeries; //in the current segment
+  uint32_t nbSegments;
+} history_stats;
+
+/// creates the directory if needed and continues its last segment
+extern bool history_open(const char* dir, uint32_t maxSegments);
+extern void history_close(void);
+/// HISTORY_MAX_BATCH slots for the readings of a frame
+extern history_record* history_reserve(void);
+/// stores the first nbRecords slots filled (id, type and value), returns where they are now:
+/// the slots of history_reserve() are no longer valid when the frame went to a new segment
+extern history_record* history_commit(const zigbee_64bDestAddr* address, uint64_t timestamp, uint32_t nbRecords);
+extern const history_stats* history_getStats(void);
+
+/// read only mapping of a segment, e.g. while the daemon writes it, NULL if invalid
+extern const history_header* history_mapSegment(const char* path);
+extern void history_unmapSegment(const history_header* header);
+
+#endif /* __HISTORY_H__ */
@@ -0,0 +1,171 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+#include "history.h"
+#include "monotonic.h"
+
+/**
+ * Dump of history segments (see history.h), read only: the segment being written by
+ * zb_controler can be read as well, only the readings already counted are shown.
+ * Lists the series of each segment and, with -r, their readings in chronological order,
+ * read backwards from the last reading of each series.
+ */
+
+#define DUMP_ADDRESS_SIZE   (sizeof("xb@00:00:00:00:00:00:00:00"))
+#define DUMP_TIME_SIZE      (sizeof("2000-01-01 00:00:00.000"))
+
+static void dump_buildAddress(const zigbee_64bDestAddr* address, char* buffer);
+static void dump_buildTime(uint64_t timestamp, char* buffer);
+static void dump_printReadings(const history_header* header, const history_series* series);
+static void dump_segment(const char* path, const char* address, bool bReadings);
+
+static void dump_buildAddress(const zigbee_64bDestAddr* address, char* buffer)
+{
+  uint32_t i;
+
+  strcpy(buffer, "xb@");
+  for (i = 0; i < sizeof(*address); i++)
+  {
+    sprintf(buffer + 3 + i * 3, (i != (sizeof(*address) - 1)) ? "%.2x:" : "%.2x", (*address)[i]);
+  }
+}
+
+static void dump_buildTime(uint64_t timestamp, char* buffer)
+{
+  struct tm date;
+  time_t seconds;
+
+  seconds = (time_t) (timestamp / MONOTONIC_NS_PER_S);
+  localtime_r(&seconds, &date);
+  strftime(buffer, DUMP_TIME_SIZE, "%Y-%m-%d %H:%M:%S", &date);
+  sprintf(buffer + strlen(buffer), ".%03u", (uint32_t) ((timestamp % MONOTONIC_NS_PER_S) / 1000000));
+}
+
+static void dump_printReadings(const history_header* header, const history_series* series)
+{
+  const history_record* records;
+  uint32_t* indexes;
+  uint32_t nbRecords;
+  uint32_t index;
+  uint32_t nbCommitted;
+  char date[DUMP_TIME_SIZE];
+
+  indexes = malloc(series->nbRecords * sizeof(uint32_t));
+  if (indexes == NULL)
+  {
+    fprintf(stderr, "not enough memory\n");
+    return;
+  }
+
+  //the chain is bounded by the readings counted when the dump started
+  records = HISTORY_RECORDS(header);
+  nbCommitted = __atomic_load_n(&header->nbRecords, __ATOMIC_ACQUIRE);
+  nbRecords = 0;
+  index = series->last;
+  while ((index < nbCommitted) && (nbRecords < series->nbRecords))
+  {
+    indexes[nbRecords] = index;
+    nbRecords++;
+    index = records[index].prev;
+  }
+
+  while (nbRecords > 0)
+  {
+    nbRecords--;
+    dump_buildTime(records[indexes[nbRecords]].timestamp, date);
+    printf("    %s %g\n", date, records[indexes[nbRecords]].value);
+  }
+
+  free(indexes);
+}
+
+static void dump_segment(const char* path, const char* address, bool bReadings)
+{
+  const history_header* header;
+  const history_series* series;
+  uint32_t nbSeries;
+  uint32_t i;
+  char seriesAddress[DUMP_ADDRESS_SIZE];
+  char first[DUMP_TIME_SIZE];
+  char last[DUMP_TIME_SIZE];
+
+  header = history_mapSegment(path);
+  if (header == NULL)
+  {
+    fprintf(stderr, "%s: not a history segment\n", path);
+    return;
+  }
+
+  nbSeries = __atomic_load_n(&header->nbSeries, __ATOMIC_ACQUIRE);
+  printf("%s: %u readings, %u series\n", path, __atomic_load_n(&header->nbRecords, __ATOMIC_ACQUIRE), nbSeries);
+
+  for (i = 0; (i < nbSeries) && (i < HISTORY_MAX_SERIES); i++)
+  {
+    series = &header->series[i];
+    dump_buildAddress(&series->address, seriesAddress);
+    if ((address != NULL) && (strcmp(address, seriesAddress) != 0))
+    {
+      continue;
+    }
+
+    dump_buildTime(series->firstTime, first);
+    dump_buildTime(series->lastTime, last);
+    printf("  %s id %u type 0x%.2x: %u readings, %s .. %s\n", seriesAddress, series->id, series->type,
+           series->nbRecords, first, last);
+    if ((bReadings == true) && (series->nbRecords != 0))
+    {
+      dump_printReadings(header, series);
+    }
+  }
+
+  history_unmapSegment(header);
+}
+
+int main(int argc, char* argv[])
+{
+  const char* address;
+  bool bReadings;
+  int opt;
+
+  address = NULL;
+  bReadings = false;
+
+  while ((opt = getopt(argc, argv, "ha:r")) != -1)
+  {
+    switch (opt)
+    {
+      case 'a':
+        address = optarg;
+        break;
+
+      case 'r':
+        bReadings = true;
+        break;
+
+      case 'h':
+      default:
+        fprintf(stderr,
+                "usage : %s [-a <node address, e.g. xb@00:13:a2:00:40:b5:bb:4e>] [-r, print the readings] <segment file>...\n",
+                argv[0]);
+        exit(EXIT_FAILURE);
+    }
+  }
+
+  if (optind >= argc)
+  {
+    fprintf(stderr, "no segment file provided\nExiting...\n");
+    exit(EXIT_FAILURE);
+  }
+
+  for (; optind < argc; optind++)
+  {
+    dump_segment(argv[optind], address, bReadings);
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,221 @@
+#include "latency.h"
+#include "monotonic.h"
+#include "zigbee.h"
+#include <assert.h>
+#include <string.h>
+#include <syslog.h>
+
+static latency_histogram latency_histograms[LATENCY_NB_TYPES][LATENCY_NB_STAGES];
+static uint64_t latency_points[LATENCY_NB_POINTS]; //0 when not marked
+
+static const char* latency_stageNames[LATENCY_NB_STAGES] =
+{
+  /* LATENCY_STAGE_RX */      "rx",
+  /* LATENCY_STAGE_DATA */    "data",
+  /* LATENCY_STAGE_PREPARE */ "prepare",
+  /* LATENCY_STAGE_SINK */    "sink",
+  /* LATENCY_STAGE_TOTAL */   "total",
+};
+
+static const char* latency_typeNames[LATENCY_NB_TYPES] =
+{
+  /* LATENCY_TYPE_RECEIVE_PACKET */  "receive_packet",
+  /* LATENCY_TYPE_AT_RESPONSE */     "at_response",
+  /* LATENCY_TYPE_TRANSMIT_STATUS */ "transmit_status",
+  /* LATENCY_TYPE_MODEM_STATUS */    "modem_status",
+  /* LATENCY_TYPE_OTHER */           "other",
+};
+
+static uint32_t latency_getBucket(uint64_t value);
+static uint64_t latency_getBucketUpperBound(uint32_t bucket);
+static latency_type latency_getType(uint8_t frameType);
+static void latency_recordStage(latency_type type, latency_stage stage, latency_point from, latency_point to);
+
+void latency_mark(latency_point point)
+{
+  latency_points[point] = monotonic_getTimeNs();
+}
+
+void latency_markAt(latency_point point, uint64_t time)
+{
+  latency_points[point] = time;
+}
+
+void latency_commit(uint8_t frameType)
+{
+  latency_type type;
+  uint32_t last;
+
+  type = latency_getType(frameType);
+  latency_recordStage(type, LATENCY_STAGE_RX, LATENCY_FIRST_BYTE, LATENCY_DECODED);
+  latency_recordStage(type, LATENCY_STAGE_DATA, LATENCY_DECODED, LATENCY_DATA_READ);
+  latency_recordStage(type, LATENCY_STAGE_PREPARE, LATENCY_DATA_READ, LATENCY_SINK_STARTED);
+  latency_recordStage(type, LATENCY_STAGE_SINK, LATENCY_SINK_STARTED, LATENCY_SINK_DONE);
+
+  //a retry stops after the dedup, the total ends at the last point reached
+  for (last = LATENCY_NB_POINTS - 1; (last > LATENCY_FIRST_BYTE) && (latency_points[last] == 0); last--)
+  {
+  }
+  if (last != LATENCY_FIRST_BYTE)
+  {
+    latency_recordStage(type, LATENCY_STAGE_TOTAL, LATENCY_FIRST_BYTE, last);
+  }
+
+  memset(latency_points, 0, sizeof(latency_points));
+}
+
+void latency_record(latency_histogram* histogram, uint64_t value)
+{
+  assert(histogram != NULL);
+
+  histogram->count++;
+  histogram->sum += value;
+  if (value > histogram->max)
+  {
+    histogram->max = value;
+  }
+  histogram->buckets[latency_getBucket(value)]++;
+}
+
+uint64_t latency_getPercentile(const latency_histogram* histogram, double ratio)
+{
+  uint64_t threshold;
+  uint64_t seen;
+  uint32_t i;
+
+  assert(histogram != NULL);
+
+  if (histogram->count == 0)
+  {
+    return 0;
+  }
+
+  threshold = (uint64_t) (ratio * histogram->count);
+  if (threshold == 0)
+  {
+    threshold = 1;
+  }
+
+  seen = 0;
+  for (i = 0; i < LATENCY_NB_BUCKETS; i++)
+  {
+    seen += histogram->buckets[i];
+    if (seen >= threshold)
+    {
+      //the bucket bound may exceed the largest sample
+      return (latency_getBucketUpperBound(i) < histogram->max) ? latency_getBucketUpperBound(i) : histogram->max;
+    }
+  }
+
+  return histogram->max;
+}
+
+const latency_histogram* latency_getHistogram(latency_type type, latency_stage stage)
+{
+  return &latency_histograms[type][stage];
+}
+
+const char* latency_getStageName(latency_stage stage)
+{
+  return latency_stageNames[stage];
+}
+
+const char* latency_getTypeName(latency_type type)
+{
+  return latency_typeNames[type];
+}
+
+void latency_dump(void)
+{
+  const latency_histogram* histogram;
+  uint32_t type;
+  uint32_t stage;
+
+  for (type = 0; type < LATENCY_NB_TYPES; type++)
+  {
+    for (stage = 0; stage < LATENCY_NB_STAGES; stage++)
+    {
+      histogram = &latency_histograms[type][stage];
+      if (histogram->count == 0)
+      {
+        continue;
+      }
+
+      syslog(LOG_INFO, "latency %s/%s: %llu frames, avg %llu us, p50 %llu us, p90 %llu us, p99 %llu us, max %llu us",
+             latency_typeNames[type], latency_stageNames[stage], (unsigned long long) histogram->count,
+             (unsigned long long) (histogram->sum / histogram->count / 1000),
+             (unsigned long long) (latency_getPercentile(histogram, 0.5) / 1000),
+             (unsigned long long) (latency_getPercentile(histogram, 0.9) / 1000),
+             (unsigned long long) (latency_getPercentile(histogram, 0.99) / 1000),
+             (unsigned long long) (histogram->max / 1000));
+    }
+  }
+}
+
+static uint32_t latency_getBucket(uint64_t value)
+{
+  uint32_t exponent;
+
+  if (value < LATENCY_SUB_BUCKETS)
+  {
+    return value;
+  }
+
+  exponent = 63 - __builtin_clzll(value);
+  if (exponent > LATENCY_MAX_EXPONENT)
+  {
+    return LATENCY_NB_BUCKETS - 1;
+  }
+
+  //the LATENCY_SUB_BUCKETS_BITS bits under the leading one select the linear sub bucket
+  return ((exponent - LATENCY_SUB_BUCKETS_BITS + 1) << LATENCY_SUB_BUCKETS_BITS) +
+         ((value >> (exponent - LATENCY_SUB_BUCKETS_BITS)) & (LATENCY_SUB_BUCKETS - 1));
+}
+
+static uint64_t latency_getBucketUpperBound(uint32_t bucket)
+{
+  uint32_t group;
+  uint32_t shift;
+  uint64_t lowerBound;
+
+  group = bucket >> LATENCY_SUB_BUCKETS_BITS;
+  if (group == 0)
+  {
+    return bucket;
+  }
+
+  shift = group - 1;
+  lowerBound = ((uint64_t) (LATENCY_SUB_BUCKETS + (bucket & (LATENCY_SUB_BUCKETS - 1)))) << shift;
+  return lowerBound + (1ULL << shift) - 1;
+}
+
+static latency_type latency_getType(uint8_t frameType)
+{
+  switch (frameType)
+  {
+    case ZIGBEE_RECEIVE_PACKET:
+      return LATENCY_TYPE_RECEIVE_PACKET;
+
+    case ZIGBEE_AT_COMMAND_RESPONSE:
+      return LATENCY_TYPE_AT_RESPONSE;
+
+    case ZIGBEE_TRANSMIT_STATUS:
+      return LATENCY_TYPE_TRANSMIT_STATUS;
+
+    case ZIGBEE_MODEM_STATUS:
+      return LATENCY_TYPE_MODEM_STATUS;
+
+    default:
+      return LATENCY_TYPE_OTHER;
+  }
+}
+
+static void latency_recordStage(latency_type type, latency_stage stage, latency_point from, latency_point to)
+{
+  if ((latency_points[from] == 0) || (latency_points[to] == 0) || (latency_points[to] < latency_points[from]))
+  {
+    return;
+  }
+
+  latency_record(&latency_histograms[type][stage], latency_points[to] - latency_points[from]);
+}
@@ -0,0 +1,74 @@
+#ifndef __LATENCY_H__
+#define __LATENCY_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * Latency of each received frame, from its first byte read on the serial line to the end
+ * of the sink (script). Points are marked along the pipeline, then the frame is committed:
+ * each stage whose two ends were marked feeds a histogram, per stage and per frame type.
+ *
+ * Histograms are log-linear with fixed buckets: exact below LATENCY_SUB_BUCKETS ns, then
+ * LATENCY_SUB_BUCKETS linear buckets per power of 2 (relative error < 1/LATENCY_SUB_BUCKETS).
+ * Recording is a few instructions, no allocation.
+ */
+
+#define LATENCY_SUB_BUCKETS_BITS  (4)
+#define LATENCY_SUB_BUCKETS       (1 << LATENCY_SUB_BUCKETS_BITS)
+#define LATENCY_MAX_EXPONENT      (40) //2^40 ns is about 18 mn, longer values go in the last bucket
+#define LATENCY_NB_BUCKETS        ((LATENCY_MAX_EXPONENT - LATENCY_SUB_BUCKETS_BITS + 2) * LATENCY_SUB_BUCKETS)
+
+typedef enum
+{
+  LATENCY_FIRST_BYTE,   //first byte of the frame read
+  LATENCY_DECODED,      //frame extracted and decoded
+  LATENCY_DATA_READ,    //sensor_readData() done
+  LATENCY_SINK_STARTED,
+  LATENCY_SINK_DONE,
+  LATENCY_NB_POINTS
+} latency_point;
+
+typedef enum
+{
+  LATENCY_STAGE_RX,       //first byte -> decoded: serial, event loop, parser
+  LATENCY_STAGE_DATA,     //decoded -> data read: dispatch, dedup, payload decoding
+  LATENCY_STAGE_PREPARE,  //data read -> sink started: command line
+  LATENCY_STAGE_SINK,     //sink started -> sink done: script, pipe write or hand over to the workers
+  LATENCY_STAGE_TOTAL,    //first byte -> last point marked
+  LATENCY_NB_STAGES
+} latency_stage;
+
+typedef enum
+{
+  LATENCY_TYPE_RECEIVE_PACKET,
+  LATENCY_TYPE_AT_RESPONSE,
+  LATENCY_TYPE_TRANSMIT_STATUS,
+  LATENCY_TYPE_MODEM_STATUS,
+  LATENCY_TYPE_OTHER,
+  LATENCY_NB_TYPES
+} latency_type;
+
+typedef struct
+{
+  uint64_t count;
+  uint64_t sum; //in ns
+  uint64_t max;
+  uint32_t buckets[LATENCY_NB_BUCKETS];
+} latency_histogram;
+
+extern void latency_mark(latency_point point);
+extern void latency_markAt(latency_point point, uint64_t time);
+/// record the stages of the current frame (frameType is the API identifier), then forget its points
+extern void latency_commit(uint8_t frameType);
+
+extern void latency_record(latency_histogram* histogram, uint64_t value);
+/// value under which ratio (0..1) of the samples are, upper bound of its bucket
+extern uint64_t latency_getPercentile(const latency_histogram* histogram, double ratio);
+extern const latency_histogram* latency_getHistogram(latency_type type, latency_stage stage);
+extern const char* latency_getStageName(latency_stage stage);
+extern const char* latency_getTypeName(latency_type type);
+/// every non empty histogram in syslog: count, average, p50, p90, p99 and max
+extern void latency_dump(void);
+
+#endif /* __LATENCY_H__ */
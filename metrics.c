@@ -0,0 +1,360 @@
+#include "metrics.h"
+#include "sensor.h"
+#include "sensor_db.h"
+#include "sink.h"
+#include "spool.h"
+#include "history.h"
+#include "webcmd.h"
+#include "latency.h"
+#include "monotonic.h"
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define METRICS_SOCKET_BACKLOG  (4)
+#define METRICS_NAME_SIZE       (24)
+
+typedef struct
+{
+  char* buffer;
+  uint32_t size;
+  uint32_t offset;
+  bool bTruncated;
+} metrics_output;
+
+static char metrics_buffer[METRICS_BUFFER_SIZE];
+
+static void metrics_printf(metrics_output* out, const char* format, ...) __attribute__((format(printf, 2, 3)));
+static void metrics_header(metrics_output* out, const char* name, const char* type, const char* help);
+static void metrics_counter(metrics_output* out, const char* name, const char* help, uint64_t value);
+static void metrics_gauge(metrics_output* out, const char* name, const char* help, uint64_t value);
+static void metrics_gaugeSeconds(metrics_output* out, const char* name, const char* help, uint64_t value);
+static void metrics_frameCounters(metrics_output* out, const char* name, const char* help,
+                                  const uint32_t counters[ZIGBEE_NB_API_IDS]);
+static void metrics_summary(metrics_output* out, const char* name, const char* help,
+                            const latency_histogram* histogram);
+static const char* metrics_getFrameTypeName(uint32_t apiID, char* buffer, uint32_t size);
+
+uint32_t metrics_render(zigbee_obj* zigbee, char* buffer, uint32_t size)
+{
+  metrics_output out;
+  const sensor_stats* sensorStats;
+  const history_stats* historyStats;
+  sink_stats sinkStats;
+  spool_stats spoolStats;
+
+  assert(zigbee != NULL);
+  assert(buffer != NULL);
+
+  out.buffer = buffer;
+  out.size = size;
+  out.offset = 0;
+  out.bTruncated = false;
+  sensorStats = sensor_getStats();
+  historyStats = history_getStats();
+  sink_getStats(&sinkStats);
+  spool_getStats(&spoolStats);
+
+  metrics_frameCounters(&out, "zb_rx_frames_total", "API frames received with a valid checksum, by type",
+                        zigbee->rxStats.nbFrames);
+  metrics_counter(&out, "zb_rx_checksum_errors_total", "received frames dropped on a wrong checksum",
+                  zigbee->parser.nbChecksumErrors);
+  metrics_counter(&out, "zb_rx_length_errors_total", "received frames dropped on an invalid length",
+                  zigbee->parser.nbLengthErrors);
+  metrics_counter(&out, "zb_rx_discarded_bytes_total", "bytes skipped while looking for a start delimiter",
+                  zigbee->parser.nbDiscardedBytes);
+  metrics_counter(&out, "zb_rx_decode_errors_total", "received frames not decoded",
+                  zigbee->rxStats.nbDecodeErrors);
+  metrics_counter(&out, "zb_serial_timeouts_total", "incomplete frames dropped after the inter byte timeout",
+                  zigbee->rxStats.nbIncompleteFrames);
+
+  metrics_frameCounters(&out, "zb_tx_frames_total", "API frames queued for the radio, by type",
+                        zigbee->txStats.nbQueued);
+  metrics_gauge(&out, "zb_tx_queue_depth", "frames waiting to be written on the serial line",
+                zigbee->txQueue.nbItems);
+  metrics_counter(&out, "zb_tx_cts_stalls_total", "transmissions paused by CTS", zigbee->txStats.nbStalls);
+
+  metrics_counter(&out, "zb_at_timeouts_total", "AT commands without reply", zigbee->rxStats.nbAtTimeouts);
+  metrics_gauge(&out, "zb_at_pending", "AT commands waiting for their reply", zigbee->nbAtPending);
+
+  metrics_gauge(&out, "zb_nodes", "sensors heard since the start", sensor_db_getCount());
+  metrics_counter(&out, "zb_sensor_retries_total", "data frames received twice, not sent to the script",
+                  sensorStats->nbRetries);
+  metrics_summary(&out, "zb_sink_duration_seconds", "readings delivered to the script and their duration",
+                  &sinkStats.duration);
+  metrics_counter(&out, "zb_sink_failures_total", "readings dropped or with a script failure",
+                  sinkStats.nbFailures);
+  metrics_counter(&out, "zb_sink_restarts_total", "restarts of the persistent script", sinkStats.nbRestarts);
+  metrics_gauge(&out, "zb_sink_workers", "threads running the script", sinkStats.nbWorkers);
+  metrics_gauge(&out, "zb_sink_workers_busy", "threads running the script now", sinkStats.nbBusyWorkers);
+  metrics_gauge(&out, "zb_sink_queue_depth", "readings waiting for a worker", sinkStats.queueDepth);
+  metrics_gauge(&out, "zb_sink_queue_capacity", "size of the worker queue", sinkStats.queueCapacity);
+  metrics_counter(&out, "zb_sink_queue_dropped_total", "readings dropped on a full worker queue",
+                  sinkStats.nbDropped);
+  metrics_counter(&out, "zb_sink_queue_blocked_total", "readings that waited for room in the worker queue",
+                  sinkStats.nbBlocked);
+  metrics_summary(&out, "zb_sink_queue_wait_seconds", "time spent by the readings in the worker queue",
+                  &sinkStats.queueWait);
+  metrics_counter(&out, "zb_sink_batches_total", "batches of readings given to the script", sinkStats.nbBatches);
+  metrics_counter(&out, "zb_sink_batch_records_total", "readings sent in a batch", sinkStats.nbBatchedRecords);
+  metrics_gaugeSeconds(&out, "zb_sink_batch_window_seconds", "time a batch waits for more readings",
+                       sinkStats.batchWindow);
+
+  metrics_counter(&out, "zb_history_readings_total", "readings stored in the history", historyStats->nbRecords);
+  metrics_counter(&out, "zb_history_dropped_total", "readings not stored, no history segment",
+                  historyStats->nbDropped);
+  metrics_gauge(&out, "zb_history_series", "series of the current history segment", historyStats->nbSeries);
+  metrics_gauge(&out, "zb_history_segments", "history segment files", historyStats->nbSegments);
+
+  metrics_gauge(&out, "zb_spool_bytes", "readings waiting in the spool, in bytes", spoolStats.size);
+  metrics_gauge(&out, "zb_spool_segments", "segment files of the spool", spoolStats.nbSegments);
+  metrics_counter(&out, "zb_spool_appended_total", "readings not delivered, spooled", spoolStats.nbAppended);
+  metrics_counter(&out, "zb_spool_replayed_total", "spooled readings delivered by the sink", spoolStats.nbReplayed);
+  metrics_counter(&out, "zb_spool_dropped_total", "readings lost by the spool (full, write error, invalid line)",
+                  spoolStats.nbDropped);
+  metrics_counter(&out, "zb_spool_replay_failures_total", "replays postponed by a delivery failure",
+                  spoolStats.nbReplayFailures);
+  metrics_summary(&out, "zb_spool_sync_duration_seconds", "fdatasync of the spool and its duration",
+                  &spoolStats.syncDuration);
+
+  metrics_gauge(&out, "zb_webcmd_queue_depth", "web commands waiting to be sent", webcmd_getQueueDepth());
+  metrics_counter(&out, "zb_webcmd_overflows_total", "web commands lost on a full queue", webcmd_getNbOverflows());
+
+  if (out.bTruncated == true)
+  {
+    syslog(LOG_ERR, "metrics truncated, buffer of %d bytes too small", size);
+    return 0;
+  }
+
+  return out.offset;
+}
+
+bool metrics_writeFile(zigbee_obj* zigbee, const char* path)
+{
+  char tmpPath[PATH_MAX];
+  uint32_t size;
+  int32_t fd;
+  bool bSuccess;
+
+  size = metrics_render(zigbee, metrics_buffer, sizeof(metrics_buffer));
+  if (size == 0)
+  {
+    return false;
+  }
+
+  //the collector may read at any time, it must see the old file or the new one
+  snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", path);
+  fd = open(tmpPath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0)
+  {
+    syslog(LOG_ERR, "unable to open metrics file '%s', errno = %d", tmpPath, errno);
+    return false;
+  }
+
+  bSuccess = (write(fd, metrics_buffer, size) == (ssize_t) size);
+  if (bSuccess == false)
+  {
+    syslog(LOG_ERR, "unable to write metrics file '%s', errno = %d", tmpPath, errno);
+  }
+  close(fd);
+
+  if ((bSuccess == true) && (rename(tmpPath, path) != 0))
+  {
+    syslog(LOG_ERR, "unable to rename metrics file to '%s', errno = %d", path, errno);
+    bSuccess = false;
+  }
+
+  if (bSuccess == false)
+  {
+    unlink(tmpPath);
+  }
+
+  return bSuccess;
+}
+
+int32_t metrics_openSocket(const char* path)
+{
+  struct sockaddr_un address;
+  int32_t fd;
+
+  if (strlen(path) >= sizeof(address.sun_path))
+  {
+    syslog(LOG_ERR, "metrics socket path '%s' too long", path);
+    return -1;
+  }
+
+  fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+  {
+    syslog(LOG_ERR, "unable to create metrics socket, errno = %d", errno);
+    return -1;
+  }
+
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strcpy(address.sun_path, path);
+
+  //left by a previous instance
+  unlink(path);
+  if ((bind(fd, (struct sockaddr*) &address, sizeof(address)) != 0) || (listen(fd, METRICS_SOCKET_BACKLOG) != 0))
+  {
+    syslog(LOG_ERR, "unable to listen on metrics socket '%s', errno = %d", path, errno);
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+void metrics_closeSocket(int32_t fd, const char* path)
+{
+  close(fd);
+  unlink(path);
+}
+
+void metrics_handleConnection(int32_t fd, zigbee_obj* zigbee)
+{
+  int32_t clientFd;
+  uint32_t size;
+
+  size = 0;
+  while ((clientFd = accept(fd, NULL, NULL)) >= 0)
+  {
+    //rendered once for all the connections pending
+    if (size == 0)
+    {
+      size = metrics_render(zigbee, metrics_buffer, sizeof(metrics_buffer));
+    }
+
+    //far below the socket buffer, a client not reading must not block the event loop
+    if (send(clientFd, metrics_buffer, size, MSG_DONTWAIT | MSG_NOSIGNAL) != (ssize_t) size)
+    {
+      syslog(LOG_WARNING, "metrics not sent, errno = %d", errno);
+    }
+    close(clientFd);
+  }
+
+  if ((errno != EAGAIN) && (errno != EWOULDBLOCK))
+  {
+    syslog(LOG_ERR, "unable to accept on metrics socket, errno = %d", errno);
+  }
+}
+
+static void metrics_printf(metrics_output* out, const char* format, ...)
+{
+  va_list args;
+  int32_t nbWritten;
+
+  if (out->bTruncated == true)
+  {
+    return;
+  }
+
+  va_start(args, format);
+  nbWritten = vsnprintf(&out->buffer[out->offset], out->size - out->offset, format, args);
+  va_end(args);
+
+  if ((nbWritten < 0) || ((uint32_t) nbWritten >= (out->size - out->offset)))
+  {
+    out->bTruncated = true;
+    return;
+  }
+  out->offset += nbWritten;
+}
+
+static void metrics_header(metrics_output* out, const char* name, const char* type, const char* help)
+{
+  metrics_printf(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+static void metrics_counter(metrics_output* out, const char* name, const char* help, uint64_t value)
+{
+  metrics_header(out, name, "counter", help);
+  metrics_printf(out, "%s %llu\n", name, (unsigned long long) value);
+}
+
+static void metrics_gauge(metrics_output* out, const char* name, const char* help, uint64_t value)
+{
+  metrics_header(out, name, "gauge", help);
+  metrics_printf(out, "%s %llu\n", name, (unsigned long long) value);
+}
+
+///value in ns
+static void metrics_gaugeSeconds(metrics_output* out, const char* name, const char* help, uint64_t value)
+{
+  metrics_header(out, name, "gauge", help);
+  metrics_printf(out, "%s %.6f\n", name, (double) value / MONOTONIC_NS_PER_S);
+}
+
+static void metrics_frameCounters(metrics_output* out, const char* name, const char* help,
+                                  const uint32_t counters[ZIGBEE_NB_API_IDS])
+{
+  char typeName[METRICS_NAME_SIZE];
+  uint32_t i;
+
+  metrics_header(out, name, "counter", help);
+  for (i = 0; i < ZIGBEE_NB_API_IDS; i++)
+  {
+    //only the types seen, a series appears with its first frame
+    if (counters[i] != 0)
+    {
+      metrics_printf(out, "%s{type=\"%s\"} %u\n", name, metrics_getFrameTypeName(i, typeName, sizeof(typeName)),
+                     counters[i]);
+    }
+  }
+}
+
+static void metrics_summary(metrics_output* out, const char* name, const char* help,
+                            const latency_histogram* histogram)
+{
+  static const double quantiles[] = { 0.5, 0.9, 0.99 };
+  uint32_t i;
+
+  metrics_header(out, name, "summary", help);
+  for (i = 0; i < sizeof(quantiles) / sizeof(quantiles[0]); i++)
+  {
+    metrics_printf(out, "%s{quantile=\"%g\"} %.6f\n", name, quantiles[i],
+                   (double) latency_getPercentile(histogram, quantiles[i]) / MONOTONIC_NS_PER_S);
+  }
+  metrics_printf(out, "%s_sum %.6f\n", name, (double) histogram->sum / MONOTONIC_NS_PER_S);
+  metrics_printf(out, "%s_count %llu\n", name, (unsigned long long) histogram->count);
+}
+
+static const char* metrics_getFrameTypeName(uint32_t apiID, char* buffer, uint32_t size)
+{
+  switch (apiID)
+  {
+    case ZIGBEE_API_AT_CMD:
+      return "at_command";
+
+    case ZIGBEE_API_AT_QUEUE_CMD:
+      return "at_queue_command";
+
+    case ZIGBEE_API_TRANSMIT_REQUEST:
+      return "transmit_request";
+
+    case ZIGBEE_AT_COMMAND_RESPONSE:
+      return "at_response";
+
+    case ZIGBEE_MODEM_STATUS:
+      return "modem_status";
+
+    case ZIGBEE_TRANSMIT_STATUS:
+      return "transmit_status";
+
+    case ZIGBEE_RECEIVE_PACKET:
+      return "receive_packet";
+
+    default:
+      snprintf(buffer, size, "0x%02x", apiID);
+      return buffer;
+  }
+}
@@ -0,0 +1,31 @@
+#ifndef __METRICS_H__
+#define __METRICS_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "zigbee_protocol.h"
+
+/**
+ * Counters and gauges of the controller in the Prometheus text exposition format (0.0.4).
+ * The values are read from where they are maintained (zigbee_obj statistics, parser,
+ * sensor, sensor_db, webcmd), rendering is only done when they are exported:
+ *  - to a file, rewritten atomically (temporary file then rename), for the textfile
+ *    collector of node_exporter;
+ *  - on a Unix stream socket, each connection receives the current values then is closed
+ *    (e.g. "socat - UNIX-CONNECT:<path>").
+ */
+
+#define METRICS_BUFFER_SIZE     (32768)
+#define METRICS_DEFAULT_PERIOD  (10) //in s, file rewriting
+
+/// returns the rendered size, 0 when buffer is too small
+extern uint32_t metrics_render(zigbee_obj* zigbee, char* buffer, uint32_t size);
+extern bool metrics_writeFile(zigbee_obj* zigbee, const char* path);
+
+/// listening socket, non blocking, -1 on error
+extern int32_t metrics_openSocket(const char* path);
+extern void metrics_closeSocket(int32_t fd, const char* path);
+/// to call when the listening socket is readable
+extern void metrics_handleConnection(int32_t fd, zigbee_obj* zigbee);
+
+#endif /* __METRICS_H__ */
@@ -0,0 +1,17 @@
+#ifndef __MONOTONIC_H__
+#define __MONOTONIC_H__
+
+#include <stdint.h>
+#include <time.h>
+
+#define MONOTONIC_NS_PER_MS     (1000000ULL)
+#define MONOTONIC_NS_PER_S      (1000000000ULL)
+
+static inline uint64_t monotonic_getTimeNs(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return ((uint64_t) now.tv_sec) * MONOTONIC_NS_PER_S + (uint64_t) now.tv_nsec;
+}
+
+#endif /* __MONOTONIC_H__ */
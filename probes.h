@@ -0,0 +1,47 @@
+#ifndef __PROBES_H__
+#define __PROBES_H__
+
+/**
+ * USDT static probes, provider "zb", listed by "bpftrace -l 'usdt:./zb_controler:*'".
+ * A probe is a nop in the code and a note in the ELF file: nothing is executed when no
+ * tracer is attached, the arguments are only left in registers or on the stack.
+ * Without sys/sdt.h (systemtap-sdt-dev) the probes are compiled out.
+ *
+ *   frame_rx(apiID, size)                  frame extracted by the parser, before decoding
+ *   frame_tx(apiID, frameID, size)         frame fully written on the serial line
+ *   decode_ok(apiID, size)
+ *   decode_failed(apiID, size)             checksum KO (frame dropped by the parser) or unknown/invalid frame
+ *   at_submit(frameID, cmd0, cmd1)
+ *   at_complete(frameID, cmd0, cmd1, status)  status is a zb_status, ZB_CMD_TIMEOUT without reply
+ *   dedup_hit(address, counter)            address points to the 8 bytes of the 64 bit address
+ *   sink_start(address, nbValues)          address is the string given to the script
+ *   sink_end(address, delivered, duration) duration in ns, of the hand over when sink workers run the script
+ *   sink_batch(nbRecords, size, window)    batch handed over, window in ns
+ *   webcmd_enqueue(sensorID, command, depth)
+ *   webcmd_dequeue(sensorID, command, depth)
+ *
+ * e.g. time between submit and completion of each AT command:
+ *   bpftrace -e 'usdt:./zb_controler:zb:at_submit { @s[arg0] = nsecs; }
+ *                usdt:./zb_controler:zb:at_complete /@s[arg0]/ { @us = hist((nsecs - @s[arg0]) / 1000); delete(@s[arg0]); }'
+ */
+
+#ifdef HAVE_SYS_SDT_H
+
+#include <sys/sdt.h>
+
+#define ZB_PROBE1(name, a1)                  DTRACE_PROBE1(zb, name, a1)
+#define ZB_PROBE2(name, a1, a2)              DTRACE_PROBE2(zb, name, a1, a2)
+#define ZB_PROBE3(name, a1, a2, a3)          DTRACE_PROBE3(zb, name, a1, a2, a3)
+#define ZB_PROBE4(name, a1, a2, a3, a4)      DTRACE_PROBE4(zb, name, a1, a2, a3, a4)
+
+#else
+
+//arguments still referenced, a variable only used by a probe must not warn
+#define ZB_PROBE1(name, a1)                  do { (void) (a1); } while (0)
+#define ZB_PROBE2(name, a1, a2)              do { (void) (a1); (void) (a2); } while (0)
+#define ZB_PROBE3(name, a1, a2, a3)          do { (void) (a1); (void) (a2); (void) (a3); } while (0)
+#define ZB_PROBE4(name, a1, a2, a3, a4)      do { (void) (a1); (void) (a2); (void) (a3); (void) (a4); } while (0)
+
+#endif /* HAVE_SYS_SDT_H */
+
+#endif /* __PROBES_H__ */
@@ -0,0 +1,306 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <syslog.h>
+#include <time.h>
+#include <errno.h>
+#include "zigbee.h"
+#include "zigbee_protocol.h"
+#include "sensor.h"
+#include "configfile.h"
+#include "capture.h"
+#include "sink.h"
+#include "spool.h"
+#include "monotonic.h"
+#include "unused.h"
+
+/**
+ * Replay of a capture (see capture.h) through the reception pipeline of the controller:
+ * the received frames are written in a pipe read by zigbee_handleInput(), so that the
+ * parser, zigbee_decodeFrame(), the dispatch and sensor_readAndProvideSensorData() all
+ * run as with a radio. Sent frames are skipped, the radio is not there to answer.
+ */
+
+#define REPLAY_BUFFER_SIZE      (100) //same frame buffer as the controller
+#define REPLAY_DEFAULT_SCRIPT   "/bin/true"
+
+typedef struct
+{
+  uint64_t count;
+  uint64_t sum;
+  uint64_t min;
+  uint64_t max;
+} replay_stat;
+
+typedef struct
+{
+  uint64_t nbRxFrames; //written in the pipe
+  uint64_t nbDataFrames; //expected at the sink
+  uint64_t nbDelivered; //received by the sink
+  uint64_t nbBytes;
+  replay_stat lag; //actual push time - scheduled time
+  replay_stat decode; //push to sink: read, parse, decode and dispatch
+  replay_stat sink; //sensor_readAndProvideSensorData()
+} replay_stats;
+
+static uint8_t replay_buffer[REPLAY_BUFFER_SIZE];
+static replay_stats replay_result;
+static uint64_t replay_pushTime;
+static const char* replay_script;
+
+static void replay_addSample(replay_stat* stat, uint64_t value);
+static void replay_printStat(const char* name, replay_stat* stat);
+static void replay_waitUntil(uint64_t deadline);
+static void onDataCallBack(zigbee_obj* obj, zigbee_decodedFrame* frame);
+
+int main(int argc, char* argv[])
+{
+  zigbee_obj zigbee;
+  capture_ring capture;
+  const capture_record* record;
+  const uint8_t* frame;
+  uint32_t offset;
+  uint64_t firstTimestamp;
+  uint64_t startTime;
+  uint64_t scheduled;
+  uint64_t duration;
+  double speed;
+  char* configFile;
+  char* spoolDir;
+  int32_t pipeFd[2];
+  int opt;
+
+  speed = 1.0;
+  configFile = NULL;
+  spoolDir = NULL;
+  replay_script = NULL;
+
+  while ((opt = getopt(argc, argv, "hx:c:s:p:")) != -1)
+  {
+    switch (opt)
+    {
+      case 'x':
+        speed = atof(optarg);
+        break;
+
+      case 'c':
+        configFile = optarg;
+        break;
+
+      case 's':
+        replay_script = optarg;
+        break;
+
+      case 'p':
+        spoolDir = optarg;
+        break;
+
+      case 'h':
+      default:
+        fprintf(stderr,
+                "usage : %s [-x <speed factor, 1 by default, 0 as fast as possible>] [-c <config file, for its script>] [-s <script, default: the one of the config file, else %s>] [-p <spool directory, not the one of the daemon>] <capture file>\n",
+                argv[0], REPLAY_DEFAULT_SCRIPT);
+        exit(EXIT_FAILURE);
+    }
+  }
+
+  if (optind >= argc)
+  {
+    fprintf(stderr, "no capture file provided\nExiting...\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if (configFile != NULL)
+  {
+    if (configfile_read(configFile) != 0)
+    {
+      exit(EXIT_FAILURE);
+    }
+    //an explicit -s wins over the config file
+    if ((replay_script == NULL) && (config_scriptName != NULL))
+    {
+      replay_script = config_scriptName;
+    }
+  }
+  if (replay_script == NULL)
+  {
+    replay_script = REPLAY_DEFAULT_SCRIPT;
+  }
+
+  openlog("zb_replay", LOG_PERROR, LOG_USER);
+  setlogmask(LOG_UPTO(LOG_WARNING));
+  //spool_dir of the config file is the daemon's one, replaying it would consume its backlog
+  //history_dir is never opened: a second writer corrupts the daemon's segment, and the
+  //replayed frames would be stored as readings of now
+  if (spoolDir != NULL)
+  {
+    spool_open(spoolDir,
+               ((uint64_t) ((config_spool_max_size != 0) ? config_spool_max_size : SPOOL_DEFAULT_MAX_SIZE)) * 1024);
+  }
+  //same delivery as the controller, script_persistent is read from the config file
+  sink_init(replay_script, config_script_persistent);
+  if (config_sink_batch_max != 0)
+  {
+    sink_setBatching(config_sink_batch_max,
+                     (config_sink_batch_delay != 0) ? config_sink_batch_delay : SINK_DEFAULT_BATCH_DELAY);
+  }
+  if (config_sink_workers != 0)
+  {
+    sink_startWorkers(config_sink_workers, (config_sink_queue_size != 0) ? config_sink_queue_size : SINK_DEFAULT_QUEUE,
+                      (sink_overflowPolicy) config_sink_overflow);
+  }
+
+  if (capture_openReadOnly(&capture, argv[optind]) == false)
+  {
+    exit(EXIT_FAILURE);
+  }
+
+  //the read side behaves like the serial port, non blocking
+  if ((pipe(pipeFd) != 0) || (fcntl(pipeFd[0], F_SETFL, O_NONBLOCK) != 0))
+  {
+    fprintf(stderr, "unable to create the pipe\n");
+    exit(EXIT_FAILURE);
+  }
+
+  zigbee_protocol_initialize(&zigbee, pipeFd[0], ZIGBEE_DEFAULT_SERIAL_SPEED, replay_buffer, REPLAY_BUFFER_SIZE,
+                             onDataCallBack);
+
+  replay_result.lag.min = UINT64_MAX;
+  replay_result.decode.min = UINT64_MAX;
+  replay_result.sink.min = UINT64_MAX;
+
+  firstTimestamp = 0;
+  startTime = monotonic_getTimeNs();
+  offset = capture.header->tail;
+  while ((record = capture_getNext(&capture, &offset)) != NULL)
+  {
+    if (record->direction != CAPTURE_DIR_RX)
+    {
+      continue;
+    }
+
+    if (firstTimestamp == 0)
+    {
+      firstTimestamp = record->timestamp;
+    }
+
+    if (speed > 0)
+    {
+      scheduled = startTime + (uint64_t) ((record->timestamp - firstTimestamp) / speed);
+      replay_waitUntil(scheduled);
+      replay_pushTime = monotonic_getTimeNs();
+      replay_addSample(&replay_result.lag, replay_pushTime - scheduled);
+    }
+    else
+    {
+      replay_pushTime = monotonic_getTimeNs();
+    }
+
+    //the pipe is only read after the write, a frame the parser can't hold would block the replay
+    if (record->size > REPLAY_BUFFER_SIZE)
+    {
+      fprintf(stderr, "frame of %u bytes skipped, larger than the frame buffer\n", record->size);
+      continue;
+    }
+
+    frame = (const uint8_t*) &record[1];
+    if (write(pipeFd[1], frame, record->size) != record->size)
+    {
+      fprintf(stderr, "unable to write a frame of %u bytes in the pipe\n", record->size);
+      break;
+    }
+    replay_result.nbRxFrames++;
+    replay_result.nbBytes += record->size;
+    if ((record->size > ZIGBEE_HEADER_SIZE) && (frame[ZIGBEE_HEADER_SIZE] == ZIGBEE_RECEIVE_PACKET))
+    {
+      replay_result.nbDataFrames++;
+    }
+
+    //the frame is complete in the pipe, one call reads and dispatches it
+    zigbee_handleInput(&zigbee);
+    sink_checkChild();
+    sink_handleTimeout();
+  }
+  duration = monotonic_getTimeNs() - startTime;
+
+  printf("capture: %llu records, %llu overwritten before the replay\n",
+         (unsigned long long) capture.header->nbRecords, (unsigned long long) capture.header->nbOverwritten);
+  printf("replayed %llu frames (%llu bytes) in %.3f s at x%g: %.1f frames/s\n",
+         (unsigned long long) replay_result.nbRxFrames, (unsigned long long) replay_result.nbBytes,
+         (double) duration / MONOTONIC_NS_PER_S, speed,
+         (duration != 0) ? (double) replay_result.nbRxFrames * MONOTONIC_NS_PER_S / duration : 0.0);
+  printf("dropped: %llu data frames not delivered, %u checksum errors, %u length errors, %u bytes discarded\n",
+         (unsigned long long) (replay_result.nbDataFrames - replay_result.nbDelivered),
+         zigbee.parser.nbChecksumErrors, zigbee.parser.nbLengthErrors, zigbee.parser.nbDiscardedBytes);
+  if (speed > 0)
+  {
+    replay_printStat("schedule lag", &replay_result.lag);
+  }
+  replay_printStat("read+decode", &replay_result.decode);
+  replay_printStat("sink", &replay_result.sink);
+
+  sink_close();
+  spool_close();
+  capture_close(&capture);
+  close(pipeFd[0]);
+  close(pipeFd[1]);
+  closelog();
+
+  return EXIT_SUCCESS;
+}
+
+static void onDataCallBack(zigbee_obj* obj, zigbee_decodedFrame* frame)
+{
+  uint64_t now;
+
+  UNUSED(obj);
+  now = monotonic_getTimeNs();
+  replay_addSample(&replay_result.decode, now - replay_pushTime);
+  replay_result.nbDelivered++;
+
+  sensor_readAndProvideSensorData(frame, replay_script);
+  replay_addSample(&replay_result.sink, monotonic_getTimeNs() - now);
+}
+
+static void replay_addSample(replay_stat* stat, uint64_t value)
+{
+  stat->count++;
+  stat->sum += value;
+  if (value < stat->min)
+  {
+    stat->min = value;
+  }
+  if (value > stat->max)
+  {
+    stat->max = value;
+  }
+}
+
+static void replay_printStat(const char* name, replay_stat* stat)
+{
+  if (stat->count == 0)
+  {
+    printf("%-12s: no sample\n", name);
+    return;
+  }
+
+  printf("%-12s: min %8.1f us, avg %8.1f us, max %8.1f us (%llu samples)\n", name,
+         stat->min / 1000.0, (double) stat->sum / stat->count / 1000.0, stat->max / 1000.0,
+         (unsigned long long) stat->count);
+}
+
+static void replay_waitUntil(uint64_t deadline)
+{
+  struct timespec ts;
+
+  ts.tv_sec = deadline / MONOTONIC_NS_PER_S;
+  ts.tv_nsec = deadline % MONOTONIC_NS_PER_S;
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+  {
+    //interrupted, sleep again until the deadline
+  }
+}
@@ -10,6 +10,11 @@
 #include <stdlib.h>
 #include "sensor_db.h"
 #include "webcmd.h"
+#include "latency.h"
+#include "monotonic.h"
+#include "probes.h"
+#include "sink.h"
+#include "history.h"
 
 typedef struct
 {
@@ -32,7 +37,7 @@ typedef struct
   uint8_t v3;
 } __attribute__((packed)) sensorDbgFrameStruct;
 
-typedef struct
+struct zb_payload_frame_s
 {
   uint8_t dataType;
   uint8_t counter;
@@ -41,7 +46,7 @@ typedef struct
     sensorFrameStruct frame;
     sensorDbgFrameStruct dbgFrame;
   };
-} __attribute__((packed)) zb_payload_frame;
+} __attribute__((packed));
 
 typedef enum
 {
@@ -61,45 +66,33 @@ typedef enum
   ACT_HEATER = 0x81
 } sensor_Type;
 
-#define SENSOR_MAX  (100)
+#define SENSOR_MAX  (HISTORY_MAX_BATCH) //slots of history_reserve()
 #define SENSOR_CMD_LINE_SIZE (1024)
 #define SENSOR_TMP_SIZE (50)
 #define HEX_SIZE  (3)
 
-typedef enum
-{
-  DOUBLE,
-  STRING
-} sensor_data_type;
-
-typedef struct
-{
-  uint8_t id;
-  char* unit;
-  sensor_data_type type;
-  union
-  {
-    double value;
-    const char* sValue;
-  };
-} sensorDataForScript;
-
-
-static sensorDataForScript gData[SENSOR_MAX];
+//readings of the last frame, in the history segment (history_reserve()) when it is opened
+static history_record* gData;
 static uint32_t gIndex;
+static sensor_stats sensor_statistics;
 
-static void sensor_readData(zb_payload_frame* payload);
 static void sensor_buildAddress(zigbee_64bDestAddr* zbAddr, char* buffer, uint32_t size);
+static const char* sensor_getUnit(uint8_t type);
+static const char* sensor_getHeatMode(uint8_t mode);
 
 void sensor_readAndProvideSensorData(zigbee_decodedFrame* decodedData, const char* scriptExe)
 {
   assert(decodedData != NULL);
   assert(decodedData->type == ZIGBEE_RECEIVE_PACKET);
-  char commandline[SENSOR_CMD_LINE_SIZE];
+  char record[SENSOR_CMD_LINE_SIZE];
   char address[SENSOR_TMP_SIZE];
   char temp[SENSOR_TMP_SIZE];
   uint32_t i;
   bool isRetry;
+  uint64_t sinkStart;
+  uint64_t sinkEnd;
+  bool bDelivered;
+  struct timespec now;
 
   zb_payload_frame* payload = (zb_payload_frame*) decodedData->receivedPacket.payload;
 
@@ -111,40 +104,45 @@ void sensor_readAndProvideSensorData(zigbee_decodedFrame* decodedData, const cha
       if (isRetry == false)
       {
         sensor_readData(payload);
-        snprintf(commandline, SENSOR_CMD_LINE_SIZE, "%s address=", scriptExe);
-        strcat(commandline, address);
-        strcat(commandline, " ");
+        clock_gettime(CLOCK_REALTIME, &now);
+        //moved by a new segment
+        gData = history_commit(&decodedData->receivedPacket.receiver64bAddr,
+                               ((uint64_t) now.tv_sec) * MONOTONIC_NS_PER_S + now.tv_nsec, gIndex);
+        latency_mark(LATENCY_DATA_READ);
+        snprintf(record, SENSOR_CMD_LINE_SIZE, "address=");
+        strcat(record, address);
+        strcat(record, " ");
 
         for (i = 0; i < gIndex; i++)
         {
           temp[0] = '\0';
           snprintf(temp, SENSOR_TMP_SIZE, "id=%d ", gData[i].id);
-          strcat(commandline, temp);
-          strcat(commandline, gData[i].unit);
-          strcat(commandline, "=");
-          switch (gData[i].type)
+          strcat(record, temp);
+          strcat(record, sensor_getUnit(gData[i].type));
+          strcat(record, "=");
+          if (gData[i].type == ACT_HEATER)
           {
-            case DOUBLE:
-              snprintf(temp, SENSOR_TMP_SIZE, "%.3f ", gData[i].value);
-              break;
-
-            case STRING:
-              snprintf(temp, SENSOR_TMP_SIZE, "%s ", gData[i].sValue);
-              break;
-
-            default:
-              //not possible, decoded earlier...
-              assert(false);
-              break;
+            //mode checked when decoded
+            snprintf(temp, SENSOR_TMP_SIZE, "%s ", sensor_getHeatMode((uint8_t) gData[i].value));
           }
-          strcat(commandline, temp);
+          else
+          {
+            snprintf(temp, SENSOR_TMP_SIZE, "%.3f ", gData[i].value);
+          }
+          strcat(record, temp);
         }
-        syslog(LOG_DEBUG, "commandline: %s", commandline);
-        system(commandline);
+        sinkStart = monotonic_getTimeNs();
+        latency_markAt(LATENCY_SINK_STARTED, sinkStart);
+        ZB_PROBE2(sink_start, address, gIndex);
+        bDelivered = sink_send(scriptExe, record);
+        sinkEnd = monotonic_getTimeNs();
+        latency_markAt(LATENCY_SINK_DONE, sinkEnd);
+        ZB_PROBE3(sink_end, address, bDelivered, sinkEnd - sinkStart);
       }
       else
       {
         syslog(LOG_INFO, "retry frame for '%s', counter = %u", address, payload->counter);
+        sensor_statistics.nbRetries++;
       }
       break;
 
@@ -159,6 +157,74 @@ void sensor_readAndProvideSensorData(zigbee_decodedFrame* decodedData, const cha
 }
 
 
+const sensor_stats* sensor_getStats(void)
+{
+  return &sensor_statistics;
+}
+
+static const char* sensor_getUnit(uint8_t type)
+{
+  switch (type)
+  {
+    case SENSOR_HYT221_TEMP:
+      return "temp";
+
+    case SENSOR_HYT221_HUM:
+      return "humd";
+
+    case SENSOR_VOLTAGE:
+      return "volt";
+
+    case SENSOR_WIND_SPEED:
+      return "wind_speed";
+
+    case SENSOR_WIND_DIR:
+      return "wind_dir";
+
+    case SENSOR_PRESSURE:
+      return "press";
+
+    case SENSOR_RAINFALL:
+      return "rain_fall";
+
+    case ACT_HEATER:
+      return "heat";
+
+    default:
+      //not possible, decoded earlier...
+      assert(false);
+      return "unknown";
+  }
+}
+
+///NULL for an unknown mode
+static const char* sensor_getHeatMode(uint8_t mode)
+{
+  switch (mode)
+  {
+    case CONFORT:
+      return "CONFORT";
+
+    case CONFORT_M1:
+      return "CONFORT_M1";
+
+    case CONFORT_M2:
+      return "CONFORT_M2";
+
+    case ECO:
+      return "ECO";
+
+    case HG:
+      return "HG";
+
+    case STOP:
+      return "STOP";
+
+    default:
+      return NULL;
+  }
+}
+
 static void sensor_buildAddress(zigbee_64bDestAddr* zbAddr, char* buffer, uint32_t size)
 {
   UNUSED(size);
@@ -180,7 +246,7 @@ static void sensor_buildAddress(zigbee_64bDestAddr* zbAddr, char* buffer, uint32
   }
 }
 
-static void sensor_readData(zb_payload_frame* payload)
+uint32_t sensor_readData(zb_payload_frame* payload)
 {
   uint8_t nbSensor;
   uint8_t id;
@@ -194,10 +260,12 @@ static void sensor_readData(zb_payload_frame* payload)
   double batt;
 
   nbSensor = payload->frame.sensorDataNumber;
+  gData = history_reserve();
   gIndex = 0;
 
   for (id = 0; ((id < nbSensor) && (gIndex < SENSOR_MAX)); id++)
   {
+    gData[gIndex].type = payload->frame.sensors[id].type;
     switch (payload->frame.sensors[id].type)
     {
       case SENSOR_HYT221_TEMP:
@@ -206,9 +274,7 @@ static void sensor_readData(zb_payload_frame* payload)
           temp_raw = ntohs(payload->frame.sensors[id].data);
           temp = ((165.0 * temp_raw) / 16383.0) - 40.0;
           gData[gIndex].id = id;
-          gData[gIndex].type = DOUBLE;
           gData[gIndex].value = temp;
-          gData[gIndex].unit = "temp";
           gIndex++;
         }
         break;
@@ -219,9 +285,7 @@ static void sensor_readData(zb_payload_frame* payload)
           humidity_raw = ntohs(payload->frame.sensors[id].data);
           humidity = (100.0 * humidity_raw) / 16383.0;
           gData[gIndex].id = id;
-          gData[gIndex].type = DOUBLE;
           gData[gIndex].value = humidity;
-          gData[gIndex].unit = "humd";
           gIndex++;
         }
         break;
@@ -233,9 +297,7 @@ static void sensor_readData(zb_payload_frame* payload)
           batt = (batt_raw * 3.3) / 1023.0;
           batt = (batt * (2.2 + 4.7)) / 2.2;
           gData[gIndex].id = id;
-          gData[gIndex].type = DOUBLE;
           gData[gIndex].value = batt;
-          gData[gIndex].unit = "volt";
           gIndex++;
         }
         break;
@@ -244,9 +306,7 @@ static void sensor_readData(zb_payload_frame* payload)
         raw_data = ntohs(payload->frame.sensors[id].data);
         raw_double_data =  (((double)raw_data)*3.6) / 100.0;
         gData[gIndex].id = id;
-        gData[gIndex].type = DOUBLE;
         gData[gIndex].value = raw_double_data;
-        gData[gIndex].unit = "wind_speed";
         gIndex++;
         break;
 
@@ -254,9 +314,7 @@ static void sensor_readData(zb_payload_frame* payload)
         raw_data = ntohs(payload->frame.sensors[id].data);
         raw_double_data = ((double) raw_data) / 10.0;
         gData[gIndex].id = id;
-        gData[gIndex].type = DOUBLE;
         gData[gIndex].value = raw_double_data;
-        gData[gIndex].unit = "wind_dir";
         gIndex++;
         break;
 
@@ -264,9 +322,7 @@ static void sensor_readData(zb_payload_frame* payload)
         raw_data = ntohs(payload->frame.sensors[id].data);
         raw_double_data = raw_data / 10.0;
         gData[gIndex].id = id;
-        gData[gIndex].type = DOUBLE;
         gData[gIndex].value = raw_double_data;
-        gData[gIndex].unit = "press";
         gIndex++;
         break;
 
@@ -274,55 +330,23 @@ static void sensor_readData(zb_payload_frame* payload)
         raw_data = ntohs(payload->frame.sensors[id].data);
         raw_double_data = ((double) raw_data) / 100.0;
         gData[gIndex].id = id;
-        gData[gIndex].type = DOUBLE;
         gData[gIndex].value = raw_double_data;
-        gData[gIndex].unit = "rain_fall";
         gIndex++;
         break;
 
       case ACT_HEATER:
         if (payload->frame.sensors[id].status == 0x03)
         {
-          bool bOk;
-          bOk = true;
-          switch (ntohs(payload->frame.sensors[id].data) & 0x00FF)
+          raw_data = ntohs(payload->frame.sensors[id].data);
+          if (sensor_getHeatMode(raw_data & 0x00FF) != NULL)
           {
-            case CONFORT:
-              gData[gIndex].sValue = "CONFORT";
-              break;
-
-            case CONFORT_M1:
-              gData[gIndex].sValue = "CONFORT_M1";
-              break;
-
-            case CONFORT_M2:
-              gData[gIndex].sValue = "CONFORT_M2";
-              break;
-
-            case ECO:
-              gData[gIndex].sValue = "ECO";
-              break;
-
-            case HG:
-              gData[gIndex].sValue = "HG";
-              break;
-
-            case STOP:
-              gData[gIndex].sValue = "STOP";
-              break;
-
-            default:
-              bOk = false;
-              syslog(LOG_INFO, "unable to decode heat value %d. Skypping...", ntohs(payload->frame.sensors[id].data));
-              break;
+            gData[gIndex].id = (raw_data & 0xFF00) >> 8;
+            gData[gIndex].value = raw_data & 0x00FF;
+            gIndex++;
           }
-
-          if (bOk)
+          else
           {
-            gData[gIndex].id = (ntohs(payload->frame.sensors[id].data) & 0xFF00) >> 8;
-            gData[gIndex].type = STRING;
-            gData[gIndex].unit = "heat";
-            gIndex++;
+            syslog(LOG_INFO, "unable to decode heat value %d. Skypping...", raw_data);
           }
         }
         break;
@@ -331,6 +355,8 @@ static void sensor_readData(zb_payload_frame* payload)
         break;
     }
   }
+
+  return gIndex;
 }
 
 #define SENSOR_PROTOCOL_DATA_TYPE   (0x00)
@@ -4,7 +4,20 @@
 #include "zigbee.h"
 #include "webcmd.h"
 
+typedef struct
+{
+  uint32_t nbRetries; //frames already received, detected by sensor_db_update()
+} sensor_stats;
+
 extern void sensor_readAndProvideSensorData(zigbee_decodedFrame* decodedData, const char* scriptExe);
 extern uint32_t sensor_build_command(webmsg* receivedCmd, uint8_t buffer[], uint32_t size);
+extern const sensor_stats* sensor_getStats(void);
+
+/**
+ * Function public only for benchmarks, payload is the RF data of a receive packet
+ */
+typedef struct zb_payload_frame_s zb_payload_frame;
+/// decodes the readings in the slots of history_reserve(), returns their number
+extern uint32_t sensor_readData(zb_payload_frame* payload);
 
 #endif /* __SENSOR_H__ */
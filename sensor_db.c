@@ -3,6 +3,7 @@
 #include <string.h>
 #include "sensor_db.h"
 #include "assert.h"
+#include "probes.h"
 
 #define DEFAULT_ALLOCATED   (10)
 
@@ -45,6 +46,7 @@ bool sensor_db_update(zigbee_64bDestAddr* zbAddr, uint8_t counter)
   if ((newlyAdded == false) && (pSensor->lastFrameID == counter))
   {
     isRetry = true;
+    ZB_PROBE2(dedup_hit, zbAddr, counter);
   }
   else
   {
@@ -56,6 +58,19 @@ bool sensor_db_update(zigbee_64bDestAddr* zbAddr, uint8_t counter)
 }
 
 
+void sensor_db_clear(void)
+{
+  free(sensor_db_pData);
+  sensor_db_pData = NULL;
+  sensor_db_count = 0;
+  sensor_db_nbAllocated = 0;
+}
+
+uint32_t sensor_db_getCount(void)
+{
+  return sensor_db_count;
+}
+
 static sensor_db* sensor_db_search(zigbee_64bDestAddr* zbAddr)
 {
   sensor_db* found;
@@ -79,8 +94,8 @@ static sensor_db* sensor_db_add(zigbee_64bDestAddr* zbAddr, uint8_t counter)
 {
   if (sensor_db_count >= sensor_db_nbAllocated)
   {
-    sensor_db_nbAllocated = 2 * sensor_db_nbAllocated * sizeof(sensor_db);
-    sensor_db* pNewData = realloc(sensor_db_pData, sensor_db_nbAllocated);
+    sensor_db_nbAllocated = 2 * sensor_db_nbAllocated;
+    sensor_db* pNewData = realloc(sensor_db_pData, sensor_db_nbAllocated * sizeof(sensor_db));
     sensor_db_pData = pNewData;
     assert(sensor_db_pData != NULL);
   }
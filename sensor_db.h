@@ -5,6 +5,10 @@
 #include <stdbool.h>
 
 extern bool sensor_db_update(zigbee_64bDestAddr* zbAddr, uint8_t counter);
+/// forget every sensor, the next update starts a new database
+extern void sensor_db_clear(void);
+/// number of sensors heard since the start
+extern uint32_t sensor_db_getCount(void);
 
 
 #endif /* __SENSOR_DB_H__ */
@@ -8,15 +8,26 @@
 #include <errno.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
 #include "serial.h"
 #include <assert.h>
 #include <syslog.h>
 
-static uint32_t serial_convertBaudRateToFlag(uint32_t baudrate);
+static bool serial_convertBaudRateToFlag(uint32_t baudrate, speed_t* speedFlag);
 
-int32_t serial_set_interface (int32_t fd, int32_t speedFlags, int32_t parity, int32_t rtscts, int32_t nbstop)
+int32_t serial_set_interface (int32_t fd, int32_t speed, int32_t parity, int32_t rtscts, int32_t nbstop)
 {
   struct termios tty;
+  speed_t speedFlags;
+  bool bStandardSpeed;
+
+  //non standard speeds are set once the line is configured
+  bStandardSpeed = serial_convertBaudRateToFlag(speed, &speedFlags);
+  if (bStandardSpeed == false)
+  {
+    speedFlags = B38400;
+  }
   memset (&tty, 0, sizeof tty);
   if (tcgetattr (fd, &tty) != 0)
   {
@@ -74,6 +85,11 @@ int32_t serial_set_interface (int32_t fd, int32_t speedFlags, int32_t parity, in
     perror ("error from tcsetattr");
     return -1;
   }
+
+  if (bStandardSpeed == false)
+  {
+    return serial_set_custom_baudrate(fd, speed);
+  }
   return 0;
 }
 
@@ -97,12 +113,24 @@ void serial_set_blocking (int32_t fd, int32_t should_block)
 }
 
 
+void serial_flushInput(int32_t fd)
+{
+  if (tcflush(fd, TCIFLUSH) != 0)
+  {
+    syslog(LOG_ERR, "unable to flush serial input (errno = %d)", errno);
+  }
+}
+
 int32_t serial_set_baudrate(int32_t fd, int32_t baudrate)
 {
   struct termios tty;
-  int32_t speedFlags;
+  speed_t speedFlags;
+
+  if (serial_convertBaudRateToFlag(baudrate, &speedFlags) == false)
+  {
+    return serial_set_custom_baudrate(fd, baudrate);
+  }
 
-  speedFlags = serial_convertBaudRateToFlag(baudrate);
   memset (&tty, 0, sizeof tty);
   if (tcgetattr (fd, &tty) != 0)
   {
@@ -125,22 +153,23 @@ int32_t serial_set_baudrate(int32_t fd, int32_t baudrate)
 int32_t serial_setup(char* device, int32_t speed, int32_t parity, int32_t rtscts, int32_t nbstop)
 {
   int32_t fd;
-  int32_t speedFlags;
 
-  fd = open (device, O_RDWR | O_NOCTTY | O_SYNC);
+  fd = open (device, O_RDWR | O_NOCTTY | O_NONBLOCK);
   if (fd >= 0)
   {
-    speedFlags = serial_convertBaudRateToFlag(speed);
-    serial_set_interface (fd, speedFlags, parity, rtscts, nbstop);
+    serial_set_interface (fd, speed, parity, rtscts, nbstop);
     // set no blocking already set
     //serial_set_blocking (fd, 0);
   }
   return fd;
 }
 
-static uint32_t serial_convertBaudRateToFlag(uint32_t baudrate)
+static bool serial_convertBaudRateToFlag(uint32_t baudrate, speed_t* speedFlag)
 {
-  uint32_t baudrateValue;
+  speed_t baudrateValue;
+  bool bStandardSpeed;
+
+  bStandardSpeed = true;
 
   switch (baudrate)
   {
@@ -200,13 +229,27 @@ static uint32_t serial_convertBaudRateToFlag(uint32_t baudrate)
       baudrateValue = B115200;
       break;
 
+    case 230400:
+      baudrateValue = B230400;
+      break;
+
+    case 460800:
+      baudrateValue = B460800;
+      break;
+
+    case 921600:
+      baudrateValue = B921600;
+      break;
+
     default:
-      baudrateValue = B9600;
-      syslog(LOG_WARNING, "unknwon speed value, set to 9600bps");
+      //set through termios2
+      baudrateValue = B0;
+      bStandardSpeed = false;
       break;
   }
 
-  return baudrateValue;
+  *speedFlag = baudrateValue;
+  return bStandardSpeed;
 }
 
 
@@ -254,6 +297,69 @@ bool serial_read(int32_t fd, uint8_t* buffer, uint32_t size)
   return bResult;
 }
 
+int32_t serial_readAvailable(int32_t fd, uint8_t* buffer, uint32_t size)
+{
+  ssize_t nbRead;
+
+  nbRead = read(fd, buffer, size);
+  if (nbRead == -1)
+  {
+    if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+    {
+      return 0;
+    }
+    syslog(LOG_ERR, "Error on read data errno = %d", errno);
+  }
+
+  return nbRead;
+}
+
+int32_t serial_writeAvailable(int32_t fd, uint8_t* buffer, uint32_t size)
+{
+  ssize_t nbWritten;
+
+  nbWritten = write(fd, buffer, size);
+  if (nbWritten == -1)
+  {
+    if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+    {
+      return 0;
+    }
+    syslog(LOG_ERR, "unable to send data on serial line errno = %d", errno);
+  }
+
+  return nbWritten;
+}
+
+int32_t serial_writevAvailable(int32_t fd, const struct iovec* iov, uint32_t nbIov)
+{
+  ssize_t nbWritten;
+
+  nbWritten = writev(fd, iov, nbIov);
+  if (nbWritten == -1)
+  {
+    if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+    {
+      return 0;
+    }
+    syslog(LOG_ERR, "unable to send data on serial line errno = %d", errno);
+  }
+
+  return nbWritten;
+}
+
+int32_t serial_getCTS(int32_t fd)
+{
+  int32_t status;
+
+  if (ioctl(fd, TIOCMGET, &status) != 0)
+  {
+    return -1;
+  }
+
+  return ((status & TIOCM_CTS) != 0) ? 1 : 0;
+}
+
 bool serial_write(int32_t fd, uint8_t* buffer, uint32_t size)
 {
   ssize_t nbWritten;
@@ -3,6 +3,7 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <sys/uio.h>
 
 #define SERIAL_PARITY_OFF       (0)
 #define SERIAL_PARITY_ON        (1)
@@ -15,7 +16,16 @@
 
 extern int32_t  serial_setup(char* device, int32_t speed, int32_t parity, int32_t rtscts, int32_t nbstop);
 extern bool serial_read(int32_t fd, uint8_t* buffer, uint32_t size);
+extern int32_t serial_readAvailable(int32_t fd, uint8_t* buffer, uint32_t size);
 extern bool serial_write(int32_t fd, uint8_t* buffer, uint32_t size);
+/// non blocking: number of bytes written, 0 when the line is busy, -1 on error
+extern int32_t serial_writeAvailable(int32_t fd, uint8_t* buffer, uint32_t size);
+/// same as serial_writeAvailable(), gathering several buffers in one call
+extern int32_t serial_writevAvailable(int32_t fd, const struct iovec* iov, uint32_t nbIov);
+/// CTS line state: 1 asserted, 0 deasserted, -1 unknown
+extern int32_t serial_getCTS(int32_t fd);
 extern int32_t serial_set_baudrate(int32_t fd, int32_t baudrate);
+extern void serial_flushInput(int32_t fd);
+extern int32_t serial_set_custom_baudrate(int32_t fd, uint32_t baudrate); //any speed, through termios2
 
 #endif /* SERIAL_H */
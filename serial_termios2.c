@@ -0,0 +1,34 @@
+/*
+ * arbitrary baud rates through termios2/BOTHER.
+ * kept apart from serial.c: <asm/termbits.h> can't be included with <termios.h>
+ */
+#include <asm/termbits.h>
+#include <sys/ioctl.h>
+#include <stdint.h>
+#include <errno.h>
+#include <syslog.h>
+#include "serial.h"
+
+int32_t serial_set_custom_baudrate(int32_t fd, uint32_t baudrate)
+{
+  struct termios2 tty;
+
+  if (ioctl(fd, TCGETS2, &tty) != 0)
+  {
+    syslog(LOG_ERR, "error from TCGETS2 (errno = %d)", errno);
+    return -1;
+  }
+
+  tty.c_cflag &= ~(CBAUD | (CBAUD << IBSHIFT));
+  tty.c_cflag |= BOTHER | (BOTHER << IBSHIFT);
+  tty.c_ispeed = baudrate;
+  tty.c_ospeed = baudrate;
+
+  if (ioctl(fd, TCSETS2, &tty) != 0)
+  {
+    syslog(LOG_ERR, "unable to set %d bps (errno = %d)", baudrate, errno);
+    return -1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,588 @@
+#define _GNU_SOURCE //posix_openpt(), ptsname()
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+#include <arpa/inet.h>
+#include "zigbee.h"
+#include "monotonic.h"
+
+/**
+ * XBee coordinator emulator on a pseudo terminal: point ttydevice at the printed slave
+ * (or at the -l link) and zb_controler runs end to end without a radio.
+ * - every AT command used by the protocol layer is answered, parameters are kept in memory,
+ *   queued parameters (0x09) are applied at once,
+ * - AC (re)starts the network: AI is 0xFF, then 0 with a "coordinator started" modem status,
+ * - transmit requests are acknowledged with a successful transmit status,
+ * - N virtual sensor nodes send receive packets in the sensor.c payload format,
+ *   at R frames/s each, spread evenly.
+ * The GPIO reset can't be seen, the controller falls back on its reset timeout.
+ */
+
+#define SIM_BUFFER_SIZE         (256)
+#define SIM_AT_VALUE_SIZE       (20)
+#define SIM_NB_PARAMETERS       (32)
+#define SIM_ASSOCIATION_TIME    (200) //in ms, from AC to the coordinator started status
+#define SIM_NODE_SERIAL_HIGH    (0x0013A200)
+#define SIM_NODE_SERIAL_LOW     (0x41000000)
+#define SIM_NODE_16B_BASE       (0x1000)
+#define SIM_ND_PARENT           (0xFFFE)
+#define SIM_ND_ROUTER           (1)
+#define SIM_PROFILE_ID          (0xC105)
+#define SIM_MANUFACTURER_ID     (0x101E)
+#define SIM_STATUS_OK           (0)
+#define SIM_STATUS_INVALID_CMD  (2)
+
+typedef struct
+{
+  char cmd[2];
+  uint8_t value[SIM_AT_VALUE_SIZE];
+  uint32_t size;
+} sim_parameter;
+
+typedef struct
+{
+  uint64_t nbAT;
+  uint64_t nbTxRequests;
+  uint64_t nbRxPackets; //sent by the virtual nodes
+  uint64_t nbDropped; //not written, nobody reads the slave side
+  uint64_t nbParserErrors;
+} sim_stats;
+
+static sim_parameter sim_parameters[SIM_NB_PARAMETERS];
+static uint32_t sim_nbParameters;
+static zigbee_parser sim_parser;
+static uint8_t sim_apiMode = ZIGBEE_API_MODE_UNESCAPED;
+static int32_t sim_fd = -1;
+static uint64_t sim_associationDeadline;
+static sim_stats sim_result;
+static uint32_t sim_nbNodes = 1;
+static volatile sig_atomic_t sim_bRunning = 1;
+
+static void sim_setParameter(const char* cmd, const uint8_t* value, uint32_t size);
+static sim_parameter* sim_getParameter(const char* cmd);
+static void sim_initParameters(void);
+static void sim_sendFrame(uint8_t* data, uint32_t size);
+static void sim_sendATResponse(uint8_t frameID, const char* cmd, uint8_t status, const uint8_t* data, uint32_t size);
+static void sim_handleAT(uint8_t* data, uint32_t size);
+static void sim_handleNodeDiscover(uint8_t frameID, uint32_t nbNodes);
+static void sim_handleTxRequest(uint8_t* data, uint32_t size);
+static void sim_handleFrame(uint8_t* frame, uint32_t size);
+static void sim_sendSensorData(uint32_t node, uint8_t counter);
+static void sim_onSignal(int signo);
+
+int main(int argc, char* argv[])
+{
+  struct termios tio;
+  struct pollfd pfd;
+  uint8_t buffer[SIM_BUFFER_SIZE];
+  uint8_t frame[SIM_BUFFER_SIZE];
+  uint8_t* counters;
+  uint16_t frameSize;
+  uint32_t sizeToRead;
+  uint64_t now;
+  uint64_t startTime;
+  uint64_t interval;
+  uint64_t nextEmission;
+  uint64_t endTime;
+  uint64_t nbEmitted;
+  double rate;
+  char* link;
+  int32_t slaveFd;
+  int32_t timeout;
+  ssize_t nbRead;
+  int opt;
+
+  rate = 1.0;
+  link = NULL;
+  endTime = 0;
+
+  while ((opt = getopt(argc, argv, "hn:r:l:t:")) != -1)
+  {
+    switch (opt)
+    {
+      case 'n':
+        sim_nbNodes = strtoul(optarg, NULL, 0);
+        break;
+
+      case 'r':
+        rate = atof(optarg);
+        break;
+
+      case 'l':
+        link = optarg;
+        break;
+
+      case 't':
+        endTime = strtoull(optarg, NULL, 0) * MONOTONIC_NS_PER_S;
+        break;
+
+      case 'h':
+      default:
+        fprintf(stderr,
+                "usage : %s [-n <nodes, default 1>] [-r <frames/s per node, default 1, 0 for none>] [-l <symlink to the pty>] [-t <duration in s>]\n",
+                argv[0]);
+        exit(EXIT_FAILURE);
+    }
+  }
+
+  sim_fd = posix_openpt(O_RDWR | O_NOCTTY);
+  if ((sim_fd < 0) || (grantpt(sim_fd) != 0) || (unlockpt(sim_fd) != 0))
+  {
+    fprintf(stderr, "unable to create a pseudo terminal, errno = %d\n", errno);
+    exit(EXIT_FAILURE);
+  }
+
+  //the slave side is kept open: the controller can restart without an EIO on the master side
+  slaveFd = open(ptsname(sim_fd), O_RDWR | O_NOCTTY);
+  if ((slaveFd < 0) || (tcgetattr(slaveFd, &tio) != 0))
+  {
+    fprintf(stderr, "unable to open %s, errno = %d\n", ptsname(sim_fd), errno);
+    exit(EXIT_FAILURE);
+  }
+  cfmakeraw(&tio);
+  tcsetattr(slaveFd, TCSANOW, &tio);
+  fcntl(sim_fd, F_SETFL, O_NONBLOCK);
+
+  if (link != NULL)
+  {
+    unlink(link);
+    if (symlink(ptsname(sim_fd), link) != 0)
+    {
+      fprintf(stderr, "unable to create the link %s, errno = %d\n", link, errno);
+      exit(EXIT_FAILURE);
+    }
+  }
+  printf("%s\n", ptsname(sim_fd));
+  fflush(stdout);
+
+  signal(SIGINT, sim_onSignal);
+  signal(SIGTERM, sim_onSignal);
+
+  sim_initParameters();
+  zigbee_parser_init(&sim_parser);
+  counters = calloc((sim_nbNodes != 0) ? sim_nbNodes : 1, sizeof(uint8_t));
+  if (counters == NULL)
+  {
+    exit(EXIT_FAILURE);
+  }
+
+  startTime = monotonic_getTimeNs();
+  if (endTime != 0)
+  {
+    endTime += startTime;
+  }
+  interval = ((rate > 0) && (sim_nbNodes != 0)) ? (uint64_t) (MONOTONIC_NS_PER_S / (rate * sim_nbNodes)) : 0;
+  nextEmission = startTime + interval;
+  nbEmitted = 0;
+
+  pfd.fd = sim_fd;
+  pfd.events = POLLIN;
+  while (sim_bRunning)
+  {
+    now = monotonic_getTimeNs();
+    if ((endTime != 0) && (now >= endTime))
+    {
+      break;
+    }
+
+    //virtual nodes, late emissions are caught up at once
+    while ((interval != 0) && (now >= nextEmission))
+    {
+      sim_sendSensorData(nbEmitted % sim_nbNodes, counters[nbEmitted % sim_nbNodes]++);
+      nbEmitted++;
+      nextEmission += interval;
+    }
+
+    if ((sim_associationDeadline != 0) && (now >= sim_associationDeadline))
+    {
+      sim_associationDeadline = 0;
+      sim_setParameter("AI", (const uint8_t[]) { 0x00 }, 1);
+      frame[0] = ZIGBEE_MODEM_STATUS;
+      frame[1] = ZIGBEE_MODEM_COORDINATOR_STARTED;
+      sim_sendFrame(frame, 2);
+    }
+
+    timeout = 100;
+    if ((interval != 0) && (((nextEmission - now) / MONOTONIC_NS_PER_MS) < (uint64_t) timeout))
+    {
+      timeout = (nextEmission - now) / MONOTONIC_NS_PER_MS;
+    }
+    if ((sim_associationDeadline != 0) && (((sim_associationDeadline - now) / MONOTONIC_NS_PER_MS) < (uint64_t) timeout))
+    {
+      timeout = (sim_associationDeadline - now) / MONOTONIC_NS_PER_MS;
+    }
+
+    if (poll(&pfd, 1, timeout) <= 0)
+    {
+      continue;
+    }
+
+    sizeToRead = zigbee_parser_getFreeSize(&sim_parser);
+    if (sizeToRead > sizeof(buffer))
+    {
+      sizeToRead = sizeof(buffer);
+    }
+    nbRead = read(sim_fd, buffer, sizeToRead);
+    if (nbRead <= 0)
+    {
+      continue;
+    }
+
+    zigbee_parser_push(&sim_parser, buffer, nbRead);
+    while (zigbee_parser_getFrame(&sim_parser, frame, sizeof(frame), &frameSize) == true)
+    {
+      sim_handleFrame(frame, frameSize);
+    }
+  }
+
+  sim_result.nbParserErrors = sim_parser.nbChecksumErrors + sim_parser.nbLengthErrors;
+  printf("%llu AT commands, %llu transmit requests, %llu receive packets from %u nodes, %llu dropped, %llu parser errors\n",
+         (unsigned long long) sim_result.nbAT, (unsigned long long) sim_result.nbTxRequests,
+         (unsigned long long) sim_result.nbRxPackets, sim_nbNodes, (unsigned long long) sim_result.nbDropped,
+         (unsigned long long) sim_result.nbParserErrors);
+
+  if (link != NULL)
+  {
+    unlink(link);
+  }
+  free(counters);
+  close(slaveFd);
+  close(sim_fd);
+
+  return EXIT_SUCCESS;
+}
+
+static void sim_onSignal(int signo)
+{
+  (void) signo;
+  sim_bRunning = 0;
+}
+
+static void sim_initParameters(void)
+{
+  //a radio already configured and associated, as after a daemon restart
+  sim_setParameter("ID", (const uint8_t[]) { 0, 0, 0, 0, 0, 0, 0, 0 }, 8);
+  sim_setParameter("OP", (const uint8_t[]) { 0x2d, 0x56, 0x12, 0x58, 0xFF, 0xDE, 0xA0, 0x11 }, 8);
+  sim_setParameter("SC", (const uint8_t[]) { 0x7F, 0xFF }, 2);
+  sim_setParameter("SD", (const uint8_t[]) { 3 }, 1);
+  sim_setParameter("ZS", (const uint8_t[]) { 0 }, 1);
+  sim_setParameter("EE", (const uint8_t[]) { 0 }, 1);
+  sim_setParameter("SP", (const uint8_t[]) { 0x00, 0x20 }, 2);
+  sim_setParameter("SN", (const uint8_t[]) { 0x00, 0x01 }, 2);
+  sim_setParameter("NI", (const uint8_t*) " ", 1);
+  sim_setParameter("NJ", (const uint8_t[]) { 0xFF }, 1);
+  sim_setParameter("BD", (const uint8_t[]) { ZB_BD_115200 }, 1);
+  sim_setParameter("AP", (const uint8_t[]) { ZIGBEE_API_MODE_UNESCAPED }, 1);
+  sim_setParameter("D5", (const uint8_t[]) { 1 }, 1);
+  sim_setParameter("D6", (const uint8_t[]) { 0 }, 1);
+  sim_setParameter("D7", (const uint8_t[]) { 1 }, 1);
+  sim_setParameter("P0", (const uint8_t[]) { 1 }, 1);
+  sim_setParameter("RP", (const uint8_t[]) { 0x28 }, 1);
+  sim_setParameter("AI", (const uint8_t[]) { 0x00 }, 1);
+  sim_setParameter("HV", (const uint8_t[]) { 0x19, 0x42 }, 2);
+  sim_setParameter("VR", (const uint8_t[]) { 0x21, 0xA7 }, 2);
+  sim_setParameter("SH", (const uint8_t[]) { 0x00, 0x13, 0xA2, 0x00 }, 4);
+  sim_setParameter("SL", (const uint8_t[]) { 0x40, 0xD9, 0x68, 0x9C }, 4);
+  sim_setParameter("MY", (const uint8_t[]) { 0x00, 0x00 }, 2);
+  sim_setParameter("CH", (const uint8_t[]) { 0x0F }, 1);
+  sim_setParameter("DB", (const uint8_t[]) { 0x28 }, 1);
+  sim_setParameter("NP", (const uint8_t[]) { 0x00, 0x54 }, 2);
+}
+
+static sim_parameter* sim_getParameter(const char* cmd)
+{
+  uint32_t i;
+
+  for (i = 0; i < sim_nbParameters; i++)
+  {
+    if (memcmp(sim_parameters[i].cmd, cmd, 2) == 0)
+    {
+      return &sim_parameters[i];
+    }
+  }
+
+  return NULL;
+}
+
+static void sim_setParameter(const char* cmd, const uint8_t* value, uint32_t size)
+{
+  sim_parameter* parameter;
+
+  parameter = sim_getParameter(cmd);
+  if (parameter == NULL)
+  {
+    if (sim_nbParameters >= SIM_NB_PARAMETERS)
+    {
+      return;
+    }
+    parameter = &sim_parameters[sim_nbParameters++];
+    memcpy(parameter->cmd, cmd, 2);
+  }
+
+  if (size > SIM_AT_VALUE_SIZE)
+  {
+    size = SIM_AT_VALUE_SIZE;
+  }
+  memcpy(parameter->value, value, size);
+  parameter->size = size;
+}
+
+static void sim_sendFrame(uint8_t* data, uint32_t size)
+{
+  uint8_t frame[SIM_BUFFER_SIZE];
+  uint8_t escaped[2 * SIM_BUFFER_SIZE];
+  uint8_t* toWrite;
+  uint32_t sizeToWrite;
+
+  if ((size + ZIGBEE_ENCAPSULATION_SIZE) > sizeof(frame))
+  {
+    return;
+  }
+
+  frame[0] = ZIGBEE_START_DELIMITER;
+  frame[1] = size >> 8;
+  frame[2] = size & 0xFF;
+  memcpy(&frame[ZIGBEE_HEADER_SIZE], data, size);
+  frame[ZIGBEE_HEADER_SIZE + size] = zigbee_doChecksum(data, size);
+  toWrite = frame;
+  sizeToWrite = size + ZIGBEE_ENCAPSULATION_SIZE;
+
+  if (sim_apiMode == ZIGBEE_API_MODE_ESCAPED)
+  {
+    sizeToWrite = zigbee_escapeFrame(frame, sizeToWrite, escaped, sizeof(escaped));
+    toWrite = escaped;
+  }
+
+  //a frame is written whole or not at all, like a radio with a full buffer
+  if (write(sim_fd, toWrite, sizeToWrite) != (ssize_t) sizeToWrite)
+  {
+    sim_result.nbDropped++;
+  }
+}
+
+static void sim_sendATResponse(uint8_t frameID, const char* cmd, uint8_t status, const uint8_t* data, uint32_t size)
+{
+  uint8_t response[SIM_BUFFER_SIZE];
+
+  if ((frameID == 0) || ((size + 5) > sizeof(response)))
+  {
+    return;
+  }
+
+  response[0] = ZIGBEE_AT_COMMAND_RESPONSE;
+  response[1] = frameID;
+  response[2] = cmd[0];
+  response[3] = cmd[1];
+  response[4] = status;
+  memcpy(&response[5], data, size);
+  sim_sendFrame(response, size + 5);
+}
+
+static void sim_handleFrame(uint8_t* frame, uint32_t size)
+{
+  uint8_t* data;
+  uint32_t dataSize;
+
+  data = &frame[ZIGBEE_HEADER_SIZE];
+  dataSize = size - ZIGBEE_ENCAPSULATION_SIZE;
+  switch (data[0])
+  {
+    case ZIGBEE_API_AT_CMD:
+    case ZIGBEE_API_AT_QUEUE_CMD:
+      sim_handleAT(data, dataSize);
+      break;
+
+    case ZIGBEE_API_TRANSMIT_REQUEST:
+      sim_handleTxRequest(data, dataSize);
+      break;
+
+    default:
+      break;
+  }
+}
+
+static void sim_handleAT(uint8_t* data, uint32_t size)
+{
+  sim_parameter* parameter;
+  uint8_t frameID;
+  char cmd[2];
+
+  if (size < 4)
+  {
+    return;
+  }
+
+  sim_result.nbAT++;
+  frameID = data[1];
+  cmd[0] = data[2];
+  cmd[1] = data[3];
+
+  //actions
+  if ((memcmp(cmd, "WR", 2) == 0) || (memcmp(cmd, "NK", 2) == 0) || (memcmp(cmd, "KY", 2) == 0))
+  {
+    //keys are write only, WR has nothing to save
+    sim_sendATResponse(frameID, cmd, SIM_STATUS_OK, NULL, 0);
+    return;
+  }
+
+  if (memcmp(cmd, "AC", 2) == 0)
+  {
+    sim_setParameter("AI", (const uint8_t[]) { 0xFF }, 1);
+    sim_associationDeadline = monotonic_getTimeNs() + SIM_ASSOCIATION_TIME * MONOTONIC_NS_PER_MS;
+    sim_sendATResponse(frameID, cmd, SIM_STATUS_OK, NULL, 0);
+    return;
+  }
+
+  if (memcmp(cmd, "ND", 2) == 0)
+  {
+    sim_handleNodeDiscover(frameID, sim_nbNodes);
+    return;
+  }
+
+  parameter = sim_getParameter(cmd);
+  if (parameter == NULL)
+  {
+    sim_sendATResponse(frameID, cmd, SIM_STATUS_INVALID_CMD, NULL, 0);
+    return;
+  }
+
+  if (size == 4)
+  {
+    sim_sendATResponse(frameID, cmd, SIM_STATUS_OK, parameter->value, parameter->size);
+    return;
+  }
+
+  sim_setParameter(cmd, &data[4], size - 4);
+  if (memcmp(cmd, "ID", 2) == 0)
+  {
+    sim_setParameter("OP", &data[4], size - 4);
+  }
+
+  //like BD, the new framing applies after the reply
+  sim_sendATResponse(frameID, cmd, SIM_STATUS_OK, NULL, 0);
+  if (memcmp(cmd, "AP", 2) == 0)
+  {
+    sim_apiMode = data[4];
+    zigbee_parser_setEscaped(&sim_parser, (sim_apiMode == ZIGBEE_API_MODE_ESCAPED));
+  }
+}
+
+static void sim_handleNodeDiscover(uint8_t frameID, uint32_t nbNodes)
+{
+  uint8_t data[32];
+  uint32_t node;
+  uint32_t size;
+  uint32_t value;
+  uint16_t value16;
+
+  for (node = 0; node < nbNodes; node++)
+  {
+    size = 0;
+    value16 = htons(SIM_NODE_16B_BASE + node);
+    memcpy(&data[size], &value16, 2);
+    size += 2;
+    value = htonl(SIM_NODE_SERIAL_HIGH);
+    memcpy(&data[size], &value, 4);
+    size += 4;
+    value = htonl(SIM_NODE_SERIAL_LOW + node);
+    memcpy(&data[size], &value, 4);
+    size += 4;
+    size += snprintf((char*) &data[size], 12, "NODE%u", node) + 1;
+    value16 = htons(SIM_ND_PARENT);
+    memcpy(&data[size], &value16, 2);
+    size += 2;
+    data[size++] = SIM_ND_ROUTER;
+    data[size++] = 0;
+    value16 = htons(SIM_PROFILE_ID);
+    memcpy(&data[size], &value16, 2);
+    size += 2;
+    value16 = htons(SIM_MANUFACTURER_ID);
+    memcpy(&data[size], &value16, 2);
+    size += 2;
+    sim_sendATResponse(frameID, "ND", SIM_STATUS_OK, data, size);
+  }
+
+  //end of the discovery
+  sim_sendATResponse(frameID, "ND", SIM_STATUS_OK, NULL, 0);
+}
+
+static void sim_handleTxRequest(uint8_t* data, uint32_t size)
+{
+  uint8_t status[7];
+
+  //type, frame ID, 64 bits and 16 bits destination, radius, options
+  if (size < 14)
+  {
+    return;
+  }
+
+  sim_result.nbTxRequests++;
+  if (data[1] == 0)
+  {
+    return;
+  }
+
+  status[0] = ZIGBEE_TRANSMIT_STATUS;
+  status[1] = data[1];
+  status[2] = data[10];
+  status[3] = data[11];
+  status[4] = 0; //no retry
+  status[5] = 0; //delivered
+  status[6] = 0; //no discovery overhead
+  sim_sendFrame(status, sizeof(status));
+}
+
+static void sim_sendSensorData(uint32_t node, uint8_t counter)
+{
+  uint8_t data[32];
+  uint32_t size;
+  uint32_t value;
+  uint16_t value16;
+
+  size = 0;
+  data[size++] = ZIGBEE_RECEIVE_PACKET;
+  value = htonl(SIM_NODE_SERIAL_HIGH);
+  memcpy(&data[size], &value, 4);
+  size += 4;
+  value = htonl(SIM_NODE_SERIAL_LOW + node);
+  memcpy(&data[size], &value, 4);
+  size += 4;
+  value16 = htons(SIM_NODE_16B_BASE + node);
+  memcpy(&data[size], &value16, 2);
+  size += 2;
+  data[size++] = 0x01; //acknowledged
+
+  //sensor.c payload: data type, counter, then type/status/value of each sensor
+  data[size++] = 0x00;
+  data[size++] = counter;
+  data[size++] = 3;
+
+  //temperature and humidity (HYT221 raw values), then the battery voltage
+  value16 = htons(0x2000 + ((node * 37 + counter) & 0x3FF));
+  data[size++] = 0x01;
+  data[size++] = 0x03;
+  memcpy(&data[size], &value16, 2);
+  size += 2;
+  value16 = htons(0x1800 + ((node * 11 + counter) & 0x7FF));
+  data[size++] = 0x02;
+  data[size++] = 0x03;
+  memcpy(&data[size], &value16, 2);
+  size += 2;
+  value16 = htons(300 + (node & 0x3F));
+  data[size++] = 0x03;
+  data[size++] = 0x03;
+  memcpy(&data[size], &value16, 2);
+  size += 2;
+
+  sim_sendFrame(data, size);
+  sim_result.nbRxPackets++;
+}
@@ -0,0 +1,1019 @@
+#define _GNU_SOURCE //pipe2()
+#include "sink.h"
+#include "monotonic.h"
+#include "probes.h"
+#include "spool.h"
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+
+#define SINK_CMD_LINE_SIZE    (2048) //script and record
+#define SINK_STOP_POLL        (10) //in ms
+#define SINK_MAX_WORKERS      (16)
+#define SINK_LATENCY_SHIFT    (3) //moving average of the delivery time, a new sample weighs 1/8
+#define SINK_IDLE_LATENCY     (MONOTONIC_NS_PER_MS) //faster deliveries are not worth batching
+
+///what is given to the script at once: a record, or a batch of records, one by line
+typedef struct
+{
+  const char* script;
+  uint64_t queuedTime;
+  uint32_t size; //without the terminating '\0'
+  uint32_t nbRecords;
+  bool bReplayed; //from the spool
+  char data[];
+} sink_entry;
+
+///a spooled record run by its own script process, reaped on SIGCHLD
+typedef struct
+{
+  pid_t pid; //0 when none
+  uint64_t startTime;
+  sink_entry entry;
+  char data[SINK_RECORD_SIZE + 1];
+} sink_replayChild;
+
+typedef struct
+{
+  uint8_t* entries; //size entries of sink_entrySize bytes
+  uint32_t indexRead;
+  uint32_t indexWrite;
+  uint32_t nbItems;
+  uint32_t size;
+  sink_overflowPolicy policy;
+  bool bStopping;
+  pthread_mutex_t lock; //queue and statistics
+  pthread_cond_t notEmpty;
+  pthread_cond_t notFull;
+  pthread_t workers[SINK_MAX_WORKERS];
+} sink_queue;
+
+typedef struct
+{
+  uint32_t maxRecords; //0 when the readings are not batched
+  uint64_t maxDelay; //in ns
+  uint64_t deadline; //0 when the batch is empty
+  sink_entry* entry; //being filled
+} sink_batcher;
+
+static const char* sink_script;
+static bool sink_bPersistent = false;
+static pid_t sink_pid = 0; //0 when the persistent script is not running
+static int32_t sink_fd = -1; //stdin of the persistent script
+static uint64_t sink_startTime;
+static uint64_t sink_restartDeadline = 0;
+static uint32_t sink_backoff = SINK_BACKOFF_MIN;
+static uint32_t sink_entrySize = sizeof(sink_entry) + SINK_RECORD_SIZE;
+static uint64_t sink_averageLatency = 0; //in ns
+static sink_batcher sink_batch;
+static sink_replayChild sink_replay;
+static sink_queue sink_pool =
+{
+  .lock = PTHREAD_MUTEX_INITIALIZER,
+  .notEmpty = PTHREAD_COND_INITIALIZER,
+  .notFull = PTHREAD_COND_INITIALIZER,
+};
+static sink_stats sink_statistics;
+
+static bool sink_append(const char* script, const char* record);
+static bool sink_flush(void);
+static bool sink_isIdle(void);
+static bool sink_deliver(const sink_entry* entry);
+static void sink_spool(const sink_entry* entry, bool bDelivered);
+static spool_deliverStatus sink_redeliver(const char* record);
+static spool_deliverStatus sink_startReplay(const sink_entry* entry);
+static void sink_reapReplay(bool bWait);
+static bool sink_isBacklogged(void);
+static bool sink_execute(const sink_entry* entry);
+static bool sink_executeBatch(const sink_entry* entry);
+static bool sink_write(const sink_entry* entry);
+static bool sink_writeAll(int32_t fd, const char* data, uint32_t size);
+static bool sink_enqueue(const sink_entry* entry);
+static void* sink_worker(void* arg);
+static void sink_stopWorkers(void);
+static void sink_recordDelivery(uint64_t duration, bool bDelivered, uint32_t nbRecords);
+static pid_t sink_spawn(const char* script, int32_t* fd);
+static bool sink_start(void);
+static void sink_stopped(void);
+static void sink_logExit(int status);
+
+void sink_init(const char* script, bool bPersistent)
+{
+  sink_script = script;
+  sink_bPersistent = bPersistent;
+  if (bPersistent == true)
+  {
+    //a script exiting must not kill the daemon on the next write
+    signal(SIGPIPE, SIG_IGN);
+    sink_start();
+  }
+}
+
+bool sink_setBatching(uint32_t maxRecords, uint32_t maxDelay)
+{
+  uint32_t entrySize;
+
+  if ((maxRecords <= 1) || (sink_statistics.nbWorkers != 0))
+  {
+    return false;
+  }
+
+  //'\0' after the last line
+  entrySize = sizeof(sink_entry) + maxRecords * SINK_RECORD_SIZE + 1;
+  sink_batch.entry = malloc(entrySize);
+  if (sink_batch.entry == NULL)
+  {
+    syslog(LOG_ERR, "sink batches of %d records not possible", maxRecords);
+    return false;
+  }
+
+  sink_entrySize = entrySize;
+  sink_batch.maxRecords = maxRecords;
+  sink_batch.maxDelay = ((uint64_t) maxDelay) * MONOTONIC_NS_PER_MS;
+  sink_batch.deadline = 0;
+  sink_batch.entry->size = 0;
+  sink_batch.entry->nbRecords = 0;
+  sink_batch.entry->bReplayed = false;
+  //the script may exit without reading its stdin
+  signal(SIGPIPE, SIG_IGN);
+  syslog(LOG_INFO, "sink batches of up to %d records, %d ms", maxRecords, maxDelay);
+
+  return true;
+}
+
+bool sink_startWorkers(uint32_t nbWorkers, uint32_t queueSize, sink_overflowPolicy policy)
+{
+  uint32_t i;
+  int rc;
+
+  if (sink_bPersistent == true)
+  {
+    syslog(LOG_INFO, "persistent sink script, no worker needed");
+    return false;
+  }
+
+  if (nbWorkers > SINK_MAX_WORKERS)
+  {
+    nbWorkers = SINK_MAX_WORKERS;
+  }
+
+  sink_pool.entries = malloc(queueSize * sink_entrySize);
+  if ((nbWorkers == 0) || (queueSize == 0) || (sink_pool.entries == NULL))
+  {
+    syslog(LOG_ERR, "sink workers not started (%d workers, queue of %d)", nbWorkers, queueSize);
+    free(sink_pool.entries);
+    sink_pool.entries = NULL;
+    return false;
+  }
+
+  sink_pool.indexRead = 0;
+  sink_pool.indexWrite = 0;
+  sink_pool.nbItems = 0;
+  sink_pool.size = queueSize;
+  sink_pool.policy = policy;
+  sink_pool.bStopping = false;
+  sink_statistics.queueCapacity = queueSize;
+
+  for (i = 0; i < nbWorkers; i++)
+  {
+    rc = pthread_create(&sink_pool.workers[i], NULL, sink_worker, NULL);
+    if (rc != 0)
+    {
+      syslog(LOG_ERR, "unable to start sink worker %d, errno = %d", i, rc);
+      break;
+    }
+    sink_statistics.nbWorkers++;
+  }
+
+  if (sink_statistics.nbWorkers == 0)
+  {
+    free(sink_pool.entries);
+    sink_pool.entries = NULL;
+    return false;
+  }
+
+  syslog(LOG_INFO, "%d sink workers started, queue of %d records", sink_statistics.nbWorkers, queueSize);
+  return true;
+}
+
+void sink_close(void)
+{
+  uint32_t waited;
+  int status;
+
+  sink_flush();
+  sink_stopWorkers();
+  sink_reapReplay(true);
+  free(sink_batch.entry);
+  sink_batch.entry = NULL;
+  sink_batch.maxRecords = 0;
+
+  if (sink_fd >= 0)
+  {
+    close(sink_fd);
+    sink_fd = -1;
+  }
+
+  if (sink_pid == 0)
+  {
+    return;
+  }
+
+  //end of file on its stdin, let it flush what it received
+  for (waited = 0; waited < SINK_STOP_TIMEOUT; waited += SINK_STOP_POLL)
+  {
+    if (waitpid(sink_pid, &status, WNOHANG) == sink_pid)
+    {
+      sink_pid = 0;
+      return;
+    }
+    usleep(SINK_STOP_POLL * 1000);
+  }
+
+  syslog(LOG_WARNING, "sink script (pid = %d) still running, killed", sink_pid);
+  kill(sink_pid, SIGKILL);
+  waitpid(sink_pid, &status, 0);
+  sink_pid = 0;
+}
+
+bool sink_send(const char* script, const char* record)
+{
+  struct
+  {
+    sink_entry entry;
+    char data[SINK_RECORD_SIZE];
+  } single;
+  int32_t length;
+  bool bDelivered;
+
+  if (sink_batch.maxRecords != 0)
+  {
+    return sink_append(script, record);
+  }
+
+  single.entry.script = script;
+  single.entry.nbRecords = 1;
+  single.entry.bReplayed = false;
+  length = snprintf(single.entry.data, SINK_RECORD_SIZE, "%s", record);
+  single.entry.size = (length < SINK_RECORD_SIZE) ? (uint32_t) length : SINK_RECORD_SIZE - 1;
+
+  if (sink_statistics.nbWorkers != 0)
+  {
+    return sink_enqueue(&single.entry);
+  }
+
+  bDelivered = sink_deliver(&single.entry);
+  sink_spool(&single.entry, bDelivered);
+
+  return bDelivered;
+}
+
+void sink_checkChild(void)
+{
+  int status;
+
+  if ((sink_pid != 0) && (waitpid(sink_pid, &status, WNOHANG) == sink_pid))
+  {
+    sink_logExit(status);
+    sink_pid = 0;
+    sink_stopped();
+  }
+
+  sink_reapReplay(false);
+}
+
+uint64_t sink_getNextTimeout(void)
+{
+  uint64_t deadline;
+  uint64_t spoolDeadline;
+
+  deadline = sink_restartDeadline;
+  if ((sink_batch.deadline != 0) && ((deadline == 0) || (sink_batch.deadline < deadline)))
+  {
+    deadline = sink_batch.deadline;
+  }
+
+  spoolDeadline = spool_getNextTimeout();
+  if ((spoolDeadline != 0) && ((deadline == 0) || (spoolDeadline < deadline)))
+  {
+    deadline = spoolDeadline;
+  }
+
+  return deadline;
+}
+
+void sink_handleTimeout(void)
+{
+  uint64_t now;
+
+  now = monotonic_getTimeNs();
+  if ((sink_batch.deadline != 0) && (now >= sink_batch.deadline))
+  {
+    sink_flush();
+  }
+
+  if ((sink_restartDeadline != 0) && (now >= sink_restartDeadline))
+  {
+    sink_restartDeadline = 0;
+    pthread_mutex_lock(&sink_pool.lock);
+    sink_statistics.nbRestarts++;
+    pthread_mutex_unlock(&sink_pool.lock);
+    sink_start();
+  }
+
+  //SIGCHLD may be merged with the one of another child, checked on each replay tick as well
+  sink_reapReplay(false);
+  //the spooled readings only go to a sink keeping up with the live ones
+  spool_handleTimeout((sink_isBacklogged() == false) ? sink_redeliver : NULL);
+}
+
+void sink_getStats(sink_stats* stats)
+{
+  pthread_mutex_lock(&sink_pool.lock);
+  *stats = sink_statistics;
+  stats->queueDepth = sink_pool.nbItems;
+  pthread_mutex_unlock(&sink_pool.lock);
+}
+
+///the record is added to the batch, sent when full, when the sink is idle or after the window
+static bool sink_append(const char* script, const char* record)
+{
+  sink_entry* entry;
+  uint64_t window;
+  uint64_t now;
+  size_t lineSize;
+  int32_t length;
+
+  //the persistent script gets a batch in one atomic write: never beyond PIPE_BUF
+  entry = sink_batch.entry;
+  lineSize = strlen(record) + 1;
+  if ((sink_bPersistent == true) && (entry->nbRecords != 0) &&
+      ((entry->size + ((lineSize < SINK_RECORD_SIZE) ? lineSize : SINK_RECORD_SIZE)) > PIPE_BUF))
+  {
+    sink_flush();
+  }
+
+  //a line too long is truncated, the batch has room for a full one
+  length = snprintf(&entry->data[entry->size], SINK_RECORD_SIZE, "%s\n", record);
+  if (length >= SINK_RECORD_SIZE)
+  {
+    length = SINK_RECORD_SIZE;
+    entry->data[entry->size + SINK_RECORD_SIZE - 1] = '\n';
+    entry->data[entry->size + SINK_RECORD_SIZE] = '\0';
+  }
+  entry->size += length;
+  entry->nbRecords++;
+  entry->script = script;
+
+  //the readings received while the sink works are sent together: a slow sink gets larger batches
+  pthread_mutex_lock(&sink_pool.lock);
+  window = ((sink_bPersistent == false) && (sink_averageLatency < sink_batch.maxDelay)) ? sink_averageLatency :
+           sink_batch.maxDelay;
+  sink_statistics.batchWindow = window;
+  pthread_mutex_unlock(&sink_pool.lock);
+
+  now = monotonic_getTimeNs();
+  if (entry->nbRecords == 1)
+  {
+    sink_batch.deadline = now + window;
+  }
+
+  if ((entry->nbRecords >= sink_batch.maxRecords) || (now >= sink_batch.deadline) || (sink_isIdle() == true))
+  {
+    return sink_flush();
+  }
+
+  return true;
+}
+
+static bool sink_flush(void)
+{
+  sink_entry* entry;
+  bool bDelivered;
+
+  entry = sink_batch.entry;
+  if ((entry == NULL) || (entry->nbRecords == 0))
+  {
+    return true;
+  }
+
+  pthread_mutex_lock(&sink_pool.lock);
+  sink_statistics.nbBatches++;
+  sink_statistics.nbBatchedRecords += entry->nbRecords;
+  pthread_mutex_unlock(&sink_pool.lock);
+  ZB_PROBE3(sink_batch, entry->nbRecords, entry->size, sink_statistics.batchWindow);
+
+  if (sink_statistics.nbWorkers != 0)
+  {
+    bDelivered = sink_enqueue(entry);
+  }
+  else
+  {
+    bDelivered = sink_deliver(entry);
+    sink_spool(entry, bDelivered);
+  }
+
+  entry->size = 0;
+  entry->nbRecords = 0;
+  entry->data[0] = '\0';
+  sink_batch.deadline = 0;
+
+  return bDelivered;
+}
+
+///a worker waiting, or a sink fast enough, takes the batch right away
+static bool sink_isIdle(void)
+{
+  int pending;
+  bool bIdle;
+
+  pthread_mutex_lock(&sink_pool.lock);
+  if (sink_statistics.nbWorkers != 0)
+  {
+    bIdle = (sink_pool.nbItems == 0) && (sink_statistics.nbBusyWorkers < sink_statistics.nbWorkers);
+  }
+  else
+  {
+    bIdle = (sink_averageLatency < SINK_IDLE_LATENCY);
+  }
+  pthread_mutex_unlock(&sink_pool.lock);
+
+  //a pipe write is always fast, the script is idle once it has read everything
+  if ((sink_bPersistent == true) && (bIdle == true) && (sink_fd >= 0))
+  {
+    bIdle = (ioctl(sink_fd, FIONREAD, &pending) == 0) && (pending == 0);
+  }
+
+  return bIdle;
+}
+
+static bool sink_deliver(const sink_entry* entry)
+{
+  uint64_t start;
+  bool bDelivered;
+
+  start = monotonic_getTimeNs();
+  if (sink_bPersistent == true)
+  {
+    bDelivered = sink_write(entry);
+  }
+  else
+  {
+    bDelivered = sink_execute(entry);
+  }
+
+  pthread_mutex_lock(&sink_pool.lock);
+  sink_recordDelivery(monotonic_getTimeNs() - start, bDelivered, entry->nbRecords);
+  pthread_mutex_unlock(&sink_pool.lock);
+
+  return bDelivered;
+}
+
+///a live reading not delivered is kept for later, when the spool is opened, a replayed one stays in it
+static void sink_spool(const sink_entry* entry, bool bDelivered)
+{
+  if (entry->bReplayed == true)
+  {
+    spool_notifyReplayed(bDelivered);
+  }
+  else if (bDelivered == true)
+  {
+    spool_notifyDelivered();
+  }
+  else
+  {
+    spool_append(entry->data, entry->size);
+  }
+}
+
+///a spooled record, in the form of a live one, handed over without waiting for the script
+static spool_deliverStatus sink_redeliver(const char* record)
+{
+  struct
+  {
+    sink_entry entry;
+    char data[SINK_RECORD_SIZE + 1];
+  } single;
+  int32_t length;
+  int pending;
+  bool bBusy;
+
+  single.entry.script = sink_script;
+  single.entry.nbRecords = 1;
+  single.entry.bReplayed = true;
+  length = snprintf(single.entry.data, sizeof(single.data), "%s%s", record, (sink_batch.maxRecords != 0) ? "\n" : "");
+  single.entry.size = ((uint32_t) length < sizeof(single.data)) ? (uint32_t) length : sizeof(single.data) - 1;
+
+  if (sink_statistics.nbWorkers != 0)
+  {
+    //only to the free workers, a live reading never waits behind the replay
+    pthread_mutex_lock(&sink_pool.lock);
+    bBusy = ((sink_pool.nbItems + sink_statistics.nbBusyWorkers) >= sink_statistics.nbWorkers);
+    pthread_mutex_unlock(&sink_pool.lock);
+    if (bBusy == true)
+    {
+      return SPOOL_BUSY;
+    }
+    return (sink_enqueue(&single.entry) == true) ? SPOOL_PENDING : SPOOL_FAILED;
+  }
+
+  if (sink_bPersistent == true)
+  {
+    if (sink_fd < 0)
+    {
+      return SPOOL_FAILED;
+    }
+    //the rest of the pipe is kept for the live readings
+    if ((ioctl(sink_fd, FIONREAD, &pending) != 0) || (pending >= PIPE_BUF))
+    {
+      return SPOOL_BUSY;
+    }
+    return (sink_deliver(&single.entry) == true) ? SPOOL_DELIVERED : SPOOL_FAILED;
+  }
+
+  return sink_startReplay(&single.entry);
+}
+
+///one script process at a time for the replay, its exit status is read by sink_reapReplay()
+static spool_deliverStatus sink_startReplay(const sink_entry* entry)
+{
+  char commandline[SINK_CMD_LINE_SIZE];
+  int32_t fd;
+  pid_t pid;
+
+  if (sink_replay.pid != 0)
+  {
+    return SPOOL_BUSY;
+  }
+
+  //the record on the stdin of a batch script, as an argument otherwise, as for a live one
+  if (sink_batch.maxRecords != 0)
+  {
+    pid = sink_spawn(entry->script, &fd);
+    if (pid < 0)
+    {
+      return SPOOL_FAILED;
+    }
+    //a line is below PIPE_BUF, a new pipe takes it at once
+    if (sink_writeAll(fd, entry->data, entry->size) == false)
+    {
+      syslog(LOG_WARNING, "spooled record not read by the sink script, errno = %d", errno);
+    }
+  }
+  else
+  {
+    snprintf(commandline, SINK_CMD_LINE_SIZE, "%s %s", entry->script, entry->data);
+    pid = sink_spawn(commandline, &fd);
+    if (pid < 0)
+    {
+      return SPOOL_FAILED;
+    }
+  }
+  close(fd);
+
+  memcpy(&sink_replay.entry, entry, sizeof(sink_entry) + entry->size + 1);
+  sink_replay.startTime = monotonic_getTimeNs();
+  sink_replay.pid = pid;
+
+  return SPOOL_PENDING;
+}
+
+///the result of the replayed record goes back to the spool
+static void sink_reapReplay(bool bWait)
+{
+  uint32_t waited;
+  pid_t pid;
+  int status;
+  bool bDelivered;
+
+  if (sink_replay.pid == 0)
+  {
+    return;
+  }
+
+  pid = waitpid(sink_replay.pid, &status, WNOHANG);
+  for (waited = 0; (bWait == true) && (pid == 0) && (waited < SINK_STOP_TIMEOUT); waited += SINK_STOP_POLL)
+  {
+    usleep(SINK_STOP_POLL * 1000);
+    pid = waitpid(sink_replay.pid, &status, WNOHANG);
+  }
+
+  if ((pid == 0) && (bWait == true))
+  {
+    syslog(LOG_WARNING, "sink script (pid = %d) still running, killed", sink_replay.pid);
+    kill(sink_replay.pid, SIGKILL);
+    pid = waitpid(sink_replay.pid, &status, 0);
+  }
+
+  if (pid == 0)
+  {
+    return;
+  }
+
+  bDelivered = (pid == sink_replay.pid) && WIFEXITED(status) && (WEXITSTATUS(status) == 0);
+  pthread_mutex_lock(&sink_pool.lock);
+  sink_recordDelivery(monotonic_getTimeNs() - sink_replay.startTime, bDelivered, sink_replay.entry.nbRecords);
+  pthread_mutex_unlock(&sink_pool.lock);
+  sink_spool(&sink_replay.entry, bDelivered);
+  sink_replay.pid = 0;
+}
+
+static bool sink_isBacklogged(void)
+{
+  bool bBacklogged;
+
+  pthread_mutex_lock(&sink_pool.lock);
+  bBacklogged = (sink_pool.nbItems != 0);
+  pthread_mutex_unlock(&sink_pool.lock);
+
+  return bBacklogged;
+}
+
+static bool sink_execute(const sink_entry* entry)
+{
+  char commandline[SINK_CMD_LINE_SIZE];
+
+  if (sink_batch.maxRecords != 0)
+  {
+    return sink_executeBatch(entry);
+  }
+
+  snprintf(commandline, SINK_CMD_LINE_SIZE, "%s %s", entry->script, entry->data);
+  syslog(LOG_DEBUG, "commandline: %s", commandline);
+  return (system(commandline) == 0);
+}
+
+///one execution for the batch, read on the stdin of the script until the end of file
+static bool sink_executeBatch(const sink_entry* entry)
+{
+  int32_t fd;
+  pid_t pid;
+  bool bWritten;
+  int status;
+
+  pid = sink_spawn(entry->script, &fd);
+  if (pid < 0)
+  {
+    return false;
+  }
+
+  bWritten = sink_writeAll(fd, entry->data, entry->size);
+  if (bWritten == false)
+  {
+    syslog(LOG_WARNING, "batch of %d records not read by the sink script, errno = %d", entry->nbRecords, errno);
+  }
+  close(fd);
+
+  if (waitpid(pid, &status, 0) != pid)
+  {
+    return false;
+  }
+
+  return (bWritten == true) && WIFEXITED(status) && (WEXITSTATUS(status) == 0);
+}
+
+static bool sink_write(const sink_entry* entry)
+{
+  struct iovec iov[2];
+  ssize_t size;
+  ssize_t nbWritten;
+  uint32_t nbIov;
+
+  if (sink_fd < 0)
+  {
+    syslog(LOG_WARNING, "sink script not running, record dropped");
+    return false;
+  }
+
+  //a batch already ends with a new line
+  iov[0].iov_base = (void*) entry->data;
+  iov[0].iov_len = entry->size;
+  iov[1].iov_base = "\n";
+  iov[1].iov_len = 1;
+  nbIov = (sink_batch.maxRecords != 0) ? 1 : 2;
+  size = entry->size + nbIov - 1;
+
+  //records and batches are at most PIPE_BUF bytes: the write is atomic, all or nothing
+  assert(size <= PIPE_BUF);
+  nbWritten = writev(sink_fd, iov, nbIov);
+  if (nbWritten == size)
+  {
+    return true;
+  }
+
+  if ((nbWritten < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
+  {
+    syslog(LOG_WARNING, "sink script busy, %d records dropped", entry->nbRecords);
+  }
+  else
+  {
+    syslog(LOG_ERR, "unable to write to sink script, errno = %d", errno);
+    sink_stopped();
+  }
+
+  return false;
+}
+
+static bool sink_writeAll(int32_t fd, const char* data, uint32_t size)
+{
+  ssize_t nbWritten;
+
+  while (size > 0)
+  {
+    nbWritten = write(fd, data, size);
+    if (nbWritten < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      return false;
+    }
+    data += nbWritten;
+    size -= nbWritten;
+  }
+
+  return true;
+}
+
+static bool sink_enqueue(const sink_entry* entry)
+{
+  sink_entry* slot;
+  bool bQueued;
+
+  bQueued = true;
+  pthread_mutex_lock(&sink_pool.lock);
+  if (sink_pool.nbItems >= sink_pool.size)
+  {
+    switch (sink_pool.policy)
+    {
+      case SINK_OVERFLOW_DROP_OLDEST:
+        slot = (sink_entry*) &sink_pool.entries[sink_pool.indexRead * sink_entrySize];
+        sink_pool.indexRead = (sink_pool.indexRead + 1) % sink_pool.size;
+        sink_pool.nbItems--;
+        if (slot->bReplayed == true)
+        {
+          //still in the spool, retried after the backoff
+          spool_notifyReplayed(false);
+        }
+        else
+        {
+          sink_statistics.nbDropped += slot->nbRecords;
+        }
+        sink_statistics.nbFailures += slot->nbRecords;
+        syslog(LOG_WARNING, "sink queue full, oldest record dropped");
+        break;
+
+      case SINK_OVERFLOW_DROP_NEWEST:
+        sink_statistics.nbDropped += entry->nbRecords;
+        bQueued = false;
+        syslog(LOG_WARNING, "sink queue full, record dropped");
+        break;
+
+      case SINK_OVERFLOW_BLOCK:
+        sink_statistics.nbBlocked++;
+        while (sink_pool.nbItems >= sink_pool.size)
+        {
+          pthread_cond_wait(&sink_pool.notFull, &sink_pool.lock);
+        }
+        break;
+    }
+  }
+
+  if (bQueued == true)
+  {
+    slot = (sink_entry*) &sink_pool.entries[sink_pool.indexWrite * sink_entrySize];
+    memcpy(slot, entry, sizeof(sink_entry) + entry->size + 1);
+    slot->queuedTime = monotonic_getTimeNs();
+    sink_pool.indexWrite = (sink_pool.indexWrite + 1) % sink_pool.size;
+    sink_pool.nbItems++;
+    pthread_cond_signal(&sink_pool.notEmpty);
+  }
+  else
+  {
+    sink_statistics.nbFailures += entry->nbRecords;
+  }
+  pthread_mutex_unlock(&sink_pool.lock);
+
+  return bQueued;
+}
+
+static void* sink_worker(void* arg)
+{
+  sink_entry* entry;
+  sink_entry* slot;
+  sigset_t mask;
+  uint64_t start;
+  bool bDelivered;
+
+  (void) arg;
+
+  //signals are for the event loop (signalfd), never for a worker
+  sigfillset(&mask);
+  pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+  //copy of the slot, released before running the script
+  entry = malloc(sink_entrySize);
+  assert(entry != NULL);
+
+  pthread_mutex_lock(&sink_pool.lock);
+  while (true)
+  {
+    while ((sink_pool.nbItems == 0) && (sink_pool.bStopping == false))
+    {
+      pthread_cond_wait(&sink_pool.notEmpty, &sink_pool.lock);
+    }
+
+    //stopping, but the queued records are still delivered
+    if (sink_pool.nbItems == 0)
+    {
+      break;
+    }
+
+    slot = (sink_entry*) &sink_pool.entries[sink_pool.indexRead * sink_entrySize];
+    memcpy(entry, slot, sizeof(sink_entry) + slot->size + 1);
+    sink_pool.indexRead = (sink_pool.indexRead + 1) % sink_pool.size;
+    sink_pool.nbItems--;
+    sink_statistics.nbBusyWorkers++;
+    start = monotonic_getTimeNs();
+    latency_record(&sink_statistics.queueWait, start - entry->queuedTime);
+    pthread_cond_signal(&sink_pool.notFull);
+    pthread_mutex_unlock(&sink_pool.lock);
+
+    bDelivered = sink_execute(entry);
+    sink_spool(entry, bDelivered);
+
+    pthread_mutex_lock(&sink_pool.lock);
+    sink_statistics.nbBusyWorkers--;
+    sink_recordDelivery(monotonic_getTimeNs() - start, bDelivered, entry->nbRecords);
+  }
+  pthread_mutex_unlock(&sink_pool.lock);
+
+  free(entry);
+  return NULL;
+}
+
+static void sink_stopWorkers(void)
+{
+  uint32_t i;
+
+  if (sink_statistics.nbWorkers == 0)
+  {
+    return;
+  }
+
+  pthread_mutex_lock(&sink_pool.lock);
+  sink_pool.bStopping = true;
+  pthread_cond_broadcast(&sink_pool.notEmpty);
+  pthread_mutex_unlock(&sink_pool.lock);
+
+  for (i = 0; i < sink_statistics.nbWorkers; i++)
+  {
+    pthread_join(sink_pool.workers[i], NULL);
+  }
+
+  sink_statistics.nbWorkers = 0;
+  free(sink_pool.entries);
+  sink_pool.entries = NULL;
+}
+
+///called with the lock held, failures are counted in readings as the drops
+static void sink_recordDelivery(uint64_t duration, bool bDelivered, uint32_t nbRecords)
+{
+  latency_record(&sink_statistics.duration, duration);
+  if (bDelivered == false)
+  {
+    sink_statistics.nbFailures += nbRecords;
+  }
+
+  if (duration > sink_averageLatency)
+  {
+    sink_averageLatency += (duration - sink_averageLatency) >> SINK_LATENCY_SHIFT;
+  }
+  else
+  {
+    sink_averageLatency -= (sink_averageLatency - duration) >> SINK_LATENCY_SHIFT;
+  }
+}
+
+///"/bin/sh -c <script>" reading the returned pipe on its stdin, -1 on error
+static pid_t sink_spawn(const char* script, int32_t* fd)
+{
+  int32_t pipeFd[2];
+  sigset_t mask;
+  pid_t pid;
+
+  //close on exec from the start, a script forked by another worker must not hold the pipe
+  if (pipe2(pipeFd, O_CLOEXEC) != 0)
+  {
+    syslog(LOG_ERR, "unable to create sink pipe, errno = %d", errno);
+    return -1;
+  }
+
+  pid = fork();
+  if (pid < 0)
+  {
+    syslog(LOG_ERR, "unable to start sink script, errno = %d", errno);
+    close(pipeFd[0]);
+    close(pipeFd[1]);
+    return -1;
+  }
+
+  if (pid == 0)
+  {
+    //the daemon blocks the signals it reads with signalfd and ignores SIGPIPE, the script must not inherit it
+    sigemptyset(&mask);
+    sigprocmask(SIG_SETMASK, &mask, NULL);
+    signal(SIGPIPE, SIG_DFL);
+
+    dup2(pipeFd[0], STDIN_FILENO);
+    execl("/bin/sh", "sh", "-c", script, (char*) NULL);
+    _exit(127);
+  }
+
+  close(pipeFd[0]);
+  *fd = pipeFd[1];
+
+  return pid;
+}
+
+static bool sink_start(void)
+{
+  int32_t fd;
+  pid_t pid;
+
+  sink_startTime = monotonic_getTimeNs();
+  pid = sink_spawn(sink_script, &fd);
+  if (pid < 0)
+  {
+    sink_stopped();
+    return false;
+  }
+
+  //a slow script must not block the event loop
+  fcntl(fd, F_SETFL, O_NONBLOCK);
+  sink_fd = fd;
+  sink_pid = pid;
+  syslog(LOG_INFO, "sink script '%s' started (pid = %d)", sink_script, pid);
+
+  return true;
+}
+///the script is gone or unusable, schedule its restart
+static void sink_stopped(void)
+{
+  uint64_t now;
+  int status;
+
+  if (sink_fd >= 0)
+  {
+    close(sink_fd);
+    sink_fd = -1;
+  }
+
+  if (sink_pid != 0)
+  {
+    //stdin closed, it can't receive anything anymore
+    kill(sink_pid, SIGKILL);
+    waitpid(sink_pid, &status, 0);
+    sink_pid = 0;
+  }
+
+  now = monotonic_getTimeNs();
+  if ((now - sink_startTime) >= ((uint64_t) SINK_STABLE_TIME * MONOTONIC_NS_PER_MS))
+  {
+    sink_backoff = SINK_BACKOFF_MIN;
+  }
+
+  sink_restartDeadline = now + ((uint64_t) sink_backoff) * MONOTONIC_NS_PER_MS;
+  syslog(LOG_WARNING, "sink script restarted in %d ms", sink_backoff);
+
+  sink_backoff *= 2;
+  if (sink_backoff > SINK_BACKOFF_MAX)
+  {
+    sink_backoff = SINK_BACKOFF_MAX;
+  }
+}
+
+static void sink_logExit(int status)
+{
+  if (WIFEXITED(status))
+  {
+    syslog(LOG_WARNING, "sink script (pid = %d) exited, status = %d", sink_pid, WEXITSTATUS(status));
+  }
+  else if (WIFSIGNALED(status))
+  {
+    syslog(LOG_WARNING, "sink script (pid = %d) killed by signal %d", sink_pid, WTERMSIG(status));
+  }
+}
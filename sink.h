@@ -0,0 +1,92 @@
+#ifndef __SINK_H__
+#define __SINK_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "latency.h"
+
+/**
+ * Delivery of the sensor readings to the configured script, in one of two modes:
+ *  - one execution by reading (default): "<script> <record>" through system(), the
+ *    record being the arguments, e.g. "address=0013a200:40b5bb4e id=1 temp=21.500 ";
+ *  - persistent: the script is started once ("/bin/sh -c <script>") and receives one
+ *    record by line on its stdin. A reading costs a pipe write.
+ *
+ * In persistent mode, the script is restarted when it exits, after a delay doubled on
+ * each exit within SINK_STABLE_TIME of its start (SINK_BACKOFF_MIN to SINK_BACKOFF_MAX).
+ * Readings received while it is not running, or while its pipe is full, are dropped.
+ *
+ * In the first mode, the executions can be moved out of the caller (the radio event loop)
+ * with sink_startWorkers(): sink_send() only queues the record in a bounded queue, drained
+ * by worker threads. When the queue is full, the overflow policy drops the oldest record,
+ * drops the new one, or blocks the caller until a worker takes one.
+ * The persistent mode never blocks, it doesn't use the workers.
+ *
+ * With sink_setBatching(), the readings are grouped and given to the script at once, one
+ * record by line: on the stdin of one execution, or in one write in persistent mode, a
+ * batch then being sent early rather than going beyond PIPE_BUF.
+ * A batch is sent when it holds maxRecords readings, when the sink is idle (a worker
+ * waiting, executions faster than 1 ms, or the persistent script has read its whole
+ * pipe), or at the end of its window. The window is the average execution time capped by
+ * maxDelay (maxDelay for the persistent script): the slower the script, the larger the
+ * batches, and a reading waits about one execution of the previous batch.
+ *
+ * When a spool is opened (spool.h), the readings not delivered are spooled, and replayed
+ * from sink_handleTimeout() while the worker queue is empty. The replay never waits for
+ * the script: a spooled reading goes to a free worker, to the persistent pipe while it
+ * holds less than PIPE_BUF bytes, or otherwise to one script process at a time, reaped by
+ * sink_checkChild(). A replayed reading failing is spooled again.
+ */
+
+#define SINK_BACKOFF_MIN      (100)   //in ms
+#define SINK_BACKOFF_MAX      (30000) //in ms
+#define SINK_STABLE_TIME      (10000) //in ms, running longer resets the backoff
+#define SINK_STOP_TIMEOUT     (1000)  //in ms, for the script to exit once its stdin is closed
+#define SINK_RECORD_SIZE      (1024)  //longer records are truncated when queued
+#define SINK_DEFAULT_QUEUE    (64)
+#define SINK_DEFAULT_BATCH_DELAY  (1000) //in ms
+
+typedef enum
+{
+  SINK_OVERFLOW_DROP_OLDEST,
+  SINK_OVERFLOW_DROP_NEWEST,
+  SINK_OVERFLOW_BLOCK
+} sink_overflowPolicy;
+
+typedef struct
+{
+  uint32_t nbFailures; //readings dropped, script not started or exit status not 0
+  uint32_t nbRestarts; //of the persistent script
+  latency_histogram duration; //in ns, script execution or pipe write
+  uint32_t nbWorkers; //0 when records are delivered by sink_send()
+  uint32_t nbBusyWorkers;
+  uint32_t queueDepth;
+  uint32_t queueCapacity;
+  uint32_t nbDropped; //by the overflow policy
+  uint32_t nbBlocked; //sink_send() calls that waited for a free slot
+  latency_histogram queueWait; //in ns, from sink_send() to a worker
+  uint32_t nbBatches;
+  uint32_t nbBatchedRecords;
+  uint64_t batchWindow; //in ns, current one
+} sink_stats;
+
+/// without call, the sink is in "one execution by reading" mode
+extern void sink_init(const char* script, bool bPersistent);
+/// groups up to maxRecords readings during at most maxDelay ms, before sink_startWorkers()
+extern bool sink_setBatching(uint32_t maxRecords, uint32_t maxDelay);
+/// workers for the "one execution by reading" mode, returns false if not started
+extern bool sink_startWorkers(uint32_t nbWorkers, uint32_t queueSize, sink_overflowPolicy policy);
+/// the pending batch and the queued records are delivered before the workers stop
+extern void sink_close(void);
+/// returns false when the record was not delivered (or not queued) or the script failed
+extern bool sink_send(const char* script, const char* record);
+
+/// to call on SIGCHLD, reaps the persistent script or the replay process when they exited
+extern void sink_checkChild(void);
+/// batch, persistent script restart or spool deadline (CLOCK_MONOTONIC, ns), 0 when none
+extern uint64_t sink_getNextTimeout(void);
+extern void sink_handleTimeout(void);
+/// consistent copy, the workers update the statistics
+extern void sink_getStats(sink_stats* stats);
+
+#endif /* __SINK_H__ */
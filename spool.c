@@ -0,0 +1,628 @@
+#include "spool.h"
+#include "monotonic.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#define SPOOL_SEGMENT_SUFFIX    ".seg"
+#define SPOOL_POSITION_FILE     "position"
+#define SPOOL_POSITION_SIZE     (22) //"%010u %010u\n"
+#define SPOOL_DIR_SIZE          (PATH_MAX - sizeof("/0000000000" SPOOL_SEGMENT_SUFFIX)) //room for a segment name
+
+typedef struct
+{
+  char dir[SPOOL_DIR_SIZE];
+  uint64_t maxSize;
+  bool bOpened;
+  bool bFull; //logged once, until the spool shrinks
+  int32_t dirFd;
+  int32_t positionFd;
+  uint32_t readSeq; //segments on disk: readSeq to nextSeq - 1
+  uint32_t nextSeq;
+  int32_t readFd;
+  uint32_t readOffset;
+  uint32_t pendingLength; //record at readOffset handed over, 0 when none
+  int32_t writeFd; //segment nextSeq - 1, -1 until the first append
+  uint32_t writeSize;
+  uint64_t size; //of the segments on disk
+  uint32_t nbUnsynced;
+  uint64_t syncDeadline;
+  uint64_t replayDeadline; //0 when the spool is empty
+  uint32_t backoff;
+  pthread_mutex_t lock;
+} spool_state;
+
+static spool_state spool =
+{
+  .dirFd = -1,
+  .positionFd = -1,
+  .readFd = -1,
+  .writeFd = -1,
+  .backoff = SPOOL_BACKOFF_MIN,
+  .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+static spool_stats spool_statistics;
+
+static void spool_scan(void);
+static void spool_loadPosition(void);
+static void spool_savePosition(void);
+static bool spool_startSegment(void);
+static void spool_sync(void);
+static void spool_replay(spool_deliverCallBack deliver);
+static void spool_backOff(uint64_t now);
+static uint32_t spool_readRecord(char* record);
+static void spool_removeHead(void);
+static void spool_getSegmentPath(uint32_t seq, char* path);
+
+bool spool_open(const char* dir, uint64_t maxSize)
+{
+  char path[PATH_MAX];
+
+  if (strlen(dir) >= SPOOL_DIR_SIZE)
+  {
+    syslog(LOG_ERR, "spool directory '%s' too long", dir);
+    return false;
+  }
+
+  if ((mkdir(dir, 0755) != 0) && (errno != EEXIST))
+  {
+    syslog(LOG_ERR, "unable to create spool directory '%s', errno = %d", dir, errno);
+    return false;
+  }
+
+  strcpy(spool.dir, dir);
+  spool.dirFd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  snprintf(path, sizeof(path), "%s/%s", dir, SPOOL_POSITION_FILE);
+  spool.positionFd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if ((spool.dirFd < 0) || (spool.positionFd < 0))
+  {
+    syslog(LOG_ERR, "unable to open spool directory '%s', errno = %d", dir, errno);
+    if (spool.dirFd >= 0)
+    {
+      close(spool.dirFd);
+      spool.dirFd = -1;
+    }
+    if (spool.positionFd >= 0)
+    {
+      close(spool.positionFd);
+      spool.positionFd = -1;
+    }
+    return false;
+  }
+
+  spool.maxSize = maxSize;
+  spool_scan();
+  spool_loadPosition();
+
+  //left by the previous run, delivered after the first backoff
+  if (spool.readSeq != spool.nextSeq)
+  {
+    spool.replayDeadline = monotonic_getTimeNs() + ((uint64_t) spool.backoff) * MONOTONIC_NS_PER_MS;
+    syslog(LOG_INFO, "spool '%s': %d segments, %llu bytes to replay", dir, spool.nextSeq - spool.readSeq,
+           (unsigned long long) (spool.size - spool.readOffset));
+  }
+  spool.bOpened = true;
+
+  return true;
+}
+
+void spool_close(void)
+{
+  pthread_mutex_lock(&spool.lock);
+  if (spool.bOpened == true)
+  {
+    spool_sync();
+    spool_savePosition();
+    if (spool.writeFd >= 0)
+    {
+      close(spool.writeFd);
+      spool.writeFd = -1;
+    }
+    if (spool.readFd >= 0)
+    {
+      close(spool.readFd);
+      spool.readFd = -1;
+    }
+    close(spool.positionFd);
+    close(spool.dirFd);
+    spool.positionFd = -1;
+    spool.dirFd = -1;
+    spool.syncDeadline = 0;
+    spool.replayDeadline = 0;
+    spool.pendingLength = 0;
+    spool.bOpened = false;
+  }
+  pthread_mutex_unlock(&spool.lock);
+}
+
+bool spool_append(const char* data, uint32_t size)
+{
+  struct iovec iov[2];
+  uint32_t nbRecords;
+  uint32_t nbIov;
+  uint32_t total;
+  uint32_t i;
+  uint64_t now;
+
+  if (size == 0)
+  {
+    return true;
+  }
+
+  //a single record comes without its new line
+  iov[0].iov_base = (void*) data;
+  iov[0].iov_len = size;
+  iov[1].iov_base = "\n";
+  iov[1].iov_len = 1;
+  nbIov = (data[size - 1] == '\n') ? 1 : 2;
+  total = size + nbIov - 1;
+  nbRecords = nbIov - 1;
+  for (i = 0; i < size; i++)
+  {
+    nbRecords += (data[i] == '\n');
+  }
+
+  pthread_mutex_lock(&spool.lock);
+  if (spool.bOpened == false)
+  {
+    pthread_mutex_unlock(&spool.lock);
+    return false;
+  }
+
+  if ((spool.size + total) > spool.maxSize)
+  {
+    if (spool.bFull == false)
+    {
+      syslog(LOG_ERR, "spool full (%llu bytes), readings dropped", (unsigned long long) spool.size);
+      spool.bFull = true;
+    }
+    spool_statistics.nbDropped += nbRecords;
+    pthread_mutex_unlock(&spool.lock);
+    return false;
+  }
+
+  if (((spool.writeFd < 0) || ((spool.writeSize + total) > SPOOL_SEGMENT_SIZE)) && (spool_startSegment() == false))
+  {
+    spool_statistics.nbDropped += nbRecords;
+    pthread_mutex_unlock(&spool.lock);
+    return false;
+  }
+
+  //one write for the record and its new line, the replay never reads half a line
+  if (writev(spool.writeFd, iov, nbIov) != (ssize_t) total)
+  {
+    syslog(LOG_ERR, "unable to write to the spool, errno = %d", errno);
+    if (ftruncate(spool.writeFd, spool.writeSize) != 0)
+    {
+      //the segment may end with a partial line, the next records go to a new one
+      close(spool.writeFd);
+      spool.writeFd = -1;
+    }
+    spool_statistics.nbDropped += nbRecords;
+    pthread_mutex_unlock(&spool.lock);
+    return false;
+  }
+
+  now = monotonic_getTimeNs();
+  spool.writeSize += total;
+  spool.size += total;
+  spool.nbUnsynced += nbRecords;
+  spool_statistics.nbAppended += nbRecords;
+  if (spool.nbUnsynced >= SPOOL_SYNC_RECORDS)
+  {
+    spool_sync();
+  }
+  else if (spool.syncDeadline == 0)
+  {
+    spool.syncDeadline = now + ((uint64_t) SPOOL_SYNC_DELAY) * MONOTONIC_NS_PER_MS;
+  }
+
+  //the sink just failed, give it the backoff before replaying
+  if (spool.replayDeadline == 0)
+  {
+    spool.replayDeadline = now + ((uint64_t) spool.backoff) * MONOTONIC_NS_PER_MS;
+  }
+  pthread_mutex_unlock(&spool.lock);
+
+  return true;
+}
+
+void spool_notifyDelivered(void)
+{
+  pthread_mutex_lock(&spool.lock);
+  if ((spool.replayDeadline != 0) && (spool.backoff != SPOOL_BACKOFF_MIN))
+  {
+    //the sink is back, no need to wait for the end of the backoff
+    spool.replayDeadline = monotonic_getTimeNs();
+  }
+  spool.backoff = SPOOL_BACKOFF_MIN;
+  pthread_mutex_unlock(&spool.lock);
+}
+
+void spool_notifyReplayed(bool bDelivered)
+{
+  uint64_t now;
+
+  pthread_mutex_lock(&spool.lock);
+  if ((spool.bOpened == true) && (spool.pendingLength != 0))
+  {
+    now = monotonic_getTimeNs();
+    if (bDelivered == true)
+    {
+      spool.readOffset += spool.pendingLength;
+      spool_statistics.nbReplayed++;
+      spool_savePosition();
+      spool.backoff = SPOOL_BACKOFF_MIN;
+      spool.replayDeadline = now;
+    }
+    else
+    {
+      //stays at the head, the records behind wait for it
+      spool_backOff(now);
+    }
+    spool.pendingLength = 0;
+  }
+  pthread_mutex_unlock(&spool.lock);
+}
+
+uint64_t spool_getNextTimeout(void)
+{
+  uint64_t deadline;
+
+  pthread_mutex_lock(&spool.lock);
+  deadline = spool.syncDeadline;
+  if ((spool.replayDeadline != 0) && ((deadline == 0) || (spool.replayDeadline < deadline)))
+  {
+    deadline = spool.replayDeadline;
+  }
+  pthread_mutex_unlock(&spool.lock);
+
+  return deadline;
+}
+
+void spool_handleTimeout(spool_deliverCallBack deliver)
+{
+  uint64_t now;
+  bool bReplay;
+
+  now = monotonic_getTimeNs();
+  pthread_mutex_lock(&spool.lock);
+  if ((spool.syncDeadline != 0) && (now >= spool.syncDeadline))
+  {
+    spool_sync();
+  }
+
+  bReplay = (spool.replayDeadline != 0) && (now >= spool.replayDeadline);
+  if ((bReplay == true) && (deliver == NULL))
+  {
+    //live readings waiting, they go first
+    spool.replayDeadline = now + ((uint64_t) SPOOL_REPLAY_INTERVAL) * MONOTONIC_NS_PER_MS;
+    bReplay = false;
+  }
+  pthread_mutex_unlock(&spool.lock);
+
+  if (bReplay == true)
+  {
+    spool_replay(deliver);
+  }
+}
+
+void spool_getStats(spool_stats* stats)
+{
+  pthread_mutex_lock(&spool.lock);
+  *stats = spool_statistics;
+  stats->size = spool.size - spool.readOffset;
+  stats->nbSegments = spool.nextSeq - spool.readSeq;
+  pthread_mutex_unlock(&spool.lock);
+}
+
+///segments left by a previous run, the next records go to a new one
+static void spool_scan(void)
+{
+  char path[PATH_MAX];
+  struct dirent* dirEntry;
+  struct stat fileStat;
+  uint32_t seq;
+  char* end;
+  DIR* d;
+  bool bFound;
+
+  bFound = false;
+  spool.size = 0;
+  d = opendir(spool.dir);
+  while ((d != NULL) && ((dirEntry = readdir(d)) != NULL))
+  {
+    seq = strtoul(dirEntry->d_name, &end, 10);
+    if ((end == dirEntry->d_name) || (strcmp(end, SPOOL_SEGMENT_SUFFIX) != 0))
+    {
+      continue;
+    }
+
+    spool_getSegmentPath(seq, path);
+    if (stat(path, &fileStat) == 0)
+    {
+      spool.size += fileStat.st_size;
+    }
+
+    if ((bFound == false) || (seq < spool.readSeq))
+    {
+      spool.readSeq = seq;
+    }
+    if ((bFound == false) || (seq >= spool.nextSeq))
+    {
+      spool.nextSeq = seq + 1;
+    }
+    bFound = true;
+  }
+
+  if (d != NULL)
+  {
+    closedir(d);
+  }
+}
+
+static void spool_loadPosition(void)
+{
+  char position[SPOOL_POSITION_SIZE + 1];
+  uint32_t seq;
+  uint32_t offset;
+  ssize_t size;
+
+  spool.readOffset = 0;
+  size = pread(spool.positionFd, position, SPOOL_POSITION_SIZE, 0);
+  if (size <= 0)
+  {
+    return;
+  }
+
+  position[size] = '\0';
+  //the offset only applies to the segment it was saved for
+  if ((sscanf(position, "%u %u", &seq, &offset) == 2) && (seq == spool.readSeq) && (spool.readSeq != spool.nextSeq))
+  {
+    spool.readOffset = offset;
+  }
+}
+
+static void spool_savePosition(void)
+{
+  char position[SPOOL_POSITION_SIZE + 1];
+
+  snprintf(position, sizeof(position), "%010u %010u\n", spool.readSeq, spool.readOffset);
+  if (pwrite(spool.positionFd, position, SPOOL_POSITION_SIZE, 0) != SPOOL_POSITION_SIZE)
+  {
+    syslog(LOG_WARNING, "unable to save the spool position, errno = %d", errno);
+  }
+}
+
+///called with the lock held
+static bool spool_startSegment(void)
+{
+  char path[PATH_MAX];
+  int32_t fd;
+
+  spool_getSegmentPath(spool.nextSeq, path);
+  fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+  if (fd < 0)
+  {
+    syslog(LOG_ERR, "unable to create spool segment '%s', errno = %d", path, errno);
+    return false;
+  }
+
+  //the records of the previous segment are durable before the new one is used
+  if (spool.writeFd >= 0)
+  {
+    spool_sync();
+    close(spool.writeFd);
+  }
+  fsync(spool.dirFd);
+
+  spool.writeFd = fd;
+  spool.writeSize = 0;
+  spool.nextSeq++;
+
+  return true;
+}
+
+///called with the lock held
+static void spool_sync(void)
+{
+  uint64_t start;
+
+  spool.syncDeadline = 0;
+  if ((spool.nbUnsynced == 0) || (spool.writeFd < 0))
+  {
+    return;
+  }
+
+  start = monotonic_getTimeNs();
+  if (fdatasync(spool.writeFd) != 0)
+  {
+    syslog(LOG_ERR, "unable to sync the spool, errno = %d", errno);
+  }
+  latency_record(&spool_statistics.syncDuration, monotonic_getTimeNs() - start);
+  spool.nbUnsynced = 0;
+}
+
+static void spool_replay(spool_deliverCallBack deliver)
+{
+  char record[SPOOL_RECORD_SIZE + 1];
+  uint64_t start;
+  uint64_t now;
+  uint32_t length;
+  uint32_t nbReplayed;
+  spool_deliverStatus status;
+
+  start = monotonic_getTimeNs();
+  now = start;
+  nbReplayed = 0;
+  length = 1;
+  status = SPOOL_DELIVERED;
+
+  //the result of the record in flight is awaited, checked again later
+  pthread_mutex_lock(&spool.lock);
+  if (spool.pendingLength != 0)
+  {
+    spool.replayDeadline = now + ((uint64_t) SPOOL_REPLAY_INTERVAL) * MONOTONIC_NS_PER_MS;
+    pthread_mutex_unlock(&spool.lock);
+    return;
+  }
+  pthread_mutex_unlock(&spool.lock);
+
+  while ((nbReplayed < SPOOL_REPLAY_BURST) && ((now - start) < ((uint64_t) SPOOL_REPLAY_SLICE) * MONOTONIC_NS_PER_MS))
+  {
+    //the lock is not held while handing over, the workers keep appending
+    pthread_mutex_lock(&spool.lock);
+    length = spool_readRecord(record);
+    spool.pendingLength = length; //before the hand over, a worker may report at once
+    pthread_mutex_unlock(&spool.lock);
+    if (length == 0)
+    {
+      break;
+    }
+
+    status = deliver(record);
+    now = monotonic_getTimeNs();
+    if (status == SPOOL_PENDING)
+    {
+      //the position moves on with spool_notifyReplayed()
+      break;
+    }
+    pthread_mutex_lock(&spool.lock);
+    spool.pendingLength = 0;
+    pthread_mutex_unlock(&spool.lock);
+    if (status != SPOOL_DELIVERED)
+    {
+      break;
+    }
+
+    nbReplayed++;
+    pthread_mutex_lock(&spool.lock);
+    spool.readOffset += length;
+    spool_statistics.nbReplayed++;
+    pthread_mutex_unlock(&spool.lock);
+  }
+
+  pthread_mutex_lock(&spool.lock);
+  if (length == 0)
+  {
+    spool.replayDeadline = 0;
+    syslog(LOG_INFO, "spool replayed");
+  }
+  else if (status == SPOOL_FAILED)
+  {
+    spool_backOff(now);
+  }
+  else if ((status != SPOOL_PENDING) || (spool.pendingLength != 0))
+  {
+    spool.replayDeadline = now + ((uint64_t) SPOOL_REPLAY_INTERVAL) * MONOTONIC_NS_PER_MS;
+  }
+  spool_savePosition();
+  pthread_mutex_unlock(&spool.lock);
+}
+
+///called with the lock held, the sink failed: the next replay waits, longer on each failure
+static void spool_backOff(uint64_t now)
+{
+  spool_statistics.nbReplayFailures++;
+  spool.replayDeadline = now + ((uint64_t) spool.backoff) * MONOTONIC_NS_PER_MS;
+  syslog(LOG_WARNING, "spool replay failed, next try in %d ms", spool.backoff);
+  spool.backoff *= 2;
+  if (spool.backoff > SPOOL_BACKOFF_MAX)
+  {
+    spool.backoff = SPOOL_BACKOFF_MAX;
+  }
+}
+
+///called with the lock held, returns the size of the line read, 0 when the spool is empty
+static uint32_t spool_readRecord(char* record)
+{
+  char path[PATH_MAX];
+  ssize_t size;
+  char* newLine;
+
+  while (spool.readSeq != spool.nextSeq)
+  {
+    if (spool.readFd < 0)
+    {
+      spool_getSegmentPath(spool.readSeq, path);
+      spool.readFd = open(path, O_RDONLY | O_CLOEXEC);
+      if (spool.readFd < 0)
+      {
+        syslog(LOG_ERR, "unable to open spool segment '%s', errno = %d", path, errno);
+        spool_removeHead();
+        continue;
+      }
+    }
+
+    size = pread(spool.readFd, record, SPOOL_RECORD_SIZE, spool.readOffset);
+    if (size > 0)
+    {
+      newLine = memchr(record, '\n', size);
+      if (newLine != NULL)
+      {
+        *newLine = '\0';
+        return newLine - record + 1;
+      }
+    }
+
+    if (size < 0)
+    {
+      syslog(LOG_ERR, "unable to read spool segment %d, errno = %d", spool.readSeq, errno);
+    }
+    else if (size > 0)
+    {
+      //line cut by a crash, the rest of the segment is skipped
+      syslog(LOG_ERR, "invalid line in spool segment %d at %d, segment dropped", spool.readSeq, spool.readOffset);
+      spool_statistics.nbDropped++;
+    }
+
+    //replayed, or unusable: the next records go to a new segment if it was the one written
+    if (((spool.readSeq + 1) == spool.nextSeq) && (spool.writeFd >= 0))
+    {
+      close(spool.writeFd);
+      spool.writeFd = -1;
+      spool.nbUnsynced = 0;
+    }
+    spool_removeHead();
+  }
+
+  return 0;
+}
+
+///called with the lock held
+static void spool_removeHead(void)
+{
+  char path[PATH_MAX];
+  struct stat fileStat;
+
+  spool_getSegmentPath(spool.readSeq, path);
+  if ((stat(path, &fileStat) == 0) && ((uint64_t) fileStat.st_size <= spool.size))
+  {
+    spool.size -= fileStat.st_size;
+  }
+  unlink(path);
+
+  if (spool.readFd >= 0)
+  {
+    close(spool.readFd);
+    spool.readFd = -1;
+  }
+  spool.readSeq++;
+  spool.readOffset = 0;
+  spool.bFull = false;
+}
+
+static void spool_getSegmentPath(uint32_t seq, char* path)
+{
+  snprintf(path, PATH_MAX, "%s/%010u" SPOOL_SEGMENT_SUFFIX, spool.dir, seq);
+}
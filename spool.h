@@ -0,0 +1,81 @@
+#ifndef __SPOOL_H__
+#define __SPOOL_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "latency.h"
+
+/**
+ * On-disk spool of the readings the sink could not deliver, replayed in order once the
+ * script works again.
+ *
+ * The records are appended as lines to segment files ("<dir>/0000000012.seg"), a new
+ * segment being started beyond SPOOL_SEGMENT_SIZE. The appends are written at once but
+ * fdatasync() is batched: every SPOOL_SYNC_RECORDS records or SPOOL_SYNC_DELAY ms after
+ * the first one not synced. The spool is bounded by maxSize, records beyond are dropped.
+ *
+ * The replay reads the oldest segment from the position saved in "<dir>/position" and
+ * removes each segment once fully delivered. It runs from the event loop by bursts of at
+ * most SPOOL_REPLAY_BURST records or SPOOL_REPLAY_SLICE ms, SPOOL_REPLAY_INTERVAL ms
+ * apart, so live readings still go first. The sink never waits for its script: a record
+ * handed over to a worker or a script process is in flight, the replay stops until its
+ * result is reported by spool_notifyReplayed() and the position only moves on when it was
+ * delivered. A failing record stays at the head, the order is kept. When a record fails,
+ * the replay waits from SPOOL_BACKOFF_MIN to SPOOL_BACKOFF_MAX ms, doubled on each failure
+ * and reset as soon as a reading is delivered. The position is not synced: after a crash,
+ * the records of the last bursts may be delivered twice.
+ *
+ * spool_append(), spool_notifyDelivered() and spool_notifyReplayed() may be called from
+ * the sink workers.
+ */
+
+#define SPOOL_RECORD_SIZE       (1024)  //longest line, '\n' included
+#define SPOOL_DEFAULT_MAX_SIZE  (16384) //in kB
+#define SPOOL_SEGMENT_SIZE      (262144) //in bytes
+#define SPOOL_SYNC_RECORDS      (32)
+#define SPOOL_SYNC_DELAY        (1000)  //in ms
+#define SPOOL_REPLAY_BURST      (64)
+#define SPOOL_REPLAY_SLICE      (20)    //in ms
+#define SPOOL_REPLAY_INTERVAL   (50)    //in ms
+#define SPOOL_BACKOFF_MIN       (1000)  //in ms
+#define SPOOL_BACKOFF_MAX       (60000) //in ms
+
+typedef struct
+{
+  uint32_t nbAppended; //records
+  uint32_t nbReplayed; //delivered by the sink
+  uint32_t nbDropped; //spool full, write error or invalid line
+  uint32_t nbReplayFailures;
+  uint64_t size; //in bytes, not replayed yet
+  uint32_t nbSegments;
+  latency_histogram syncDuration; //in ns
+} spool_stats;
+
+typedef enum
+{
+  SPOOL_DELIVERED, //the position moves on
+  SPOOL_PENDING,   //in flight, the burst ends until spool_notifyReplayed()
+  SPOOL_BUSY,      //not now, the burst ends without backoff
+  SPOOL_FAILED     //retried after the backoff
+} spool_deliverStatus;
+
+/// hands a record (without '\n') over to the sink, never waits for the script
+typedef spool_deliverStatus (*spool_deliverCallBack)(const char* record);
+
+/// creates the directory if needed, the records already spooled are replayed
+extern bool spool_open(const char* dir, uint64_t maxSize);
+extern void spool_close(void);
+/// one record, or lines of records, returns false when not spooled
+extern bool spool_append(const char* data, uint32_t size);
+/// a live reading was delivered, the replay can start right away
+extern void spool_notifyDelivered(void);
+/// result of the record in flight, kept at the head when not delivered
+extern void spool_notifyReplayed(bool bDelivered);
+
+/// next sync or replay (CLOCK_MONOTONIC, ns), 0 when none
+extern uint64_t spool_getNextTimeout(void);
+/// without deliver, the replay is postponed by SPOOL_REPLAY_INTERVAL
+extern void spool_handleTimeout(spool_deliverCallBack deliver);
+extern void spool_getStats(spool_stats* stats);
+
+#endif /* __SPOOL_H__ */
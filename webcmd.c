@@ -9,6 +9,7 @@
 #include <sys/select.h>
 #include <string.h>
 #include <stdio.h>
+#include "probes.h"
 #include <stdlib.h>
 #include "unused.h"
 
@@ -27,6 +28,7 @@ typedef struct
 } webmsg_msg;
 
 static webmsg_msg web_receivedMessage;
+static uint32_t webcmd_nbOverflows;
 
 static void webcmd_readReceivedMessage(void);
 static bool webcmd_decodeAddress(char message[], zigbee_64bDestAddr* zbAddress);
@@ -61,6 +63,16 @@ bool webcmd_init(char* fifo)
   return initOk;
 }
 
+int32_t webcmd_getFd(void)
+{
+  return webcmd_fd;
+}
+
+void webcmd_handleInput(void)
+{
+  webcmd_readReceivedMessage();
+}
+
 bool webcmd_getMessage(webmsg* msg)
 {
   bool hasMessage;
@@ -71,6 +83,7 @@ bool webcmd_getMessage(webmsg* msg)
     hasMessage = true;
     *msg = web_receivedMessage.message[web_receivedMessage.indexRead];
     web_receivedMessage.nbItems--;
+    ZB_PROBE3(webcmd_dequeue, msg->sensor_id, msg->command, web_receivedMessage.nbItems);
     web_receivedMessage.indexRead++;
     if (web_receivedMessage.indexRead >= MESSAGE_NB_MAX)
     {
@@ -81,6 +94,16 @@ bool webcmd_getMessage(webmsg* msg)
   return hasMessage;
 }
 
+uint32_t webcmd_getQueueDepth(void)
+{
+  return web_receivedMessage.nbItems;
+}
+
+uint32_t webcmd_getNbOverflows(void)
+{
+  return webcmd_nbOverflows;
+}
+
 bool webcmd_checkMsg(webmsg* msg)
 {
   struct timeval waitTime;
@@ -148,6 +171,7 @@ static void webcmd_readReceivedMessage(void)
       if (!bReceivedOk)
       {
         syslog(LOG_EMERG, "unable to insert frame in FIFO");
+        webcmd_nbOverflows++;
       }
     }
     else
@@ -156,6 +180,9 @@ static void webcmd_readReceivedMessage(void)
     }
     msgReceived = fgets(message, MESSAGE_MAX_SIZE - 2, webcmd_file);
   }
+
+  //FIFO is non blocking, the last fgets() ends on EAGAIN
+  clearerr(webcmd_file);
 }
 
 static bool webcmd_insertFrame(webmsg* msg)
@@ -168,6 +195,7 @@ static bool webcmd_insertFrame(webmsg* msg)
     web_receivedMessage.message[web_receivedMessage.indexWrite] = *msg;
     web_receivedMessage.indexWrite++;
     web_receivedMessage.nbItems++;
+    ZB_PROBE3(webcmd_enqueue, msg->sensor_id, msg->command, web_receivedMessage.nbItems);
     if (web_receivedMessage.indexWrite >= MESSAGE_NB_MAX)
     {
       web_receivedMessage.indexWrite = 0;
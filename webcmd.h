@@ -31,6 +31,20 @@ typedef enum
 extern bool webcmd_init(char* fifo);
 extern bool webcmd_checkMsg(webmsg* msg);
 
+/**
+ * Non blocking entry points, for an external event loop:
+ * call webcmd_handleInput() when the FIFO fd is readable, then
+ * webcmd_getMessage() until it returns false.
+ */
+extern int32_t webcmd_getFd(void);
+extern void webcmd_handleInput(void);
+extern bool webcmd_getMessage(webmsg* msg);
+
+/// messages waiting for webcmd_getMessage()
+extern uint32_t webcmd_getQueueDepth(void);
+/// messages lost because the queue was full
+extern uint32_t webcmd_getNbOverflows(void);
+
 /**
  * Function public only for unit tests
  */
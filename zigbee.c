@@ -7,6 +7,7 @@
 #include <string.h>
 #include <netinet/in.h>
 #include <syslog.h>
+#include "probes.h"
 
 const zigbee_panID zigbee_randomPanID = { 0, 0, 0, 0, 0, 0, 0, 0};
 const zigbee_encryptionKey zigbee_randomEncryptionKey = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
@@ -44,6 +45,9 @@ typedef enum
   AT_WRITE,
   AT_FORCE_DISASSOCIATION,
   AT_OPERATING_CHANNEL,
+  AT_IO_D6,
+  AT_IO_D7,
+  AT_API_MODE,
   AT_NB_COMMAND,
 } zigbee_AT_COMMAND_LIST;
 
@@ -79,17 +83,43 @@ const char* zigbee_AT_COMMAND[AT_NB_COMMAND] =
   /* AT_WRITE */                     "WR",
   /* AT_FORCE_DISASSOCIATION */      "DA",
   /* AT_OPERATING_CHANNEL */         "CH",
+  /* AT_IO_D6 */                     "D6",
+  /* AT_IO_D7 */                     "D7",
+  /* AT_API_MODE */                  "AP",
+};
+
+//API mode 2: class of each byte, everything but data is escaped on the line
+typedef enum
+{
+  ZIGBEE_BYTE_DATA = 0,
+  ZIGBEE_BYTE_DELIMITER,
+  ZIGBEE_BYTE_ESCAPE,
+  ZIGBEE_BYTE_FLOW_CONTROL,
+} zigbee_byteClass;
+
+static const uint8_t zigbee_byteClasses[256] =
+{
+  [ZIGBEE_START_DELIMITER] = ZIGBEE_BYTE_DELIMITER,
+  [ZIGBEE_ESCAPE]          = ZIGBEE_BYTE_ESCAPE,
+  [ZIGBEE_XON]             = ZIGBEE_BYTE_FLOW_CONTROL,
+  [ZIGBEE_XOFF]            = ZIGBEE_BYTE_FLOW_CONTROL,
 };
 
-static uint8_t zigbee_doChecksum(uint8_t* frame, uint32_t size);
 static void zigbee_appendChecksum(uint8_t* buffer, uint32_t* frameSize);
 static void zigbee_setZigBeeFrameSize(uint8_t* buffer, uint32_t sizeFrame);
 static bool zigbee_decodeATResponseFrame(uint8_t* frame, uint32_t size, zigbee_decodedFrame* decodedFrame);
 static bool zibgee_decodeReceivePacket(uint8_t* frame, uint32_t size, zigbee_decodedFrame* decodedFrame);
 
-#define ZIGBEE_START_DELIMITER      (0x7E)
-#define ZIGBEE_HEADER_SIZE          (3)
-#define ZIGBEE_ENCAPSULATION_SIZE   (ZIGBEE_HEADER_SIZE + 1)
+static uint8_t zigbee_parser_peek(zigbee_parser* parser, uint32_t offset);
+static void    zigbee_parser_drop(zigbee_parser* parser, uint32_t size);
+static void    zigbee_parser_copy(zigbee_parser* parser, uint8_t* frame, uint32_t size);
+static void    zigbee_parser_huntDelimiter(zigbee_parser* parser);
+static bool    zigbee_parser_getEscapedFrame(zigbee_parser* parser, uint8_t* frame, uint32_t sizeBuffer,
+    uint16_t* frameSize);
+static uint32_t zigbee_parser_unescape(zigbee_parser* parser, uint32_t* rawOffset, uint8_t* data, uint32_t size,
+                                       bool* bDelimiter);
+
+#define ZIGBEE_PARSER_MASK          (ZIGBEE_PARSER_BUFFER_SIZE - 1)
 
 
 static uint32_t zigbee_encode_ATcmd(uint8_t* buffer, uint32_t size, uint8_t frameID, const char* atCmd, uint8_t* data,
@@ -127,7 +157,7 @@ static void zigbee_appendChecksum(uint8_t* buffer, uint32_t* sizeFrame)
 }
 
 
-static uint8_t zigbee_doChecksum(uint8_t* frame, uint32_t size)
+uint8_t zigbee_doChecksum(uint8_t* frame, uint32_t size)
 {
   uint8_t checksum;
 
@@ -157,6 +187,15 @@ uint32_t zigbee_encode_SetPanID(uint8_t* buffer, uint32_t size, uint8_t frameID,
                         (uint8_t*) panID, sizeof(zigbee_panID));
 }
 
+uint32_t zigbee_encode_getExtendedPanID(uint8_t* buffer, uint32_t size, uint8_t frameID)
+{
+  return
+    zigbee_encode_ATcmd(buffer, size,
+                        frameID,
+                        zigbee_AT_COMMAND[AT_SET_PAN_ID],
+                        NULL, 0);
+}
+
 uint32_t zigbee_encode_getPanID(uint8_t* buffer, uint32_t size, uint8_t frameID)
 {
   return
@@ -176,8 +215,27 @@ uint32_t zigbee_encode_getOperatingChannel(uint8_t* buffer, uint32_t size, uint8
 }
 
 
+uint32_t zigbee_encode_getNumberOfSleepPeriod(uint8_t* buffer, uint32_t size, uint8_t frameID)
+{
+  return
+    zigbee_encode_ATcmd(buffer, size,
+                        frameID,
+                        zigbee_AT_COMMAND[AT_SET_NUMBER_OF_SLEEP_PERIOD],
+                        NULL, 0);
+}
+
+uint32_t zigbee_encode_getSleepPeriod(uint8_t* buffer, uint32_t size, uint8_t frameID)
+{
+  return
+    zigbee_encode_ATcmd(buffer, size,
+                        frameID,
+                        zigbee_AT_COMMAND[AT_SET_SLEEP_PERIOD],
+                        NULL, 0);
+}
+
 uint32_t zigbee_encode_setNumberOfSleepPeriod(uint8_t* buffer, uint32_t size, uint8_t frameID, uint16_t nSleepPeriod)
 {
+  nSleepPeriod = htons(nSleepPeriod);
   return
     zigbee_encode_ATcmd(buffer, size,
                         frameID,
@@ -187,6 +245,7 @@ uint32_t zigbee_encode_setNumberOfSleepPeriod(uint8_t* buffer, uint32_t size, ui
 
 uint32_t zigbee_encode_setSleepPeriod(uint8_t* buffer, uint32_t size, uint8_t frameID, uint16_t sleepPeriod)
 {
+  sleepPeriod = htons(sleepPeriod);
   return
     zigbee_encode_ATcmd(buffer, size,
                         frameID,
@@ -206,6 +265,15 @@ uint32_t zigbee_encode_setScanChannelBitmask(uint8_t* buffer, uint32_t size, uin
                         (uint8_t*) &bitmask, sizeof(uint16_t));
 }
 
+uint32_t zigbee_encode_getScanChannelBitmask(uint8_t* buffer, uint32_t size, uint8_t frameID)
+{
+  return
+    zigbee_encode_ATcmd(buffer, size,
+                        frameID,
+                        zigbee_AT_COMMAND[AT_SCAN_CHAN],
+                        NULL, 0);
+}
+
 //AT SD
 uint32_t zigbee_encode_setScanDurationExponent(uint8_t* buffer, uint32_t size, uint8_t frameID, uint8_t duration)
 {
@@ -216,6 +284,15 @@ uint32_t zigbee_encode_setScanDurationExponent(uint8_t* buffer, uint32_t size, u
                         &duration, sizeof(uint8_t));
 }
 
+uint32_t zigbee_encode_getScanDurationExponent(uint8_t* buffer, uint32_t size, uint8_t frameID)
+{
+  return
+    zigbee_encode_ATcmd(buffer, size,
+                        frameID,
+                        zigbee_AT_COMMAND[AT_SCAN_DURATION],
+                        NULL, 0);
+}
+
 
 //AT ZS
 uint32_t zigbee_encode_setStackProfile(uint8_t* buffer, uint32_t size, uint8_t frameID, uint8_t stackProfile)
@@ -227,6 +304,15 @@ uint32_t zigbee_encode_setStackProfile(uint8_t* buffer, uint32_t size, uint8_t f
                         &stackProfile, sizeof(uint8_t));
 }
 
+uint32_t zigbee_encode_getStackProfile(uint8_t* buffer, uint32_t size, uint8_t frameID)
+{
+  return
+    zigbee_encode_ATcmd(buffer, size,
+                        frameID,
+                        zigbee_AT_COMMAND[AT_STACK_PROFILE],
+                        NULL, 0);
+}
+
 //AT EE
 uint32_t zigbee_encode_setEncryptionEnabled(uint8_t* buffer, uint32_t size, uint8_t frameID, bool encryptionEnabled)
 {
@@ -247,6 +333,15 @@ uint32_t zigbee_encode_setEncryptionEnabled(uint8_t* buffer, uint32_t size, uint
                         &encryption, sizeof(uint8_t));
 }
 
+uint32_t zigbee_encode_getEncryptionEnabled(uint8_t* buffer, uint32_t size, uint8_t frameID)
+{
+  return
+    zigbee_encode_ATcmd(buffer, size,
+                        frameID,
+                        zigbee_AT_COMMAND[AT_ENCRYPTION_ENABLED],
+                        NULL, 0);
+}
+
 //AT NK
 uint32_t zigbee_encode_setNetworkEncryptionKey(uint8_t* buffer, uint32_t size, uint8_t frameID,
     zigbee_encryptionKey* key)
@@ -288,6 +383,15 @@ uint32_t zigbee_encode_SetJoinTime(uint8_t* buffer, uint32_t size, uint8_t frame
                         &joinTimeInSecond, sizeof(uint8_t));
 }
 
+uint32_t zigbee_encode_getJoinTime(uint8_t* buffer, uint32_t size, uint8_t frameID)
+{
+  return
+    zigbee_encode_ATcmd(buffer, size,
+                        frameID,
+                        zigbee_AT_COMMAND[AT_SET_JOIN_TIME],
+                        NULL, 0);
+}
+
 //AT NI
 uint32_t zigbee_encode_SetNodeIdentifier(uint8_t* buffer, uint32_t size, uint8_t frameID, char* string)
 {
@@ -298,6 +402,15 @@ uint32_t zigbee_encode_SetNodeIdentifier(uint8_t* buffer, uint32_t size, uint8_t
                         (uint8_t*) string, strlen(string));
 }
 
+uint32_t zigbee_encode_getNodeIdentifier(uint8_t* buffer, uint32_t size, uint8_t frameID)
+{
+  return
+    zigbee_encode_ATcmd(buffer, size,
+                        frameID,
+                        zigbee_AT_COMMAND[AT_SET_NODE_ID],
+                        NULL, 0);
+}
+
 //AT AI
 uint32_t zigbee_encode_getAssociationIndication(uint8_t* buffer, uint32_t size, uint8_t frameID)
 {
@@ -424,6 +537,63 @@ uint32_t zigbee_encode_D5(uint8_t* buffer, uint32_t size, uint8_t frameID, uint8
                         &state, sizeof(uint8_t));
 }
 
+// AT D6 IO DIO6/RTS
+uint32_t zigbee_encode_D6(uint8_t* buffer, uint32_t size, uint8_t frameID, uint8_t state)
+{
+  return
+    zigbee_encode_ATcmd(buffer, size,
+                        frameID,
+                        zigbee_AT_COMMAND[AT_IO_D6],
+                        &state, sizeof(uint8_t));
+}
+
+uint32_t zigbee_encode_getD6(uint8_t* buffer, uint32_t size, uint8_t frameID)
+{
+  return
+    zigbee_encode_ATcmd(buffer, size,
+                        frameID,
+                        zigbee_AT_COMMAND[AT_IO_D6],
+                        NULL, 0);
+}
+
+// AT D7 IO DIO7/CTS
+uint32_t zigbee_encode_D7(uint8_t* buffer, uint32_t size, uint8_t frameID, uint8_t state)
+{
+  return
+    zigbee_encode_ATcmd(buffer, size,
+                        frameID,
+                        zigbee_AT_COMMAND[AT_IO_D7],
+                        &state, sizeof(uint8_t));
+}
+
+uint32_t zigbee_encode_getD7(uint8_t* buffer, uint32_t size, uint8_t frameID)
+{
+  return
+    zigbee_encode_ATcmd(buffer, size,
+                        frameID,
+                        zigbee_AT_COMMAND[AT_IO_D7],
+                        NULL, 0);
+}
+
+// AT AP
+uint32_t zigbee_encode_setApiMode(uint8_t* buffer, uint32_t size, uint8_t frameID, uint8_t apiMode)
+{
+  return
+    zigbee_encode_ATcmd(buffer, size,
+                        frameID,
+                        zigbee_AT_COMMAND[AT_API_MODE],
+                        &apiMode, sizeof(uint8_t));
+}
+
+uint32_t zigbee_encode_getApiMode(uint8_t* buffer, uint32_t size, uint8_t frameID)
+{
+  return
+    zigbee_encode_ATcmd(buffer, size,
+                        frameID,
+                        zigbee_AT_COMMAND[AT_API_MODE],
+                        NULL, 0);
+}
+
 // AT PO IO PWM RRSI
 uint32_t zigbee_encode_P0(uint8_t* buffer, uint32_t size, uint8_t frameID, uint8_t state)
 {
@@ -447,20 +617,48 @@ uint32_t zigbee_encode_RSSI_PWM_Timer(uint8_t* buffer, uint32_t size, uint8_t fr
 
 
 // AT BD
-uint32_t zigbee_encode_setBaudRate(uint8_t* buffer, uint32_t size, uint8_t frameID, zigbee_baudrate baudrate)
+uint32_t zigbee_encode_setBaudRate(uint8_t* buffer, uint32_t size, uint8_t frameID, uint32_t baudrate)
 {
   uint8_t bd;
-  bd = (uint8_t) baudrate;
+  uint32_t rawBaudrate;
 
+  if (baudrate < ZB_BD_NON_STANDARD_MIN)
+  {
+    bd = (uint8_t) baudrate;
+    return
+      zigbee_encode_ATcmd(buffer, size,
+                          frameID,
+                          zigbee_AT_COMMAND[AT_SET_BAUD_RATE],
+                          &bd, sizeof(uint8_t));
+  }
+
+  rawBaudrate = htonl(baudrate);
   return
     zigbee_encode_ATcmd(buffer, size,
                         frameID,
                         zigbee_AT_COMMAND[AT_SET_BAUD_RATE],
-                        &bd, sizeof(uint8_t));
+                        (uint8_t*) &rawBaudrate, sizeof(uint32_t));
 }
 
 
 
+// AT Command - Queue Parameter Value: same frame as an AT command, applied on next AC
+bool zigbee_encode_toQueuedParameter(uint8_t* buffer, uint32_t sizeFrame)
+{
+  bool bConverted;
+  bConverted = false;
+
+  if ((sizeFrame >= (ZIGBEE_ENCAPSULATION_SIZE + 4)) && (buffer[ZIGBEE_HEADER_SIZE] == ZIGBEE_API_AT_CMD))
+  {
+    buffer[ZIGBEE_HEADER_SIZE] = ZIGBEE_API_AT_QUEUE_CMD;
+    sizeFrame--;
+    zigbee_appendChecksum(buffer, &sizeFrame);
+    bConverted = true;
+  }
+
+  return bConverted;
+}
+
 uint32_t zigbee_encode_transmitRequest(uint8_t* buffer, uint32_t sizeBuffer, uint8_t frameID,
                                        zigbee_64bDestAddr* destAddr64b, uint16_t destAddr16b, uint8_t* payload, uint8_t size)
 {
@@ -469,6 +667,11 @@ uint32_t zigbee_encode_transmitRequest(uint8_t* buffer, uint32_t sizeBuffer, uin
   sizeFrame  = 0;
   assert(sizeBuffer >= 8);
 
+  if (sizeBuffer < (ZIGBEE_ENCAPSULATION_SIZE + 14 + (uint32_t) size))
+  {
+    return 0;
+  }
+
   buffer[sizeFrame++] = ZIGBEE_START_DELIMITER;
   sizeFrame += 2; //for size frame insertion
   buffer[sizeFrame++] = ZIGBEE_API_TRANSMIT_REQUEST;
@@ -567,6 +770,15 @@ bool zigbee_decodeFrame(uint8_t* frame, uint16_t frameSize, zigbee_decodedFrame*
     }
   }
 
+  if (bCorrectlyDecoded)
+  {
+    ZB_PROBE2(decode_ok, frame[0], frameSize);
+  }
+  else
+  {
+    ZB_PROBE2(decode_failed, (frameSize >= 1) ? frame[0] : 0, frameSize);
+  }
+
   return bCorrectlyDecoded;
 }
 
@@ -611,6 +823,370 @@ static bool zibgee_decodeReceivePacket(uint8_t* frame, uint32_t size, zigbee_dec
   return true;
 }
 
+void zigbee_parser_init(zigbee_parser* parser)
+{
+  assert(parser != NULL);
+  parser->indexRead = 0;
+  parser->nbBytes = 0;
+  parser->bEscaped = false;
+  parser->nbChecksumErrors = 0;
+  parser->nbLengthErrors = 0;
+  parser->nbDiscardedBytes = 0;
+}
+
+void zigbee_parser_setEscaped(zigbee_parser* parser, bool bEscaped)
+{
+  assert(parser != NULL);
+  parser->bEscaped = bEscaped;
+}
+
+void zigbee_parser_flush(zigbee_parser* parser)
+{
+  parser->nbDiscardedBytes += parser->nbBytes;
+  parser->indexRead = 0;
+  parser->nbBytes = 0;
+}
+
+uint32_t zigbee_parser_getFreeSize(zigbee_parser* parser)
+{
+  return ZIGBEE_PARSER_BUFFER_SIZE - parser->nbBytes;
+}
+
+uint32_t zigbee_parser_push(zigbee_parser* parser, uint8_t* data, uint32_t size)
+{
+  uint32_t indexWrite;
+  uint32_t firstPart;
+
+  if (size > zigbee_parser_getFreeSize(parser))
+  {
+    size = zigbee_parser_getFreeSize(parser);
+  }
+
+  indexWrite = (parser->indexRead + parser->nbBytes) & ZIGBEE_PARSER_MASK;
+  firstPart = ZIGBEE_PARSER_BUFFER_SIZE - indexWrite;
+  if (firstPart > size)
+  {
+    firstPart = size;
+  }
+
+  memcpy(&parser->buffer[indexWrite], data, firstPart);
+  memcpy(&parser->buffer[0], &data[firstPart], size - firstPart);
+  parser->nbBytes += size;
+
+  return size;
+}
+
+bool zigbee_parser_getFrame(zigbee_parser* parser, uint8_t* frame, uint32_t sizeBuffer, uint16_t* frameSize)
+{
+  bool bFrameFound;
+  bool bContinue;
+  uint32_t length;
+
+  assert(parser != NULL);
+  assert(frame != NULL);
+  bFrameFound = false;
+  bContinue = true;
+
+  if (parser->bEscaped == true)
+  {
+    return zigbee_parser_getEscapedFrame(parser, frame, sizeBuffer, frameSize);
+  }
+
+  while ((bFrameFound == false) && (bContinue == true))
+  {
+    zigbee_parser_huntDelimiter(parser);
+    if (parser->nbBytes < ZIGBEE_HEADER_SIZE)
+    {
+      bContinue = false;
+      continue;
+    }
+
+    length = ((uint32_t) zigbee_parser_peek(parser, 1)) << 8 | zigbee_parser_peek(parser, 2);
+    if ((length == 0) ||
+        ((length + ZIGBEE_ENCAPSULATION_SIZE) > sizeBuffer) ||
+        ((length + ZIGBEE_ENCAPSULATION_SIZE) > ZIGBEE_PARSER_BUFFER_SIZE))
+    {
+      //not a real start of frame, resynchronise on the next delimiter
+      parser->nbLengthErrors++;
+      parser->nbDiscardedBytes++;
+      zigbee_parser_drop(parser, 1);
+      continue;
+    }
+
+    if (parser->nbBytes < (length + ZIGBEE_ENCAPSULATION_SIZE))
+    {
+      //frame not yet complete
+      bContinue = false;
+      continue;
+    }
+
+    zigbee_parser_copy(parser, frame, length + ZIGBEE_ENCAPSULATION_SIZE);
+    if (zigbee_doChecksum(&frame[ZIGBEE_HEADER_SIZE], length) != frame[ZIGBEE_HEADER_SIZE + length])
+    {
+      syslog(LOG_ERR, "Checksum KO, resynchronise on next delimiter");
+      ZB_PROBE2(decode_failed, frame[ZIGBEE_HEADER_SIZE], length + ZIGBEE_ENCAPSULATION_SIZE);
+      parser->nbChecksumErrors++;
+      parser->nbDiscardedBytes++;
+      zigbee_parser_drop(parser, 1);
+      continue;
+    }
+
+    zigbee_parser_drop(parser, length + ZIGBEE_ENCAPSULATION_SIZE);
+    *frameSize = length + ZIGBEE_ENCAPSULATION_SIZE;
+    bFrameFound = true;
+  }
+
+  return bFrameFound;
+}
+
+static bool zigbee_parser_getEscapedFrame(zigbee_parser* parser, uint8_t* frame, uint32_t sizeBuffer,
+    uint16_t* frameSize)
+{
+  uint32_t rawOffset;
+  uint32_t length;
+  bool bDelimiter;
+
+  while (true)
+  {
+    zigbee_parser_huntDelimiter(parser);
+    if (parser->nbBytes == 0)
+    {
+      return false;
+    }
+
+    frame[0] = ZIGBEE_START_DELIMITER;
+    rawOffset = 1;
+    if (zigbee_parser_unescape(parser, &rawOffset, &frame[1], 2, &bDelimiter) < 2)
+    {
+      if (bDelimiter == false)
+      {
+        return false;
+      }
+
+      //truncated frame, a raw 0x7E always starts a new one
+      parser->nbLengthErrors++;
+      parser->nbDiscardedBytes += rawOffset;
+      zigbee_parser_drop(parser, rawOffset);
+      continue;
+    }
+
+    length = ((uint32_t) frame[1]) << 8 | frame[2];
+    if ((length == 0) || ((length + ZIGBEE_ENCAPSULATION_SIZE) > sizeBuffer))
+    {
+      parser->nbLengthErrors++;
+      parser->nbDiscardedBytes++;
+      zigbee_parser_drop(parser, 1);
+      continue;
+    }
+
+    if (zigbee_parser_unescape(parser, &rawOffset, &frame[ZIGBEE_HEADER_SIZE], length + 1, &bDelimiter) < (length + 1))
+    {
+      if ((bDelimiter == false) && (parser->nbBytes < ZIGBEE_PARSER_BUFFER_SIZE))
+      {
+        //frame not yet complete
+        return false;
+      }
+
+      parser->nbLengthErrors++;
+      parser->nbDiscardedBytes += rawOffset;
+      zigbee_parser_drop(parser, rawOffset);
+      continue;
+    }
+
+    //no delimiter inside, the whole frame is dropped in both cases
+    zigbee_parser_drop(parser, rawOffset);
+    if (zigbee_doChecksum(&frame[ZIGBEE_HEADER_SIZE], length) != frame[ZIGBEE_HEADER_SIZE + length])
+    {
+      syslog(LOG_ERR, "Checksum KO, resynchronise on next delimiter");
+      ZB_PROBE2(decode_failed, frame[ZIGBEE_HEADER_SIZE], length + ZIGBEE_ENCAPSULATION_SIZE);
+      parser->nbChecksumErrors++;
+      parser->nbDiscardedBytes += rawOffset;
+      continue;
+    }
+
+    *frameSize = length + ZIGBEE_ENCAPSULATION_SIZE;
+    return true;
+  }
+}
+
+/**
+ * unescape up to size bytes, starting rawOffset bytes after the read index.
+ * Runs of plain data are found with the class table and copied with memcpy.
+ * Stops before a raw delimiter (bDelimiter set), even right after an escape, or an escape
+ * whose second byte is missing.
+ */
+static uint32_t zigbee_parser_unescape(zigbee_parser* parser, uint32_t* rawOffset, uint8_t* data, uint32_t size,
+                                       bool* bDelimiter)
+{
+  uint32_t produced;
+  uint32_t index;
+  uint32_t contiguous;
+  uint32_t run;
+  uint8_t* raw;
+
+  produced = 0;
+  *bDelimiter = false;
+  while ((produced < size) && (*rawOffset < parser->nbBytes))
+  {
+    index = (parser->indexRead + *rawOffset) & ZIGBEE_PARSER_MASK;
+    raw = &parser->buffer[index];
+    contiguous = ZIGBEE_PARSER_BUFFER_SIZE - index;
+    if (contiguous > (parser->nbBytes - *rawOffset))
+    {
+      contiguous = parser->nbBytes - *rawOffset;
+    }
+    if (contiguous > (size - produced))
+    {
+      contiguous = size - produced;
+    }
+
+    run = 0;
+    while ((run < contiguous) && (zigbee_byteClasses[raw[run]] == ZIGBEE_BYTE_DATA))
+    {
+      run++;
+    }
+    memcpy(&data[produced], raw, run);
+    produced += run;
+    *rawOffset += run;
+    if (run == contiguous)
+    {
+      continue;
+    }
+
+    switch (zigbee_byteClasses[raw[run]])
+    {
+      case ZIGBEE_BYTE_DELIMITER:
+        *bDelimiter = true;
+        return produced;
+
+      case ZIGBEE_BYTE_FLOW_CONTROL:
+        //XON/XOFF are not part of the frames
+        (*rawOffset)++;
+        break;
+
+      case ZIGBEE_BYTE_ESCAPE:
+      default:
+        if ((*rawOffset + 1) >= parser->nbBytes)
+        {
+          return produced;
+        }
+        //an escape cut by a new frame, the delimiter is kept for the resynchronisation
+        if (zigbee_parser_peek(parser, *rawOffset + 1) == ZIGBEE_START_DELIMITER)
+        {
+          (*rawOffset)++;
+          *bDelimiter = true;
+          return produced;
+        }
+        data[produced++] = zigbee_parser_peek(parser, *rawOffset + 1) ^ ZIGBEE_ESCAPE_XOR;
+        *rawOffset += 2;
+        break;
+    }
+  }
+
+  return produced;
+}
+
+uint32_t zigbee_escapeFrame(const uint8_t* frame, uint32_t size, uint8_t* buffer, uint32_t sizeBuffer)
+{
+  uint32_t i;
+  uint32_t run;
+  uint32_t sizeEscaped;
+
+  if ((size == 0) || (sizeBuffer < size))
+  {
+    return 0;
+  }
+
+  buffer[0] = frame[0];
+  sizeEscaped = 1;
+  i = 1;
+  while (i < size)
+  {
+    run = 0;
+    while (((i + run) < size) && (zigbee_byteClasses[frame[i + run]] == ZIGBEE_BYTE_DATA))
+    {
+      run++;
+    }
+
+    if ((sizeEscaped + run) > sizeBuffer)
+    {
+      return 0;
+    }
+    memcpy(&buffer[sizeEscaped], &frame[i], run);
+    sizeEscaped += run;
+    i += run;
+
+    if (i < size)
+    {
+      if ((sizeEscaped + 2) > sizeBuffer)
+      {
+        return 0;
+      }
+      buffer[sizeEscaped++] = ZIGBEE_ESCAPE;
+      buffer[sizeEscaped++] = frame[i] ^ ZIGBEE_ESCAPE_XOR;
+      i++;
+    }
+  }
+
+  return sizeEscaped;
+}
+
+static uint8_t zigbee_parser_peek(zigbee_parser* parser, uint32_t offset)
+{
+  return parser->buffer[(parser->indexRead + offset) & ZIGBEE_PARSER_MASK];
+}
+
+static void zigbee_parser_drop(zigbee_parser* parser, uint32_t size)
+{
+  parser->indexRead = (parser->indexRead + size) & ZIGBEE_PARSER_MASK;
+  parser->nbBytes -= size;
+  if (parser->nbBytes == 0)
+  {
+    parser->indexRead = 0;
+  }
+}
+
+static void zigbee_parser_copy(zigbee_parser* parser, uint8_t* frame, uint32_t size)
+{
+  uint32_t firstPart;
+
+  firstPart = ZIGBEE_PARSER_BUFFER_SIZE - parser->indexRead;
+  if (firstPart > size)
+  {
+    firstPart = size;
+  }
+  memcpy(frame, &parser->buffer[parser->indexRead], firstPart);
+  memcpy(&frame[firstPart], &parser->buffer[0], size - firstPart);
+}
+
+static void zigbee_parser_huntDelimiter(zigbee_parser* parser)
+{
+  uint32_t contiguous;
+  uint8_t* found;
+  uint32_t skipped;
+
+  while ((parser->nbBytes > 0) && (parser->buffer[parser->indexRead] != ZIGBEE_START_DELIMITER))
+  {
+    contiguous = ZIGBEE_PARSER_BUFFER_SIZE - parser->indexRead;
+    if (contiguous > parser->nbBytes)
+    {
+      contiguous = parser->nbBytes;
+    }
+
+    found = memchr(&parser->buffer[parser->indexRead], ZIGBEE_START_DELIMITER, contiguous);
+    if (found != NULL)
+    {
+      skipped = found - &parser->buffer[parser->indexRead];
+    }
+    else
+    {
+      skipped = contiguous;
+    }
+    parser->nbDiscardedBytes += skipped;
+    zigbee_parser_drop(parser, skipped);
+  }
+}
+
 char* zigbee_get_indicationError(uint8_t indicationStatus)
 {
   char* errorString;
@@ -665,3 +1241,45 @@ char* zigbee_get_indicationError(uint8_t indicationStatus)
   }
   return errorString;
 }
+
+char* zigbee_get_modemStatus(uint8_t modemStatus)
+{
+  char* statusString;
+
+  switch (modemStatus)
+  {
+    case ZIGBEE_MODEM_HW_RESET:
+      statusString = "hardware reset";
+      break;
+    case ZIGBEE_MODEM_WATCHDOG_RESET:
+      statusString = "watchdog timer reset";
+      break;
+    case ZIGBEE_MODEM_JOINED:
+      statusString = "joined network";
+      break;
+    case ZIGBEE_MODEM_DISASSOCIATED:
+      statusString = "disassociated";
+      break;
+    case ZIGBEE_MODEM_COORDINATOR_STARTED:
+      statusString = "coordinator started";
+      break;
+    case ZIGBEE_MODEM_KEY_UPDATED:
+      statusString = "network security key was updated";
+      break;
+    case ZIGBEE_MODEM_NONE:
+      statusString = "none";
+      break;
+
+    default:
+      if (modemStatus >= ZIGBEE_MODEM_STACK_ERROR)
+      {
+        statusString = "stack error";
+      }
+      else
+      {
+        statusString = "unknown status";
+      }
+      break;
+  }
+  return statusString;
+}
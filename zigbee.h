@@ -11,6 +11,19 @@
 #define ZIGBEE_DEFAULT_ENCRYPTION_OPTION      (0)
 #define ZIGBEE_MAX_MAC_ADDRESS_NUMBER         (8)
 
+#define ZIGBEE_START_DELIMITER                (0x7E)
+#define ZIGBEE_HEADER_SIZE                    (3)
+#define ZIGBEE_ENCAPSULATION_SIZE             (ZIGBEE_HEADER_SIZE + 1)
+
+#define ZIGBEE_API_MODE_UNESCAPED             (1)
+#define ZIGBEE_API_MODE_ESCAPED               (2)
+#define ZIGBEE_ESCAPE                         (0x7D)
+#define ZIGBEE_ESCAPE_XOR                     (0x20)
+#define ZIGBEE_XON                            (0x11)
+#define ZIGBEE_XOFF                           (0x13)
+
+#define ZIGBEE_PARSER_BUFFER_SIZE             (1024) //shall be a power of 2
+
 typedef uint8_t zigbee_panID[ZIGBEE_MAX_MAC_ADDRESS_NUMBER];
 typedef uint8_t zigbee_encryptionKey[16];
 typedef uint8_t zigbee_linkKey[16];
@@ -25,6 +38,9 @@ typedef enum
   CYCLIC_SLEEP_PIN_WAKE = 5
 } zigbee_sleepMode;
 
+#define ZIGBEE_D6_RTS_FLOW_CONTROL  (1)
+#define ZIGBEE_D7_CTS_FLOW_CONTROL  (1)
+
 typedef enum
 {
   ZB_BD_1200 = 0,
@@ -35,6 +51,8 @@ typedef enum
   ZB_BD_38400 = 5,
   ZB_BD_57600 = 6,
   ZB_BD_115200 = 7,
+  //above, BD takes the speed in bps (non-standard baud rate)
+  ZB_BD_NON_STANDARD_MIN = 0x80,
 } zigbee_baudrate;
 
 
@@ -61,6 +79,7 @@ extern uint32_t zigbee_encode_getSerialNumberHigh(uint8_t* buffer, uint32_t size
 extern uint32_t zigbee_encode_getSerialNumberLow(uint8_t* buffer, uint32_t size, uint8_t frameID);
 extern uint32_t zigbee_encode_SetNodeIdentifier(uint8_t* buffer, uint32_t size, uint8_t frameID, char* string);
 extern char*    zigbee_get_indicationError(uint8_t indicationStatus);
+extern char*    zigbee_get_modemStatus(uint8_t modemStatus);
 extern uint32_t zigbee_encode_setSleepMode(uint8_t* buffer, uint32_t size, uint8_t frameID, zigbee_sleepMode sleepMode);
 extern uint32_t zigbee_encode_applyChanges(uint8_t* buffer, uint32_t size, uint8_t frameID);
 extern uint32_t zigbee_encode_write(uint8_t* buffer, uint32_t size, uint8_t frameID);
@@ -71,21 +90,41 @@ extern uint32_t zigbee_encode_getReceivedSignalStrenght(uint8_t* buffer, uint32_
 extern uint32_t zigbee_encode_nodeDiscover(uint8_t* buffer, uint32_t size, uint8_t frameID);
 
 extern uint32_t zigbee_encode_D5(uint8_t* buffer, uint32_t size, uint8_t frameID, uint8_t state);
+extern uint32_t zigbee_encode_D6(uint8_t* buffer, uint32_t size, uint8_t frameID, uint8_t state);
+extern uint32_t zigbee_encode_getD6(uint8_t* buffer, uint32_t size, uint8_t frameID);
+extern uint32_t zigbee_encode_D7(uint8_t* buffer, uint32_t size, uint8_t frameID, uint8_t state);
+extern uint32_t zigbee_encode_getD7(uint8_t* buffer, uint32_t size, uint8_t frameID);
 extern uint32_t zigbee_encode_P0(uint8_t* buffer, uint32_t size, uint8_t frameID, uint8_t state);
 extern uint32_t zigbee_encode_RSSI_PWM_Timer(uint8_t* buffer, uint32_t size, uint8_t frameID, uint8_t value);
-extern uint32_t zigbee_encode_setBaudRate(uint8_t* buffer, uint32_t size, uint8_t frameID, zigbee_baudrate baudrate);
+extern uint32_t zigbee_encode_setBaudRate(uint8_t* buffer, uint32_t size, uint8_t frameID, uint32_t baudrate);
 extern uint32_t zigbee_encode_setNumberOfSleepPeriod(uint8_t* buffer, uint32_t size, uint8_t frameID,
     uint16_t nSleepPeriod);
 extern uint32_t zigbee_encode_setSleepPeriod(uint8_t* buffer, uint32_t size, uint8_t frameID, uint16_t sleepPeriod);
 
+extern uint32_t zigbee_encode_getExtendedPanID(uint8_t* buffer, uint32_t size, uint8_t frameID);
+extern uint32_t zigbee_encode_getScanChannelBitmask(uint8_t* buffer, uint32_t size, uint8_t frameID);
+extern uint32_t zigbee_encode_getScanDurationExponent(uint8_t* buffer, uint32_t size, uint8_t frameID);
+extern uint32_t zigbee_encode_getStackProfile(uint8_t* buffer, uint32_t size, uint8_t frameID);
+extern uint32_t zigbee_encode_getEncryptionEnabled(uint8_t* buffer, uint32_t size, uint8_t frameID);
+extern uint32_t zigbee_encode_getSleepPeriod(uint8_t* buffer, uint32_t size, uint8_t frameID);
+extern uint32_t zigbee_encode_getNumberOfSleepPeriod(uint8_t* buffer, uint32_t size, uint8_t frameID);
+extern uint32_t zigbee_encode_getJoinTime(uint8_t* buffer, uint32_t size, uint8_t frameID);
+extern uint32_t zigbee_encode_getNodeIdentifier(uint8_t* buffer, uint32_t size, uint8_t frameID);
 extern uint32_t zigbee_encode_getOperatingChannel(uint8_t* buffer, uint32_t size, uint8_t frameID);
 
+extern bool     zigbee_encode_toQueuedParameter(uint8_t* buffer, uint32_t sizeFrame);
+/// API mode 2: copy frame escaping every byte after the delimiter, returns the escaped size (0 if too small)
+extern uint32_t zigbee_escapeFrame(const uint8_t* frame, uint32_t size, uint8_t* buffer, uint32_t sizeBuffer);
+extern uint32_t zigbee_encode_setApiMode(uint8_t* buffer, uint32_t size, uint8_t frameID, uint8_t apiMode);
+extern uint32_t zigbee_encode_getApiMode(uint8_t* buffer, uint32_t size, uint8_t frameID);
+
 extern uint32_t zigbee_encode_transmitRequest(uint8_t* buffer, uint32_t sizeBuffer, uint8_t frameID,
     zigbee_64bDestAddr* destAddr64b, uint16_t destAddr16b, uint8_t* payload, uint8_t size);
 
 typedef enum
 {
   ZIGBEE_API_AT_CMD           = 0x08,
+  ZIGBEE_API_AT_QUEUE_CMD     = 0x09,
   ZIGBEE_API_TRANSMIT_REQUEST = 0x10,
   ZIGBEE_AT_COMMAND_RESPONSE  = 0x88,
   ZIGBEE_MODEM_STATUS         = 0x8A,
@@ -95,6 +134,18 @@ typedef enum
 
 #define ZIGBEE_UNKNOWN_16B_ADDR    (0xFFFE)
 
+typedef enum
+{
+  ZIGBEE_MODEM_HW_RESET            = 0x00,
+  ZIGBEE_MODEM_WATCHDOG_RESET      = 0x01,
+  ZIGBEE_MODEM_JOINED              = 0x02,
+  ZIGBEE_MODEM_DISASSOCIATED       = 0x03,
+  ZIGBEE_MODEM_COORDINATOR_STARTED = 0x06,
+  ZIGBEE_MODEM_KEY_UPDATED         = 0x07,
+  ZIGBEE_MODEM_STACK_ERROR         = 0x80, //and above
+  ZIGBEE_MODEM_NONE                = 0xFF, //no status received yet
+} zigbee_modemStatus;
+
 typedef enum
 {
   ZIGBEE_OK = 0,
@@ -146,5 +197,33 @@ typedef struct
 
 extern bool zigbee_decodeHeader(uint8_t* frame, uint32_t size, uint16_t* sizeOfNextData);
 extern bool zigbee_decodeFrame(uint8_t* frame, uint16_t frameSize, zigbee_decodedFrame* decodedFrame);
+extern uint8_t zigbee_doChecksum(uint8_t* frame, uint32_t size);
+
+/**
+ * Incremental API frame parser.
+ * Bytes are pushed in chunks of any size (ring buffer), complete frames are
+ * extracted one by one. On length or checksum error the parser drops the start
+ * delimiter and hunts for the next 0x7E, so a stray byte only costs one frame.
+ * In API mode 2 the buffer holds the escaped stream, frames are unescaped when
+ * they are extracted: a raw 0x7E is then always a start of frame.
+ */
+typedef struct
+{
+  uint8_t buffer[ZIGBEE_PARSER_BUFFER_SIZE];
+  uint32_t indexRead;
+  uint32_t nbBytes;
+  bool bEscaped; //API mode 2
+  uint32_t nbChecksumErrors;
+  uint32_t nbLengthErrors;
+  uint32_t nbDiscardedBytes;
+} zigbee_parser;
+
+extern void     zigbee_parser_init(zigbee_parser* parser);
+extern void     zigbee_parser_flush(zigbee_parser* parser);
+extern void     zigbee_parser_setEscaped(zigbee_parser* parser, bool bEscaped);
+extern uint32_t zigbee_parser_getFreeSize(zigbee_parser* parser);
+extern uint32_t zigbee_parser_push(zigbee_parser* parser, uint8_t* data, uint32_t size);
+extern bool     zigbee_parser_getFrame(zigbee_parser* parser, uint8_t* frame, uint32_t sizeBuffer,
+                                       uint16_t* frameSize);
 
 #endif /* ZIGBEE_H */
@@ -9,20 +9,66 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <syslog.h>
+#include <string.h>
+#include "monotonic.h"
+#include "latency.h"
+#include "probes.h"
+#include "unused.h"
+
+#define ZIGBEE_RX_CHUNK_SIZE          (256)
+#define ZIGBEE_BATCH_MAX_SIZE         (24)
+
+//most likely first: factory default, then the speeds set by this controller
+static const uint32_t zigbee_baudRates[] =
+{
+  9600, 115200, 57600, 38400, 19200, 230400, 460800, 921600, 4800, 2400, 1200
+};
+#define ZIGBEE_NB_BAUDRATES           (sizeof(zigbee_baudRates) / sizeof(zigbee_baudRates[0]))
+#define ZIGBEE_RX_FRAME_TIMEOUT_NS    (500 * MONOTONIC_NS_PER_MS) //max time between two bytes of the same frame
+
+typedef struct zigbee_batch_s zigbee_batch;
+
+typedef struct
+{
+  zigbee_batch* batch;
+  zigbee_atResult result;
+} zigbee_batchEntry;
+
+struct zigbee_batch_s
+{
+  zigbee_batchEntry entries[ZIGBEE_BATCH_MAX_SIZE];
+  uint32_t nbEntries;
+  uint32_t nbPending;
+  uint32_t timeout; //in ms, for each command
+};
 
 static void zigbee_handleTx(zigbee_obj* zb);
 static zb_handle_status zigbee_handleRx(zigbee_obj* zb);
 
-static void      zigbee_protocol_incrementFrameID(zigbee_obj* obj);
-static zb_status zigbee_protocol_setPanID(zigbee_obj* obj, zigbee_panID* panID);
-static zb_status zigbee_protocol_setScanChannelBitmask(zigbee_obj* obj, uint16_t chanBitmask);
-static zb_status zigbee_protocol_setScanDurationExponent(zigbee_obj* obj, uint8_t duration);
-static zb_status zigbee_protocol_setStackProfile(zigbee_obj* obj, uint8_t stackProfile);
-static zb_status zigbee_protocol_disableEncryption(zigbee_obj* obj);
-static zb_status zigbee_protocol_enableEncryption(zigbee_obj* obj, zigbee_encryptionKey* encryptKey,
-    zigbee_linkKey* linkKey);
-static bool      zigbee_protocol_waitAndcheckReply(uint32_t fd, uint8_t* receivedFrame, uint32_t sizeBuffer,
-    zigbee_decodedFrame* decodedData);
+static zigbee_atResult* zigbee_protocol_batchSubmit(zigbee_obj* obj, zigbee_batch* batch, uint8_t* frame,
+    uint32_t size, bool bQueued);
+static zb_status zigbee_protocol_batchWait(zigbee_obj* obj, zigbee_batch* batch);
+static void      zigbee_protocol_batchHwInfo(zigbee_obj* obj, zigbee_batch* batch, zigbee_atResult* results[4]);
+static void      zigbee_protocol_decodeHwInfo(zigbee_atResult* results[4], zigbee_hwInfo* hwInfo);
+static bool      zigbee_protocol_resultToValue(zigbee_atResult* result, uint64_t* value);
+static bool      zigbee_protocol_resultEquals(zigbee_atResult* result, uint64_t expected, const char* name);
+static void      zigbee_protocol_onBatchCompleted(zigbee_obj* obj, zb_status status,
+    zigbee_atCommandResponse* response, void* userData);
+static bool      zigbee_protocol_dispatchFrames(zigbee_obj* zb, zb_handle_status* status);
+static bool      zigbee_protocol_waitAndRead(zigbee_obj* zb);
+static bool      zigbee_protocol_readInput(zigbee_obj* zb);
+static zb_status zigbee_protocol_queueFrame(zigbee_obj* obj, uint8_t* frame, uint32_t size);
+static void      zigbee_protocol_completeAT(zigbee_obj* zb, zigbee_atCommandResponse* response);
+static bool      zigbee_protocol_isClearToSend(zigbee_obj* zb);
+static void      zigbee_protocol_consumeTxBytes(zigbee_obj* zb, uint32_t nbBytes);
+static void      zigbee_protocol_releaseTxFrames(zigbee_obj* zb, uint32_t nbFrames, bool bSent);
+static bool      zigbee_protocol_tryBaudRate(zigbee_obj* obj, uint32_t baudRate);
+static bool      zigbee_protocol_isBaudRateIn(uint32_t baudRate, const uint32_t* list, uint32_t nbItems);
+static zb_status zigbee_protocol_executeATWithTimeout(zigbee_obj* obj, uint8_t* frame, uint32_t size,
+    uint32_t timeout, zigbee_atResult* result);
+static void      zigbee_protocol_onExecuteATCompleted(zigbee_obj* obj, zb_status status,
+    zigbee_atCommandResponse* response, void* userData);
+static uint64_t  zigbee_protocol_getNextATDeadline(zigbee_obj* zb);
 static uint32_t  zigbee_protocol_getAssociationIndication(zigbee_obj* obj, uint8_t* associationIndication);
 
 zb_handle_status zigbee_handle(zigbee_obj* zigbee)
@@ -30,124 +76,622 @@ zb_handle_status zigbee_handle(zigbee_obj* zigbee)
   zb_handle_status status;
   zigbee_handleTx(zigbee);
   status = zigbee_handleRx(zigbee);
-  zigbee->atReplyExpected = false;
+  zigbee_handleTimeout(zigbee);
   return status;
 }
 
 void zigbee_handleTx(zigbee_obj* zb)
 {
-  if (zb->sizeOfFrameToSend != 0)
+  struct iovec iov[ZIGBEE_TX_QUEUE_SIZE];
+  zigbee_txFrame* txFrame;
+  uint32_t nbIov;
+  uint32_t index;
+  uint32_t sizeToWrite;
+  int32_t nbWritten;
+
+  //every queued frame goes out in one call, independently of the reception
+  while (zb->txQueue.nbItems > 0)
   {
-    serial_write(zb->fd, zb->frame, zb->sizeOfFrameToSend);
-    display_frame("sent", zb->frame, zb->sizeOfFrameToSend);
+    if ((zb->bFlowControl == true) && (zigbee_protocol_isClearToSend(zb) == false))
+    {
+      break;
+    }
+
+    index = zb->txQueue.indexRead;
+    sizeToWrite = 0;
+    for (nbIov = 0; nbIov < zb->txQueue.nbItems; nbIov++)
+    {
+      txFrame = &zb->txQueue.frames[index];
+      iov[nbIov].iov_base = txFrame->data;
+      iov[nbIov].iov_len = txFrame->size;
+      sizeToWrite += txFrame->size;
+      index = (index + 1) % ZIGBEE_TX_QUEUE_SIZE;
+    }
+    iov[0].iov_base = &zb->txQueue.frames[zb->txQueue.indexRead].data[zb->txQueue.offset];
+    iov[0].iov_len -= zb->txQueue.offset;
+    sizeToWrite -= zb->txQueue.offset;
+
+    nbWritten = serial_writevAvailable(zb->fd, iov, nbIov);
+    if (nbWritten == 0)
+    {
+      //line busy, resumed on the next writability event
+      zb->txStats.nbWouldBlock++;
+      break;
+    }
+
+    if (nbWritten < 0)
+    {
+      //the line is broken, the frames are lost
+      syslog(LOG_ERR, "%d frames not sent", zb->txQueue.nbItems);
+      zigbee_protocol_releaseTxFrames(zb, zb->txQueue.nbItems, false);
+      break;
+    }
+
+    zb->txStats.nbWrites++;
+    if ((uint32_t) nbWritten < sizeToWrite)
+    {
+      zb->txStats.nbPartialWrites++;
+    }
+    zigbee_protocol_consumeTxBytes(zb, nbWritten);
   }
-  zb->sizeOfFrameToSend = 0;
 }
 
-zb_handle_status zigbee_handleRx(zigbee_obj* zb)
+///frames fully written leave the queue, the offset tracks the one partially written
+static void zigbee_protocol_consumeTxBytes(zigbee_obj* zb, uint32_t nbBytes)
 {
-  zb_handle_status status;
-  bool bReplyCorrectyReceived;
-  bool bContinue;
+  zigbee_txFrame* txFrame;
+  uint32_t remaining;
 
-  status = ZB_NO_REPLY;
-  do
+  while ((nbBytes > 0) && (zb->txQueue.nbItems > 0))
   {
-    bContinue = false;
-    bReplyCorrectyReceived = zigbee_protocol_waitAndcheckReply(zb->fd, zb->frame, zb->frameSize, &zb->decodedData);
-    if (bReplyCorrectyReceived)
+    txFrame = &zb->txQueue.frames[zb->txQueue.indexRead];
+    remaining = txFrame->size - zb->txQueue.offset;
+    if (nbBytes < remaining)
     {
-      display_decodedType(&zb->decodedData);
-      switch (zb->decodedData.type)
-      {
-        case ZIGBEE_AT_COMMAND_RESPONSE:
-          if ((zb->atReplyExpected == true) && (zb->decodedData.atCmd.frameID == zb->frameID))
-          {
-            status = ZB_AT_REPLY_RECEIVED;
-          }
-          break;
-
-        case ZIGBEE_MODEM_STATUS:
-          zb->modemStatus = zb->decodedData.modemStatus;
-          break;
-
-        case ZIGBEE_TRANSMIT_STATUS:
-          break;
-
-        case ZIGBEE_RECEIVE_PACKET:
-          status = ZB_RX_FRAME_RECEIVED;
-          if (zb->onDataFrameReception != NULL)
-          {
-            zb->onDataFrameReception(zb, &zb->decodedData);
-          }
-          break;
-
-        default:
-          syslog(LOG_WARNING, "unknow frame received (type = %x)", zb->decodedData.type);
-          break;
-      }
-      if ((zb->atReplyExpected == true) && (status != ZB_AT_REPLY_RECEIVED))
-      {
-        bContinue = true;
-      }
+      zb->txQueue.offset += nbBytes;
+      break;
+    }
+
+    nbBytes -= remaining;
+    zigbee_protocol_releaseTxFrames(zb, 1, true);
+  }
+}
+
+static void zigbee_protocol_releaseTxFrames(zigbee_obj* zb, uint32_t nbFrames, bool bSent)
+{
+  zigbee_txFrame* txFrame;
+
+  while ((nbFrames > 0) && (zb->txQueue.nbItems > 0))
+  {
+    txFrame = &zb->txQueue.frames[zb->txQueue.indexRead];
+    if (bSent == true)
+    {
+      zb->txStats.nbFrames++;
+      ZB_PROBE3(frame_tx, txFrame->apiID, txFrame->frameID, txFrame->size);
+      display_frame("sent", txFrame->data, txFrame->size);
+    }
+
+    zb->txQueue.offset = 0;
+    zb->txQueue.nbItems--;
+    zb->txQueue.indexRead++;
+    if (zb->txQueue.indexRead >= ZIGBEE_TX_QUEUE_SIZE)
+    {
+      zb->txQueue.indexRead = 0;
+    }
+    nbFrames--;
+  }
+}
+
+static bool zigbee_protocol_isClearToSend(zigbee_obj* zb)
+{
+  uint64_t now;
+
+  now = monotonic_getTimeNs();
+  if (serial_getCTS(zb->fd) != 0)
+  {
+    zb->ctsRetryDeadline = 0;
+    if (zb->txStats.stallStart != 0)
+    {
+      zb->txStats.stallTime += now - zb->txStats.stallStart;
+      zb->txStats.stallStart = 0;
+    }
+    return true;
+  }
+
+  //the queue is paused, CTS is checked again at the retry deadline
+  if (zb->txStats.stallStart == 0)
+  {
+    zb->txStats.stallStart = now;
+    zb->txStats.nbStalls++;
+  }
+  zb->ctsRetryDeadline = now + ZIGBEE_CTS_RETRY_PERIOD * MONOTONIC_NS_PER_MS;
+  return false;
+}
+
+void zigbee_handleOutput(zigbee_obj* zb)
+{
+  zigbee_handleTx(zb);
+}
+
+bool zigbee_hasPendingOutput(zigbee_obj* zb)
+{
+  //while paused by CTS, writability means nothing
+  return ((zb->txQueue.nbItems > 0) && (zb->ctsRetryDeadline == 0));
+}
+
+void zigbee_protocol_setFlowControl(zigbee_obj* obj, bool bFlowControl)
+{
+  assert(obj != NULL);
+  obj->bFlowControl = bFlowControl;
+}
+
+void zigbee_protocol_setApiMode(zigbee_obj* obj, uint8_t apiMode)
+{
+  assert(obj != NULL);
+  obj->apiMode = apiMode;
+  zigbee_parser_setEscaped(&obj->parser, (apiMode == ZIGBEE_API_MODE_ESCAPED));
+}
+
+void zigbee_protocol_setCapture(zigbee_obj* obj, capture_ring* capture)
+{
+  assert(obj != NULL);
+  obj->capture = capture;
+}
+
+static zb_status zigbee_protocol_queueFrame(zigbee_obj* obj, uint8_t* frame, uint32_t size)
+{
+  zb_status status;
+  zigbee_txFrame* txFrame;
+
+  status = ZB_CMD_FAILED;
+  if ((size == 0) || (size > ZIGBEE_TX_FRAME_SIZE))
+  {
+    syslog(LOG_ERR, "unable to queue frame, invalid size (%d)", size);
+  }
+  else if (obj->txQueue.nbItems >= ZIGBEE_TX_QUEUE_SIZE)
+  {
+    syslog(LOG_ERR, "unable to queue frame, tx queue full");
+  }
+  else
+  {
+    //captured unescaped, when queued
+    capture_frame(obj->capture, CAPTURE_DIR_TX, frame, size);
+
+    txFrame = &obj->txQueue.frames[obj->txQueue.indexWrite];
+    txFrame->apiID = (size > ZIGBEE_HEADER_SIZE) ? frame[ZIGBEE_HEADER_SIZE] : 0;
+    txFrame->frameID = (size > (ZIGBEE_HEADER_SIZE + 1)) ? frame[ZIGBEE_HEADER_SIZE + 1] : 0;
+    obj->txStats.nbQueued[txFrame->apiID]++;
+    if (obj->apiMode == ZIGBEE_API_MODE_ESCAPED)
+    {
+      //escaped once here, the writer only sees bytes
+      txFrame->size = zigbee_escapeFrame(frame, size, txFrame->data, sizeof(txFrame->data));
     }
     else
     {
-      bContinue = false;
+      memcpy(txFrame->data, frame, size);
+      txFrame->size = size;
+    }
+
+    obj->txQueue.nbItems++;
+    obj->txQueue.indexWrite++;
+    if (obj->txQueue.indexWrite >= ZIGBEE_TX_QUEUE_SIZE)
+    {
+      obj->txQueue.indexWrite = 0;
     }
+    status = ZB_CMD_SUCCESS;
   }
-  while (bContinue == true);
 
   return status;
 }
 
-static bool zigbee_protocol_waitAndcheckReply(uint32_t fd, uint8_t* receivedFrame, uint32_t sizeBuffer,
-    zigbee_decodedFrame* decodedData)
+uint8_t zigbee_protocol_nextFrameID(zigbee_obj* obj)
 {
-  fd_set rfs;
-  struct timeval waitTime;
-  bool bSuccess;
-  uint16_t nextSizeToRead;
-  FD_ZERO(&rfs);
-  FD_SET(fd, &rfs);
-  waitTime.tv_sec = 2;
-  waitTime.tv_usec = 0;
-  bSuccess = false;
-  nextSizeToRead = 0;
+  bool bInUse;
+  uint32_t i;
 
-  if (select(fd + 1, &rfs, NULL, NULL, &waitTime) > 0)
+  //0 means no reply, and an ID still in flight can't be reused
+  do
   {
-    if (FD_ISSET(fd, &rfs))
+    obj->frameID++;
+    bInUse = (obj->frameID == 0);
+    for (i = 0; (i < ZIGBEE_AT_MAX_PENDING) && (bInUse == false); i++)
     {
-      bSuccess = serial_read(fd, receivedFrame, 3);
-      if (bSuccess)
+      if ((obj->atRequests[i].bUsed == true) && (obj->atRequests[i].frameID == obj->frameID))
       {
-        bSuccess = zigbee_decodeHeader(receivedFrame, 3, &nextSizeToRead);
+        bInUse = true;
       }
+    }
+  }
+  while (bInUse == true);
 
-      if (bSuccess && ((uint16_t)(3 + nextSizeToRead + 1) <= sizeBuffer))
+  return obj->frameID;
+}
+
+zb_status zigbee_protocol_submitAT(zigbee_obj* obj, uint8_t* frame, uint32_t size, uint32_t timeout,
+                                   zigbee_atCallBack onComplete, void* userData)
+{
+  zigbee_atRequest* request;
+  zb_status status;
+  uint32_t i;
+
+  assert(obj != NULL);
+  assert(frame != NULL);
+  status = ZB_CMD_FAILED;
+  request = NULL;
+
+  if (size < (ZIGBEE_HEADER_SIZE + 4))
+  {
+    syslog(LOG_ERR, "AT command not submitted, invalid frame (size = %d)", size);
+    return status;
+  }
+
+  for (i = 0; i < ZIGBEE_AT_MAX_PENDING; i++)
+  {
+    if (obj->atRequests[i].bUsed == false)
+    {
+      request = &obj->atRequests[i];
+      break;
+    }
+  }
+
+  if (request == NULL)
+  {
+    syslog(LOG_ERR, "AT command not submitted, too many commands in flight");
+    return status;
+  }
+
+  status = zigbee_protocol_queueFrame(obj, frame, size);
+  if (status == ZB_CMD_SUCCESS)
+  {
+    //frame is 0x7E, size(2), API type, frame ID, AT command(2), parameters...
+    request->bUsed = true;
+    request->frameID = frame[ZIGBEE_HEADER_SIZE + 1];
+    request->ATcmd[0] = frame[ZIGBEE_HEADER_SIZE + 2];
+    request->ATcmd[1] = frame[ZIGBEE_HEADER_SIZE + 3];
+    request->deadline = monotonic_getTimeNs() + ((uint64_t) timeout) * MONOTONIC_NS_PER_MS;
+    request->onComplete = onComplete;
+    request->userData = userData;
+    obj->nbAtPending++;
+    ZB_PROBE3(at_submit, request->frameID, request->ATcmd[0], request->ATcmd[1]);
+  }
+
+  return status;
+}
+
+zb_status zigbee_protocol_executeAT(zigbee_obj* obj, uint8_t* frame, uint32_t size, zigbee_atResult* result)
+{
+  return zigbee_protocol_executeATWithTimeout(obj, frame, size, ZIGBEE_AT_DEFAULT_TIMEOUT, result);
+}
+
+static zb_status zigbee_protocol_executeATWithTimeout(zigbee_obj* obj, uint8_t* frame, uint32_t size,
+    uint32_t timeout, zigbee_atResult* result)
+{
+  assert(result != NULL);
+  result->bDone = false;
+  result->status = ZB_CMD_FAILED;
+  result->size = 0;
+
+  if (zigbee_protocol_submitAT(obj, frame, size, timeout,
+                               zigbee_protocol_onExecuteATCompleted, result) == ZB_CMD_SUCCESS)
+  {
+    //each request has a deadline, the loop always ends
+    while (result->bDone == false)
+    {
+      zigbee_handle(obj);
+    }
+  }
+
+  return result->status;
+}
+
+static void zigbee_protocol_onExecuteATCompleted(zigbee_obj* obj, zb_status status,
+    zigbee_atCommandResponse* response, void* userData)
+{
+  zigbee_atResult* result;
+  UNUSED(obj);
+
+  result = (zigbee_atResult*) userData;
+  result->status = status;
+  result->size = 0;
+  if ((response != NULL) && (response->data != NULL))
+  {
+    result->size = response->size;
+    if (result->size > ZIGBEE_AT_MAX_DATA_SIZE)
+    {
+      result->size = ZIGBEE_AT_MAX_DATA_SIZE;
+    }
+    memcpy(result->data, response->data, result->size);
+  }
+  result->bDone = true;
+}
+
+static void zigbee_protocol_completeAT(zigbee_obj* zb, zigbee_atCommandResponse* response)
+{
+  zigbee_atRequest request;
+  zb_status status;
+  uint32_t i;
+
+  for (i = 0; i < ZIGBEE_AT_MAX_PENDING; i++)
+  {
+    if ((zb->atRequests[i].bUsed == true) && (zb->atRequests[i].frameID == response->frameID))
+    {
+      //release the slot before the callback, it may submit a new command
+      request = zb->atRequests[i];
+      zb->atRequests[i].bUsed = false;
+      zb->nbAtPending--;
+
+      if (response->status == ZIGBEE_OK)
       {
-        bSuccess = serial_read(fd, &receivedFrame[3], nextSizeToRead + 1);
+        status = ZB_CMD_SUCCESS;
       }
       else
       {
-        bSuccess = false;
+        status = ZB_CMD_FAILED;
+        syslog(LOG_WARNING, "AT%c%c failed (status = %d)", request.ATcmd[0], request.ATcmd[1], response->status);
       }
+      ZB_PROBE4(at_complete, request.frameID, request.ATcmd[0], request.ATcmd[1], status);
 
-      if (bSuccess)
+      if (request.onComplete != NULL)
       {
-        bSuccess = zigbee_decodeFrame(&receivedFrame[3], nextSizeToRead + 1, decodedData);
-        if (bSuccess == true)
+        request.onComplete(zb, status, response, request.userData);
+      }
+      return;
+    }
+  }
+
+  syslog(LOG_DEBUG, "unexpected AT%c%c reply (frame ID = %d)", response->ATcmd[0], response->ATcmd[1],
+         response->frameID);
+}
+
+static uint64_t zigbee_protocol_getNextATDeadline(zigbee_obj* zb)
+{
+  uint64_t deadline;
+  uint32_t i;
+
+  deadline = 0;
+  for (i = 0; (i < ZIGBEE_AT_MAX_PENDING) && (zb->nbAtPending > 0); i++)
+  {
+    if ((zb->atRequests[i].bUsed == true) && ((deadline == 0) || (zb->atRequests[i].deadline < deadline)))
+    {
+      deadline = zb->atRequests[i].deadline;
+    }
+  }
+
+  return deadline;
+}
+
+zb_handle_status zigbee_handleRx(zigbee_obj* zb)
+{
+  zb_handle_status status;
+  bool bFrameReceived;
+
+  status = ZB_NO_REPLY;
+  bFrameReceived = zigbee_protocol_dispatchFrames(zb, &status);
+
+  //wait for more data only when nothing was already buffered
+  if ((bFrameReceived == false) && (zigbee_protocol_waitAndRead(zb) == true))
+  {
+    zigbee_protocol_dispatchFrames(zb, &status);
+  }
+
+  return status;
+}
+
+static bool zigbee_protocol_dispatchFrames(zigbee_obj* zb, zb_handle_status* status)
+{
+  bool bFrameDispatched;
+  uint16_t frameSize;
+
+  bFrameDispatched = false;
+
+  while (zigbee_parser_getFrame(&zb->parser, zb->frame, zb->frameSize, &frameSize) == true)
+  {
+    bFrameDispatched = true;
+    latency_markAt(LATENCY_FIRST_BYTE, zb->rxFrameStart);
+    //the bytes left in the parser came with the last read at the latest
+    zb->rxFrameStart = zb->lastRxTime;
+
+    capture_frame(zb->capture, CAPTURE_DIR_RX, zb->frame, frameSize);
+    zb->rxStats.nbFrames[zb->frame[ZIGBEE_HEADER_SIZE]]++;
+    ZB_PROBE2(frame_rx, zb->frame[ZIGBEE_HEADER_SIZE], frameSize);
+    if (zigbee_decodeFrame(&zb->frame[ZIGBEE_HEADER_SIZE], frameSize - ZIGBEE_HEADER_SIZE, &zb->decodedData) == false)
+    {
+      zb->rxStats.nbDecodeErrors++;
+      display_frame("received (ko)", zb->frame, frameSize);
+      continue;
+    }
+    latency_mark(LATENCY_DECODED);
+
+    display_frame("received (ok)", zb->frame, frameSize);
+    display_decodedType(&zb->decodedData);
+    switch (zb->decodedData.type)
+    {
+      case ZIGBEE_AT_COMMAND_RESPONSE:
+        *status = ZB_AT_REPLY_RECEIVED;
+        zigbee_protocol_completeAT(zb, &zb->decodedData.atCmd);
+        break;
+
+      case ZIGBEE_MODEM_STATUS:
+        zb->modemStatus = zb->decodedData.modemStatus;
+        zb->nbModemStatus++;
+        syslog(LOG_INFO, "modem status 0x%x: %s", zb->modemStatus, zigbee_get_modemStatus(zb->modemStatus));
+        break;
+
+      case ZIGBEE_TRANSMIT_STATUS:
+        break;
+
+      case ZIGBEE_RECEIVE_PACKET:
+        if (*status == ZB_NO_REPLY)
         {
-          display_frame("received (ok)", receivedFrame, nextSizeToRead + 1 + 3);
+          *status = ZB_RX_FRAME_RECEIVED;
         }
-        else
+        if (zb->onDataFrameReception != NULL)
         {
-          display_frame("received (ko)", receivedFrame, nextSizeToRead + 1 + 3);
+          zb->onDataFrameReception(zb, &zb->decodedData);
         }
+        break;
+
+      default:
+        syslog(LOG_WARNING, "unknow frame received (type = %x)", zb->decodedData.type);
+        break;
+    }
+    latency_commit(zb->decodedData.type);
+  }
+
+  return bFrameDispatched;
+}
+
+zb_handle_status zigbee_handleInput(zigbee_obj* zb)
+{
+  zb_handle_status status;
+
+  status = ZB_NO_REPLY;
+  if (zigbee_protocol_readInput(zb) == true)
+  {
+    zigbee_protocol_dispatchFrames(zb, &status);
+  }
+
+  return status;
+}
+
+uint64_t zigbee_getNextTimeout(zigbee_obj* zb)
+{
+  uint64_t deadline;
+
+  deadline = zigbee_protocol_getNextATDeadline(zb);
+  if ((zb->resetDeadline != 0) && ((deadline == 0) || (zb->resetDeadline < deadline)))
+  {
+    deadline = zb->resetDeadline;
+  }
+
+  if ((zb->ctsRetryDeadline != 0) && ((deadline == 0) || (zb->ctsRetryDeadline < deadline)))
+  {
+    deadline = zb->ctsRetryDeadline;
+  }
+
+  if ((zb->parser.nbBytes != 0) &&
+      ((deadline == 0) || ((zb->lastRxTime + ZIGBEE_RX_FRAME_TIMEOUT_NS) < deadline)))
+  {
+    //a partial frame is waiting for its end
+    deadline = zb->lastRxTime + ZIGBEE_RX_FRAME_TIMEOUT_NS;
+  }
+
+  return deadline;
+}
+
+void zigbee_handleTimeout(zigbee_obj* zb)
+{
+  zigbee_atRequest request;
+  uint64_t now;
+  uint32_t i;
+
+  now = monotonic_getTimeNs();
+  if ((zb->ctsRetryDeadline != 0) && (now >= zb->ctsRetryDeadline))
+  {
+    //the queue is writable again, CTS is checked by the next transmission
+    zb->ctsRetryDeadline = 0;
+  }
+
+  if ((zb->parser.nbBytes != 0) && (now >= (zb->lastRxTime + ZIGBEE_RX_FRAME_TIMEOUT_NS)))
+  {
+    syslog(LOG_WARNING, "incomplete frame dropped (%d bytes)", zb->parser.nbBytes);
+    zb->rxStats.nbIncompleteFrames++;
+    zigbee_parser_flush(&zb->parser);
+  }
+
+  for (i = 0; (i < ZIGBEE_AT_MAX_PENDING) && (zb->nbAtPending > 0); i++)
+  {
+    if ((zb->atRequests[i].bUsed == true) && (now >= zb->atRequests[i].deadline))
+    {
+      request = zb->atRequests[i];
+      zb->atRequests[i].bUsed = false;
+      zb->nbAtPending--;
+      zb->rxStats.nbAtTimeouts++;
+      syslog(LOG_WARNING, "AT%c%c timeout (frame ID = %d)", request.ATcmd[0], request.ATcmd[1], request.frameID);
+      ZB_PROBE4(at_complete, request.frameID, request.ATcmd[0], request.ATcmd[1], ZB_CMD_TIMEOUT);
+      if (request.onComplete != NULL)
+      {
+        request.onComplete(zb, ZB_CMD_TIMEOUT, NULL, request.userData);
       }
     }
   }
+}
+
+static bool zigbee_protocol_readInput(zigbee_obj* zb)
+{
+  uint8_t chunk[ZIGBEE_RX_CHUNK_SIZE];
+  uint32_t sizeToRead;
+  int32_t nbRead;
+  bool bSuccess;
+
+  bSuccess = false;
+
+  //read everything available in one call, the parser splits it in frames
+  sizeToRead = zigbee_parser_getFreeSize(&zb->parser);
+  if (sizeToRead > ZIGBEE_RX_CHUNK_SIZE)
+  {
+    sizeToRead = ZIGBEE_RX_CHUNK_SIZE;
+  }
+
+  nbRead = serial_readAvailable(zb->fd, chunk, sizeToRead);
+  if (nbRead > 0)
+  {
+    zb->lastRxTime = monotonic_getTimeNs();
+    if (zb->parser.nbBytes == 0)
+    {
+      zb->rxFrameStart = zb->lastRxTime;
+    }
+    zigbee_parser_push(&zb->parser, chunk, nbRead);
+    bSuccess = true;
+  }
+
+  return bSuccess;
+}
+
+static bool zigbee_protocol_waitAndRead(zigbee_obj* zb)
+{
+  fd_set rfs;
+  fd_set wfs;
+  struct timeval waitTime;
+  uint64_t deadline;
+  uint64_t now;
+  bool bSuccess;
+
+  FD_ZERO(&rfs);
+  FD_SET(zb->fd, &rfs);
+  FD_ZERO(&wfs);
+  if (zigbee_hasPendingOutput(zb) == true)
+  {
+    //the end of a partial write must not wait for the next frame reception
+    FD_SET(zb->fd, &wfs);
+  }
+  waitTime.tv_sec = 2;
+  waitTime.tv_usec = 0;
+  bSuccess = false;
+
+  //do not sleep past the next protocol deadline
+  deadline = zigbee_getNextTimeout(zb);
+  if (deadline != 0)
+  {
+    now = monotonic_getTimeNs();
+    if (deadline <= now)
+    {
+      waitTime.tv_sec = 0;
+    }
+    else if ((deadline - now) < (2 * MONOTONIC_NS_PER_S))
+    {
+      waitTime.tv_sec = (deadline - now) / MONOTONIC_NS_PER_S;
+      waitTime.tv_usec = ((deadline - now) % MONOTONIC_NS_PER_S) / 1000;
+    }
+  }
+
+  if (select(zb->fd + 1, &rfs, &wfs, NULL, &waitTime) > 0)
+  {
+    if (FD_ISSET(zb->fd, &rfs))
+    {
+      bSuccess = zigbee_protocol_readInput(zb);
+    }
+  }
   else
   {
 #ifdef TRACE_ACTIVATED
@@ -156,189 +700,556 @@ static bool zigbee_protocol_waitAndcheckReply(uint32_t fd, uint8_t* receivedFram
   }
 
 #ifdef TRACE_ACTIVATED
-  fprintf(stdout, "bSuccess = %d nextSizeToRead = %d\n", bSuccess, nextSizeToRead);
+  fprintf(stdout, "bSuccess = %d pending bytes = %d\n", bSuccess, zb->parser.nbBytes);
 #endif // TRACE_ACTIVATED
 
   return bSuccess;
 }
 
-void zigbee_protocol_initialize(zigbee_obj* obj, uint32_t fd, uint8_t* buffer, uint32_t bufferSize,
+void zigbee_protocol_initialize(zigbee_obj* obj, uint32_t fd, uint32_t baudRate, uint8_t* buffer,
+                                uint32_t bufferSize,
                                 void (*onDataCallBack)(struct zigbee_obj_s* obj, zigbee_decodedFrame* frame))
 {
   assert(obj != NULL);
   obj->fd = fd;
+  obj->baudRate = baudRate;
+  obj->apiMode = ZIGBEE_API_MODE_UNESCAPED;
   obj->frameID = 1;
   obj->frameSize = bufferSize;
   obj->frame = buffer;
-  obj->sizeOfFrameToSend = 0; // 0 when no data are to be sent
-  obj->modemStatus = 0;//TODO
-  obj->atReplyExpected = false;
+  obj->txQueue.indexRead = 0;
+  obj->txQueue.indexWrite = 0;
+  obj->txQueue.nbItems = 0;
+  obj->txQueue.offset = 0;
+  memset(&obj->txStats, 0, sizeof(zigbee_txStats));
+  memset(&obj->rxStats, 0, sizeof(zigbee_rxStats));
+  obj->bFlowControl = false;
+  obj->ctsRetryDeadline = 0;
+  obj->modemStatus = ZIGBEE_MODEM_NONE;
+  obj->nbModemStatus = 0;
+  obj->nbModemStatusAtReset = 0;
+  obj->resetDeadline = 0;
+  obj->capture = NULL;
+  for (uint32_t i = 0; i < ZIGBEE_AT_MAX_PENDING; i++)
+  {
+    obj->atRequests[i].bUsed = false;
+  }
+  obj->nbAtPending = 0;
   obj->onDataFrameReception = onDataCallBack;
+  zigbee_parser_init(&obj->parser);
+  obj->lastRxTime = 0;
+  obj->rxFrameStart = 0;
+}
+
+zb_status zigbee_protocol_retrieveHwVersion(zigbee_obj* obj, uint16_t* hwVersion)
+{
+  uint8_t txFrame[ZIGBEE_TX_FRAME_SIZE];
+  zigbee_atResult result;
+  uint32_t size;
+  zb_status status;
+
+  assert(obj != NULL);
+  assert(hwVersion != NULL);
+  status = ZB_CMD_FAILED;
+
+  size = zigbee_encode_getHardwareVersion(txFrame, sizeof(txFrame), zigbee_protocol_nextFrameID(obj));
+  if ((zigbee_protocol_executeAT(obj, txFrame, size, &result) == ZB_CMD_SUCCESS) &&
+      (result.size == 2))
+  {
+    *hwVersion = ((uint16_t) result.data[0]) << 8 | result.data[1];
+    status = ZB_CMD_SUCCESS;
+  }
+
+  return status;
+}
+
+zb_status zigbee_protocol_retrieveFwVersion(zigbee_obj* obj, uint16_t* fwVersion)
+{
+  uint8_t txFrame[ZIGBEE_TX_FRAME_SIZE];
+  zigbee_atResult result;
+  uint32_t size;
+  zb_status status;
+
+  assert(obj != NULL);
+  assert(fwVersion != NULL);
+  status = ZB_CMD_FAILED;
+
+  size = zigbee_encode_getFirmwareVersion(txFrame, sizeof(txFrame), zigbee_protocol_nextFrameID(obj));
+  if ((zigbee_protocol_executeAT(obj, txFrame, size, &result) == ZB_CMD_SUCCESS) &&
+      (result.size == 2))
+  {
+    *fwVersion = ((uint16_t) result.data[0]) << 8 | result.data[1];
+    //fprintf(stdout, "firwmare version = %.2x\n", firmwareVersion);
+    status = ZB_CMD_SUCCESS;
+  }
+
+  return status;
+}
+
+
+zb_status zigbee_protocol_retrieveSerial(zigbee_obj* obj, uint32_t* serialLow, uint32_t* serialHigh)
+{
+  uint8_t txFrame[ZIGBEE_TX_FRAME_SIZE];
+  zigbee_atResult result;
+  uint32_t size;
+  zb_status status;
+
+  assert(obj != NULL);
+  assert(serialLow != NULL);
+  assert(serialHigh != NULL);
+  status = ZB_CMD_FAILED;
+
+  size = zigbee_encode_getSerialNumberHigh(txFrame, sizeof(txFrame), zigbee_protocol_nextFrameID(obj));
+  if ((zigbee_protocol_executeAT(obj, txFrame, size, &result) == ZB_CMD_SUCCESS) &&
+      (result.size == 4))
+  {
+    *serialHigh =      ((uint32_t) result.data[0]) << 24 |
+                       ((uint32_t) result.data[1]) << 16 |
+                       ((uint32_t) result.data[2]) << 8  |
+                       result.data[3];
+    //    fprintf(stdout, "serial high = %.4x\n", serialHigh);
+  }
+
+  size = zigbee_encode_getSerialNumberLow(txFrame, sizeof(txFrame), zigbee_protocol_nextFrameID(obj));
+  if ((zigbee_protocol_executeAT(obj, txFrame, size, &result) == ZB_CMD_SUCCESS) &&
+      (result.size == 4))
+  {
+    *serialLow =       ((uint32_t) result.data[0]) << 24 |
+                       ((uint32_t) result.data[1]) << 16 |
+                       ((uint32_t) result.data[2]) << 8  |
+                       result.data[3];
+    //    fprintf(stdout, "serial low = %.4x\n", serialLow);
+    status = ZB_CMD_SUCCESS;
+  }
+  return status;
+}
+
+
+zb_status zigbee_protocol_configure(zigbee_obj* obj, zigbee_config* config, zigbee_hwInfo* hwInfo)
+{
+  uint8_t txFrame[ZIGBEE_TX_FRAME_SIZE];
+  zigbee_batch batch;
+  zigbee_atResult* hwResults[4];
+  zb_status status;
+  uint64_t startTime;
+  uint32_t size;
+
+  assert(obj != NULL);
+  assert(config != NULL);
+
+  //baudrate can't be pipelined, the local serial speed changes with the reply
+  status = zigbee_protocol_negotiateBaudRate(obj, config->baudRate);
+  if (status != ZB_CMD_SUCCESS)
+  {
+    return status;
+  }
+
+  //the framing neither, the following replies depend on it
+  status = zigbee_protocol_negotiateApiMode(obj, config->apiMode);
+  if (status != ZB_CMD_SUCCESS)
+  {
+    return status;
+  }
+
+  //all parameters are queued (applied together by AC) and streamed without waiting for the replies
+  startTime = monotonic_getTimeNs();
+  batch.nbEntries = 0;
+  batch.nbPending = 0;
+  batch.timeout = ZIGBEE_AT_DEFAULT_TIMEOUT;
+
+  size = zigbee_encode_SetPanID(txFrame, sizeof(txFrame), zigbee_protocol_nextFrameID(obj), &config->panID);
+  zigbee_protocol_batchSubmit(obj, &batch, txFrame, size, true);
+
+  size = zigbee_encode_setScanChannelBitmask(txFrame, sizeof(txFrame), zigbee_protocol_nextFrameID(obj),
+         config->channelBitMask);
+  zigbee_protocol_batchSubmit(obj, &batch, txFrame, size, true);
+
+  size = zigbee_encode_setScanDurationExponent(txFrame, sizeof(txFrame), zigbee_protocol_nextFrameID(obj),
+         config->scanDuration);
+  zigbee_protocol_batchSubmit(obj, &batch, txFrame, size, true);
+
+  size = zigbee_encode_setStackProfile(txFrame, sizeof(txFrame), zigbee_protocol_nextFrameID(obj),
+                                       config->stackProfile);
+  zigbee_protocol_batchSubmit(obj, &batch, txFrame, size, true);
+
+  size = zigbee_encode_setEncryptionEnabled(txFrame, sizeof(txFrame), zigbee_protocol_nextFrameID(obj),
+         config->encryption);
+  zigbee_protocol_batchSubmit(obj, &batch, txFrame, size, true);
+
+  if (config->encryption == true)
+  {
+    size = zigbee_encode_setNetworkEncryptionKey(txFrame, sizeof(txFrame), zigbee_protocol_nextFrameID(obj),
+           &config->networkKey);
+    zigbee_protocol_batchSubmit(obj, &batch, txFrame, size, true);
+
+    size = zigbee_encode_setLinkKey(txFrame, sizeof(txFrame), zigbee_protocol_nextFrameID(obj), &config->linkKey);
+    zigbee_protocol_batchSubmit(obj, &batch, txFrame, size, true);
+  }
+
+  if (config->sleepPeriod != 0)
+  {
+    size = zigbee_encode_setSleepPeriod(txFrame, sizeof(txFrame), zigbee_protocol_nextFrameID(obj),
+                                        config->sleepPeriod);
+    zigbee_protocol_batchSubmit(obj, &batch, txFrame, size, true);
+  }
+
+  if (config->nbSleepPeriod != 0)
+  {
+    size = zigbee_encode_setNumberOfSleepPeriod(txFrame, sizeof(txFrame), zigbee_protocol_nextFrameID(obj),
+           config->nbSleepPeriod);
+    zigbee_protocol_batchSubmit(obj, &batch, txFrame, size, true);
+  }
+
+  if (config->nodeIdentifier != NULL)
+  {
+    size = zigbee_encode_SetNodeIdentifier(txFrame, sizeof(txFrame), zigbee_protocol_nextFrameID(obj),
+                                           config->nodeIdentifier);
+    zigbee_protocol_batchSubmit(obj, &batch, txFrame, size, true);
+  }
+
+  size = zigbee_encode_SetJoinTime(txFrame, sizeof(txFrame), zigbee_protocol_nextFrameID(obj), config->joinTime);
+  zigbee_protocol_batchSubmit(obj, &batch, txFrame, size, true);
+
+  if (config->rtscts == true)
+  {
+    size = zigbee_encode_D6(txFrame, sizeof(txFrame), zigbee_protocol_nextFrameID(obj), ZIGBEE_D6_RTS_FLOW_CONTROL);
+    zigbee_protocol_batchSubmit(obj, &batch, txFrame, size, true);
+
+    size = zigbee_encode_D7(txFrame, sizeof(txFrame), zigbee_protocol_nextFrameID(obj), ZIGBEE_D7_CTS_FLOW_CONTROL);
+    zigbee_protocol_batchSubmit(obj, &batch, txFrame, size, true);
+  }
+
+  size = zigbee_encode_applyChanges(txFrame, sizeof(txFrame), zigbee_protocol_nextFrameID(obj));
+  zigbee_protocol_batchSubmit(obj, &batch, txFrame, size, false);
+
+  if (config->writeData == true)
+  {
+    size = zigbee_encode_write(txFrame, sizeof(txFrame), zigbee_protocol_nextFrameID(obj));
+    zigbee_protocol_batchSubmit(obj, &batch, txFrame, size, false);
+  }
+
+  if (hwInfo != NULL)
+  {
+    zigbee_protocol_batchHwInfo(obj, &batch, hwResults);
+  }
+
+  status = zigbee_protocol_batchWait(obj, &batch);
+  syslog(LOG_INFO, "configuration batch of %d commands done in %llu ms (status = %d)", batch.nbEntries,
+         (unsigned long long) ((monotonic_getTimeNs() - startTime) / MONOTONIC_NS_PER_MS), status);
+
+  if (config->writeData == true)
+  {
+    syslog(LOG_INFO, "write data into ZB (status = %d)", status);
+  }
+
+  if (hwInfo != NULL)
+  {
+    zigbee_protocol_decodeHwInfo(hwResults, hwInfo);
+  }
+
+  return status;
 }
 
-static void zigbee_protocol_incrementFrameID(zigbee_obj* obj)
-{
-  obj->frameID++;
-  if (obj->frameID == 0)
+static zigbee_atResult* zigbee_protocol_batchSubmit(zigbee_obj* obj, zigbee_batch* batch, uint8_t* frame,
+    uint32_t size, bool bQueued)
+{
+  zigbee_batchEntry* entry;
+
+  assert(batch->nbEntries < ZIGBEE_BATCH_MAX_SIZE);
+  entry = &batch->entries[batch->nbEntries];
+  batch->nbEntries++;
+
+  entry->batch = batch;
+  entry->result.bDone = true;
+  entry->result.status = ZB_CMD_FAILED;
+  entry->result.size = 0;
+
+  if ((bQueued == true) && (zigbee_encode_toQueuedParameter(frame, size) == false))
+  {
+    return &entry->result;
+  }
+
+  //when the pipeline is full, let the oldest commands complete first
+  while ((obj->nbAtPending >= ZIGBEE_AT_MAX_PENDING) || (obj->txQueue.nbItems >= ZIGBEE_TX_QUEUE_SIZE))
+  {
+    zigbee_handle(obj);
+  }
+
+  entry->result.bDone = false;
+  if (zigbee_protocol_submitAT(obj, frame, size, batch->timeout,
+                               zigbee_protocol_onBatchCompleted, entry) == ZB_CMD_SUCCESS)
+  {
+    batch->nbPending++;
+  }
+  else
+  {
+    entry->result.bDone = true;
+  }
+
+  return &entry->result;
+}
+
+static zb_status zigbee_protocol_batchWait(zigbee_obj* obj, zigbee_batch* batch)
+{
+  zb_status status;
+  uint32_t i;
+
+  while (batch->nbPending > 0)
+  {
+    zigbee_handle(obj);
+  }
+
+  status = ZB_CMD_SUCCESS;
+  for (i = 0; i < batch->nbEntries; i++)
+  {
+    if (batch->entries[i].result.status != ZB_CMD_SUCCESS)
+    {
+      status = ZB_CMD_FAILED;
+    }
+  }
+
+  return status;
+}
+
+static void zigbee_protocol_onBatchCompleted(zigbee_obj* obj, zb_status status,
+    zigbee_atCommandResponse* response, void* userData)
+{
+  zigbee_batchEntry* entry;
+
+  entry = (zigbee_batchEntry*) userData;
+  zigbee_protocol_onExecuteATCompleted(obj, status, response, &entry->result);
+  entry->batch->nbPending--;
+}
+
+static void zigbee_protocol_batchHwInfo(zigbee_obj* obj, zigbee_batch* batch, zigbee_atResult* results[4])
+{
+  uint8_t txFrame[ZIGBEE_TX_FRAME_SIZE];
+  uint32_t size;
+
+  size = zigbee_encode_getHardwareVersion(txFrame, sizeof(txFrame), zigbee_protocol_nextFrameID(obj));
+  results[0] = zigbee_protocol_batchSubmit(obj, batch, txFrame, size, false);
+
+  size = zigbee_encode_getFirmwareVersion(txFrame, sizeof(txFrame), zigbee_protocol_nextFrameID(obj));
+  results[1] = zigbee_protocol_batchSubmit(obj, batch, txFrame, size, false);
+
+  size = zigbee_encode_getSerialNumberHigh(txFrame, sizeof(txFrame), zigbee_protocol_nextFrameID(obj));
+  results[2] = zigbee_protocol_batchSubmit(obj, batch, txFrame, size, false);
+
+  size = zigbee_encode_getSerialNumberLow(txFrame, sizeof(txFrame), zigbee_protocol_nextFrameID(obj));
+  results[3] = zigbee_protocol_batchSubmit(obj, batch, txFrame, size, false);
+}
+
+static void zigbee_protocol_decodeHwInfo(zigbee_atResult* results[4], zigbee_hwInfo* hwInfo)
+{
+  uint64_t value;
+
+  memset(hwInfo, 0, sizeof(zigbee_hwInfo));
+  if (zigbee_protocol_resultToValue(results[0], &value) == true)
+  {
+    hwInfo->hwVersion = (uint16_t) value;
+  }
+
+  if (zigbee_protocol_resultToValue(results[1], &value) == true)
+  {
+    hwInfo->fwVersion = (uint16_t) value;
+  }
+
+  if (zigbee_protocol_resultToValue(results[2], &value) == true)
+  {
+    hwInfo->serialHigh = (uint32_t) value;
+  }
+
+  if (zigbee_protocol_resultToValue(results[3], &value) == true)
+  {
+    hwInfo->serialLow = (uint32_t) value;
+  }
+}
+
+///numerical parameters are returned big endian, leading zeros may be omitted
+static bool zigbee_protocol_resultToValue(zigbee_atResult* result, uint64_t* value)
+{
+  uint32_t i;
+
+  if ((result->status != ZB_CMD_SUCCESS) || (result->size == 0) || (result->size > sizeof(uint64_t)))
+  {
+    return false;
+  }
+
+  *value = 0;
+  for (i = 0; i < result->size; i++)
   {
-    obj->frameID++;
+    *value = (*value << 8) | result->data[i];
   }
+
+  return true;
 }
 
-zb_status zigbee_protocol_retrieveHwVersion(zigbee_obj* obj, uint16_t* hwVersion)
+static bool zigbee_protocol_resultEquals(zigbee_atResult* result, uint64_t expected, const char* name)
 {
-  zb_handle_status handle_status;
-  zb_status status;
-
-  assert(obj != NULL);
-  assert(hwVersion != NULL);
-  status = ZB_CMD_FAILED;
+  uint64_t value;
 
-  zigbee_protocol_incrementFrameID(obj);
-  obj->sizeOfFrameToSend = zigbee_encode_getHardwareVersion(obj->frame, obj->frameSize, obj->frameID);
-  obj->atReplyExpected = true;
+  if (zigbee_protocol_resultToValue(result, &value) == false)
+  {
+    syslog(LOG_INFO, "%s not read back (status = %d)", name, result->status);
+    return false;
+  }
 
-  handle_status = zigbee_handle(obj);
-  if ((handle_status == ZB_AT_REPLY_RECEIVED) &&
-      (obj->decodedData.atCmd.status == 0) && (obj->decodedData.atCmd.size == 2))
+  if (value != expected)
   {
-    *hwVersion = ((uint16_t) obj->decodedData.atCmd.data[0]) << 8 | obj->decodedData.atCmd.data[1];
-    status = ZB_CMD_SUCCESS;
+    syslog(LOG_INFO, "%s differs from configuration (0x%llx instead of 0x%llx)", name,
+           (unsigned long long) value, (unsigned long long) expected);
+    return false;
   }
 
-  return status;
+  return true;
 }
 
-zb_status zigbee_protocol_retrieveFwVersion(zigbee_obj* obj, uint16_t* fwVersion)
+zb_status zigbee_protocol_checkConfiguration(zigbee_obj* obj, zigbee_config* config, zigbee_hwInfo* hwInfo,
+    bool* bUpToDate, uint8_t* associationIndication)
 {
-  zb_handle_status handle_status;
+  uint8_t txFrame[ZIGBEE_TX_FRAME_SIZE];
+  zigbee_batch batch;
+  zigbee_atResult* panID;
+  zigbee_atResult* channelBitMask;
+  zigbee_atResult* scanDuration;
+  zigbee_atResult* stackProfile;
+  zigbee_atResult* encryption;
+  zigbee_atResult* sleepPeriod;
+  zigbee_atResult* nbSleepPeriod;
+  zigbee_atResult* joinTime;
+  zigbee_atResult* nodeIdentifier;
+  zigbee_atResult* association;
+  zigbee_atResult* rtsFlowControl;
+  zigbee_atResult* ctsFlowControl;
+  zigbee_atResult* apiMode;
+  zigbee_atResult* hwResults[4];
   zb_status status;
+  uint64_t expectedPanID;
+  uint64_t value;
+  uint32_t size;
+  uint32_t i;
+  bool bMatch;
 
   assert(obj != NULL);
-  assert(fwVersion != NULL);
-  status = ZB_CMD_FAILED;
+  assert(config != NULL);
+  assert(bUpToDate != NULL);
+  assert(associationIndication != NULL);
 
-  zigbee_protocol_incrementFrameID(obj);
-  obj->sizeOfFrameToSend = zigbee_encode_getFirmwareVersion(obj->frame, obj->frameSize, obj->frameID);
-  obj->atReplyExpected = true;
+  *bUpToDate = false;
+  *associationIndication = 0xFF;
 
-  handle_status = zigbee_handle(obj);
-  if ((handle_status == ZB_AT_REPLY_RECEIVED) &&
-      (obj->decodedData.atCmd.status == 0) && (obj->decodedData.atCmd.size == 2))
-  {
-    *fwVersion = ((uint16_t) obj->decodedData.atCmd.data[0]) << 8 | obj->decodedData.atCmd.data[1];
-    //fprintf(stdout, "firwmare version = %.2x\n", firmwareVersion);
-    status = ZB_CMD_SUCCESS;
-  }
+  //the radio answers within a few ms when it is alive, don't wait for the default timeout
+  batch.nbEntries = 0;
+  batch.nbPending = 0;
+  batch.timeout = ZIGBEE_AT_PROBE_TIMEOUT;
 
-  return status;
-}
+  size = zigbee_encode_getExtendedPanID(txFrame, sizeof(txFrame), zigbee_protocol_nextFrameID(obj));
+  panID = zigbee_protocol_batchSubmit(obj, &batch, txFrame, size, false);
 
+  size = zigbee_encode_getScanChannelBitmask(txFrame, sizeof(txFrame), zigbee_protocol_nextFrameID(obj));
+  channelBitMask = zigbee_protocol_batchSubmit(obj, &batch, txFrame, size, false);
 
-zb_status zigbee_protocol_retrieveSerial(zigbee_obj* obj, uint32_t* serialLow, uint32_t* serialHigh)
-{
-  zb_handle_status handle_status;
-  zb_status status;
+  size = zigbee_encode_getScanDurationExponent(txFrame, sizeof(txFrame), zigbee_protocol_nextFrameID(obj));
+  scanDuration = zigbee_protocol_batchSubmit(obj, &batch, txFrame, size, false);
 
-  assert(obj != NULL);
-  assert(serialLow != NULL);
-  assert(serialHigh != NULL);
-  status = ZB_CMD_FAILED;
+  size = zigbee_encode_getStackProfile(txFrame, sizeof(txFrame), zigbee_protocol_nextFrameID(obj));
+  stackProfile = zigbee_protocol_batchSubmit(obj, &batch, txFrame, size, false);
 
-  zigbee_protocol_incrementFrameID(obj);
-  obj->sizeOfFrameToSend = zigbee_encode_getSerialNumberHigh(obj->frame, obj->frameSize, obj->frameID);
-  obj->atReplyExpected = true;
+  size = zigbee_encode_getEncryptionEnabled(txFrame, sizeof(txFrame), zigbee_protocol_nextFrameID(obj));
+  encryption = zigbee_protocol_batchSubmit(obj, &batch, txFrame, size, false);
 
-  handle_status = zigbee_handle(obj);
-  if ((handle_status == ZB_AT_REPLY_RECEIVED) &&
-      (obj->decodedData.atCmd.status == 0) && (obj->decodedData.atCmd.size == 4))
-  {
-    *serialHigh =      ((uint32_t) obj->decodedData.atCmd.data[0]) << 24 |
-                       ((uint32_t) obj->decodedData.atCmd.data[1]) << 16 |
-                       ((uint32_t) obj->decodedData.atCmd.data[2]) << 8  |
-                       obj->decodedData.atCmd.data[3];
-    //    fprintf(stdout, "serial high = %.4x\n", serialHigh);
-  }
+  size = zigbee_encode_getSleepPeriod(txFrame, sizeof(txFrame), zigbee_protocol_nextFrameID(obj));
+  sleepPeriod = zigbee_protocol_batchSubmit(obj, &batch, txFrame, size, false);
 
-  zigbee_protocol_incrementFrameID(obj);
-  obj->sizeOfFrameToSend = zigbee_encode_getSerialNumberLow(obj->frame, obj->frameSize, obj->frameID);
-  obj->atReplyExpected = true;
+  size = zigbee_encode_getNumberOfSleepPeriod(txFrame, sizeof(txFrame), zigbee_protocol_nextFrameID(obj));
+  nbSleepPeriod = zigbee_protocol_batchSubmit(obj, &batch, txFrame, size, false);
 
-  handle_status = zigbee_handle(obj);
-  if ((handle_status == ZB_AT_REPLY_RECEIVED) &&
-      (obj->decodedData.atCmd.status == 0) && (obj->decodedData.atCmd.size == 4))
-  {
-    *serialLow =       ((uint32_t) obj->decodedData.atCmd.data[0]) << 24 |
-                       ((uint32_t) obj->decodedData.atCmd.data[1]) << 16 |
-                       ((uint32_t) obj->decodedData.atCmd.data[2]) << 8  |
-                       obj->decodedData.atCmd.data[3];
-    //    fprintf(stdout, "serial low = %.4x\n", serialLow);
-    status = ZB_CMD_SUCCESS;
-  }
-  return status;
-}
+  size = zigbee_encode_getJoinTime(txFrame, sizeof(txFrame), zigbee_protocol_nextFrameID(obj));
+  joinTime = zigbee_protocol_batchSubmit(obj, &batch, txFrame, size, false);
 
+  size = zigbee_encode_getNodeIdentifier(txFrame, sizeof(txFrame), zigbee_protocol_nextFrameID(obj));
+  nodeIdentifier = zigbee_protocol_batchSubmit(obj, &batch, txFrame, size, false);
 
-zb_status zigbee_protocol_configure(zigbee_obj* obj, zigbee_config* config)
-{
-  zb_status status;
-  //status = ZB_CMD_SUCCESS;
-  status = zigbee_protocol_setBaudRate(obj, 115200);
+  size = zigbee_encode_getAssociationIndication(txFrame, sizeof(txFrame), zigbee_protocol_nextFrameID(obj));
+  association = zigbee_protocol_batchSubmit(obj, &batch, txFrame, size, false);
 
-  if (status == ZB_CMD_SUCCESS)
+  size = zigbee_encode_getD6(txFrame, sizeof(txFrame), zigbee_protocol_nextFrameID(obj));
+  rtsFlowControl = zigbee_protocol_batchSubmit(obj, &batch, txFrame, size, false);
+
+  size = zigbee_encode_getD7(txFrame, sizeof(txFrame), zigbee_protocol_nextFrameID(obj));
+  ctsFlowControl = zigbee_protocol_batchSubmit(obj, &batch, txFrame, size, false);
+
+  size = zigbee_encode_getApiMode(txFrame, sizeof(txFrame), zigbee_protocol_nextFrameID(obj));
+  apiMode = zigbee_protocol_batchSubmit(obj, &batch, txFrame, size, false);
+
+  if (hwInfo != NULL)
   {
-    status = zigbee_protocol_setPanID(obj, &config->panID);
+    zigbee_protocol_batchHwInfo(obj, &batch, hwResults);
   }
 
-  if (status == ZB_CMD_SUCCESS)
+  status = zigbee_protocol_batchWait(obj, &batch);
+  if (status != ZB_CMD_SUCCESS)
   {
-    status = zigbee_protocol_setScanChannelBitmask(obj, config->channelBitMask);
+    return status;
   }
 
-  if (status == ZB_CMD_SUCCESS)
+  expectedPanID = 0;
+  for (i = 0; i < sizeof(zigbee_panID); i++)
   {
-    status = zigbee_protocol_setScanDurationExponent(obj, config->scanDuration);
+    expectedPanID = (expectedPanID << 8) | config->panID[i];
   }
 
-  if (status == ZB_CMD_SUCCESS)
+  //evaluate every parameter, so that all differences are logged
+  bMatch = true;
+  bMatch &= zigbee_protocol_resultEquals(panID, expectedPanID, "PAN ID");
+  bMatch &= zigbee_protocol_resultEquals(channelBitMask, config->channelBitMask, "scan channels");
+  bMatch &= zigbee_protocol_resultEquals(scanDuration, config->scanDuration, "scan duration");
+  bMatch &= zigbee_protocol_resultEquals(stackProfile, config->stackProfile, "stack profile");
+  bMatch &= zigbee_protocol_resultEquals(encryption, config->encryption, "encryption");
+  bMatch &= zigbee_protocol_resultEquals(joinTime, config->joinTime, "join time");
+  bMatch &= zigbee_protocol_resultEquals(apiMode, config->apiMode, "API mode");
+
+  if (config->sleepPeriod != 0)
   {
-    status = zigbee_protocol_setStackProfile(obj, config->stackProfile);
+    bMatch &= zigbee_protocol_resultEquals(sleepPeriod, config->sleepPeriod, "sleep period");
   }
 
-  if (status == ZB_CMD_SUCCESS)
+  if (config->nbSleepPeriod != 0)
   {
-    if (config->encryption == false)
-    {
-      status = zigbee_protocol_disableEncryption(obj);
-    }
-    else
-    {
-      status = zigbee_protocol_enableEncryption(obj, &config->networkKey, &config->linkKey);
-    }
+    bMatch &= zigbee_protocol_resultEquals(nbSleepPeriod, config->nbSleepPeriod, "number of sleep periods");
   }
 
-  if ((status == ZB_CMD_SUCCESS) && (config->sleepPeriod != 0))
+  //without flow control, D6/D7 are left as they are
+  if (config->rtscts == true)
   {
-    status = zigbee_protocol_setSleepPeriod(obj, config->sleepPeriod);
+    bMatch &= zigbee_protocol_resultEquals(rtsFlowControl, ZIGBEE_D6_RTS_FLOW_CONTROL, "RTS flow control");
+    bMatch &= zigbee_protocol_resultEquals(ctsFlowControl, ZIGBEE_D7_CTS_FLOW_CONTROL, "CTS flow control");
   }
 
+  if ((config->nodeIdentifier != NULL) &&
+      ((nodeIdentifier->size != strlen(config->nodeIdentifier)) ||
+       (memcmp(nodeIdentifier->data, config->nodeIdentifier, nodeIdentifier->size) != 0)))
+  {
+    syslog(LOG_INFO, "node identifier differs from configuration");
+    bMatch = false;
+  }
 
-  if ((status == ZB_CMD_SUCCESS) && (config->nbSleepPeriod != 0))
+  //network and link keys can't be read back, an encrypted network is always reconfigured
+  if (config->encryption == true)
   {
-    status = zigbee_protocol_setNumberOfSleepPeriod(obj, config->nbSleepPeriod);
+    syslog(LOG_INFO, "encryption keys can't be verified");
+    bMatch = false;
   }
 
-  /*
-    if (status == ZB_CMD_SUCCESS)
-    {
-      status = zigbee_protocol_applyChanges(obj);
-    }
-  */
+  if (zigbee_protocol_resultToValue(association, &value) == true)
+  {
+    *associationIndication = (uint8_t) value;
+  }
+  *bUpToDate = bMatch;
 
-  if ((status == ZB_CMD_SUCCESS) && (config->writeData == true))
+  if (hwInfo != NULL)
   {
-    status = zigbee_protocol_write(obj);
-    syslog(LOG_INFO, "write data into ZB (status = %d)", status);
+    zigbee_protocol_decodeHwInfo(hwResults, hwInfo);
   }
 
   return status;
@@ -366,15 +1277,15 @@ zb_status zigbee_protocol_configureIO(zigbee_obj* obj)
 
 zb_status zigbee_protocol_setBaudRate(zigbee_obj* obj, uint32_t baudRate)
 {
-  zb_handle_status handle_status;
+  uint8_t txFrame[ZIGBEE_TX_FRAME_SIZE];
+  zigbee_atResult result;
+  uint32_t size;
   zb_status status;
-  zigbee_baudrate zbBaudRate;
+  uint32_t zbBaudRate;
 
   assert(obj != NULL);
   status = ZB_CMD_FAILED;
 
-  zigbee_protocol_incrementFrameID(obj);
-
   switch (baudRate)
   {
     case 1200:
@@ -390,7 +1301,6 @@ zb_status zigbee_protocol_setBaudRate(zigbee_obj* obj, uint32_t baudRate)
       break;
 
     case 9600:
-    default:
       zbBaudRate = ZB_BD_9600;
       break;
 
@@ -409,251 +1319,268 @@ zb_status zigbee_protocol_setBaudRate(zigbee_obj* obj, uint32_t baudRate)
     case 115200:
       zbBaudRate = ZB_BD_115200;
       break;
-  }
 
-  obj->sizeOfFrameToSend = zigbee_encode_setBaudRate(obj->frame, 50, obj->frameID, zbBaudRate);
-  obj->atReplyExpected = true;
+    default:
+      if (baudRate < ZB_BD_NON_STANDARD_MIN)
+      {
+        syslog(LOG_ERR, "%d bps can't be set on the radio", baudRate);
+        return status;
+      }
+      zbBaudRate = baudRate;
+      break;
+  }
 
-  handle_status = zigbee_handle(obj);
-  if ((handle_status == ZB_AT_REPLY_RECEIVED) &&
-      (obj->decodedData.atCmd.status == 0))
+  size = zigbee_encode_setBaudRate(txFrame, sizeof(txFrame), zigbee_protocol_nextFrameID(obj), zbBaudRate);
+  if (zigbee_protocol_executeAT(obj, txFrame, size, &result) == ZB_CMD_SUCCESS)
   {
     status = ZB_CMD_SUCCESS;
   }
 
   serial_set_baudrate(obj->fd, baudRate);
+  obj->baudRate = baudRate;
 
   return status;
 }
 
-static zb_status zigbee_protocol_setD5State(zigbee_obj* obj, uint8_t state)
+zb_status zigbee_protocol_probe(zigbee_obj* obj, uint32_t timeout)
 {
-  zb_handle_status handle_status;
-  zb_status status;
+  uint8_t txFrame[ZIGBEE_TX_FRAME_SIZE];
+  zigbee_atResult result;
+  uint32_t size;
 
   assert(obj != NULL);
-  status = ZB_CMD_FAILED;
-
-  zigbee_protocol_incrementFrameID(obj);
-  obj->sizeOfFrameToSend = zigbee_encode_D5(obj->frame, 50, obj->frameID, state);
-  obj->atReplyExpected = true;
-
-  handle_status = zigbee_handle(obj);
-  if ((handle_status == ZB_AT_REPLY_RECEIVED) &&
-      (obj->decodedData.atCmd.status == 0))
-  {
-    status = ZB_CMD_SUCCESS;
-  }
 
-  return status;
+  size = zigbee_encode_getAssociationIndication(txFrame, sizeof(txFrame), zigbee_protocol_nextFrameID(obj));
+  return zigbee_protocol_executeATWithTimeout(obj, txFrame, size, timeout, &result);
 }
 
-static zb_status zigbee_protocol_setPWM0RRSI(zigbee_obj* obj, uint8_t state)
+zb_status zigbee_protocol_detectBaudRate(zigbee_obj* obj, const uint32_t* preferred, uint32_t nbPreferred)
 {
-  zb_handle_status handle_status;
-  zb_status status;
+  uint64_t startTime;
+  uint32_t i;
 
   assert(obj != NULL);
-  status = ZB_CMD_FAILED;
+  assert((preferred != NULL) || (nbPreferred == 0));
 
-  zigbee_protocol_incrementFrameID(obj);
-  obj->sizeOfFrameToSend = zigbee_encode_P0(obj->frame, 50, obj->frameID, state);
-  obj->atReplyExpected = true;
+  startTime = monotonic_getTimeNs();
+  for (i = 0; i < nbPreferred; i++)
+  {
+    if ((zigbee_protocol_isBaudRateIn(preferred[i], preferred, i) == false) &&
+        (zigbee_protocol_tryBaudRate(obj, preferred[i]) == true))
+    {
+      break;
+    }
+  }
 
-  handle_status = zigbee_handle(obj);
-  if ((handle_status == ZB_AT_REPLY_RECEIVED) &&
-      (obj->decodedData.atCmd.status == 0))
+  if (i == nbPreferred)
   {
-    status = ZB_CMD_SUCCESS;
+    for (i = 0; i < ZIGBEE_NB_BAUDRATES; i++)
+    {
+      if ((zigbee_protocol_isBaudRateIn(zigbee_baudRates[i], preferred, nbPreferred) == false) &&
+          (zigbee_protocol_tryBaudRate(obj, zigbee_baudRates[i]) == true))
+      {
+        break;
+      }
+    }
+
+    if (i == ZIGBEE_NB_BAUDRATES)
+    {
+      syslog(LOG_ERR, "radio speed not detected (%llu ms)",
+             (unsigned long long) ((monotonic_getTimeNs() - startTime) / MONOTONIC_NS_PER_MS));
+      return ZB_CMD_FAILED;
+    }
   }
 
-  return status;
+  syslog(LOG_INFO, "radio detected at %d bps in %llu ms", obj->baudRate,
+         (unsigned long long) ((monotonic_getTimeNs() - startTime) / MONOTONIC_NS_PER_MS));
+  return ZB_CMD_SUCCESS;
 }
 
-static zb_status zigbee_protocol_setPWM0RRSI_Timer(zigbee_obj* obj, uint8_t value)
+static bool zigbee_protocol_isBaudRateIn(uint32_t baudRate, const uint32_t* list, uint32_t nbItems)
 {
-  zb_handle_status handle_status;
-  zb_status status;
-
-  assert(obj != NULL);
-  status = ZB_CMD_FAILED;
-
-  zigbee_protocol_incrementFrameID(obj);
-  obj->sizeOfFrameToSend = zigbee_encode_RSSI_PWM_Timer(obj->frame, 50, obj->frameID, value);
-  obj->atReplyExpected = true;
+  uint32_t i;
 
-  handle_status = zigbee_handle(obj);
-  if ((handle_status == ZB_AT_REPLY_RECEIVED) &&
-      (obj->decodedData.atCmd.status == 0))
+  for (i = 0; i < nbItems; i++)
   {
-    status = ZB_CMD_SUCCESS;
+    if (list[i] == baudRate)
+    {
+      return true;
+    }
   }
 
-  return status;
+  return false;
 }
 
-zb_status zigbee_protocol_nodeDiscover(zigbee_obj* obj)
+static bool zigbee_protocol_tryBaudRate(zigbee_obj* obj, uint32_t baudRate)
 {
-  zb_handle_status handle_status;
-  zb_status status;
-
-  assert(obj != NULL);
-  status = ZB_CMD_FAILED;
-
-  zigbee_protocol_incrementFrameID(obj);
-  obj->sizeOfFrameToSend = zigbee_encode_nodeDiscover(obj->frame, 50, obj->frameID);
-  obj->atReplyExpected = true;
-
-  handle_status = zigbee_handle(obj);
-  if ((handle_status == ZB_AT_REPLY_RECEIVED) &&
-      (obj->decodedData.atCmd.status == 0))
+  if (serial_set_baudrate(obj->fd, baudRate) != 0)
   {
-    status = ZB_CMD_SUCCESS;
+    return false;
   }
+  obj->baudRate = baudRate;
 
-  return status;
+  //a reply at a wrong speed is garbage, only a valid frame with the right ID completes the probe
+  serial_flushInput(obj->fd);
+  zigbee_parser_flush(&obj->parser);
+  return (zigbee_protocol_probe(obj, ZIGBEE_AT_DETECT_TIMEOUT) == ZB_CMD_SUCCESS);
 }
 
-static zb_status zigbee_protocol_setPanID(zigbee_obj* obj, zigbee_panID* panID)
+zb_status zigbee_protocol_negotiateBaudRate(zigbee_obj* obj, uint32_t baudRate)
 {
-  zb_handle_status handle_status;
+  uint32_t candidates[2];
+  uint32_t previousBaudRate;
   zb_status status;
 
   assert(obj != NULL);
-  assert(panID != NULL);
-  status = ZB_CMD_FAILED;
 
-  zigbee_protocol_incrementFrameID(obj);
-  obj->sizeOfFrameToSend = zigbee_encode_SetPanID(obj->frame, 50, obj->frameID, panID);
-  obj->atReplyExpected = true;
+  previousBaudRate = obj->baudRate;
+  if (baudRate == previousBaudRate)
+  {
+    //nothing to negotiate, BD is still written so that WR saves it
+    return zigbee_protocol_setBaudRate(obj, baudRate);
+  }
 
-  handle_status = zigbee_handle(obj);
-  if ((handle_status == ZB_AT_REPLY_RECEIVED) &&
-      (obj->decodedData.atCmd.status == 0))
+  if (zigbee_protocol_setBaudRate(obj, baudRate) == ZB_CMD_SUCCESS)
   {
-    status = ZB_CMD_SUCCESS;
+    //bytes received during the switch are garbage
+    serial_flushInput(obj->fd);
+    zigbee_parser_flush(&obj->parser);
+    status = zigbee_protocol_probe(obj, ZIGBEE_AT_PROBE_TIMEOUT);
+    if (status == ZB_CMD_SUCCESS)
+    {
+      syslog(LOG_INFO, "serial speed raised from %d to %d bps", previousBaudRate, baudRate);
+      return status;
+    }
   }
 
-  return status;
+  //the radio may have switched: BD is sent back at the new speed, then the local port follows
+  syslog(LOG_WARNING, "radio doesn't answer at %d bps, back to %d bps", baudRate, previousBaudRate);
+  zigbee_protocol_setBaudRate(obj, previousBaudRate);
+  serial_flushInput(obj->fd);
+  zigbee_parser_flush(&obj->parser);
+  if (zigbee_protocol_probe(obj, ZIGBEE_AT_PROBE_TIMEOUT) != ZB_CMD_SUCCESS)
+  {
+    //the two ends disagree, the radio speed is searched, the two known speeds first
+    candidates[0] = previousBaudRate;
+    candidates[1] = baudRate;
+    if (zigbee_protocol_detectBaudRate(obj, candidates, 2) != ZB_CMD_SUCCESS)
+    {
+      syslog(LOG_ERR, "radio lost after the speed change to %d bps", baudRate);
+    }
+  }
+
+  return ZB_CMD_FAILED;
 }
 
-//TODO return the pan ID
-zb_status zigbee_protocol_getPanID(zigbee_obj* obj, zigbee_panID* panID)
+zb_status zigbee_protocol_negotiateApiMode(zigbee_obj* obj, uint8_t apiMode)
 {
-  zb_handle_status handle_status;
+  uint8_t txFrame[ZIGBEE_TX_FRAME_SIZE];
+  zigbee_atResult result;
+  uint8_t previousApiMode;
+  uint32_t size;
   zb_status status;
-  uint32_t index;
 
   assert(obj != NULL);
-  status = ZB_CMD_FAILED;
 
-  zigbee_protocol_incrementFrameID(obj);
-  obj->sizeOfFrameToSend = zigbee_encode_getPanID(obj->frame, 50, obj->frameID);
-  obj->atReplyExpected = true;
+  previousApiMode = obj->apiMode;
+  size = zigbee_encode_setApiMode(txFrame, sizeof(txFrame), zigbee_protocol_nextFrameID(obj), apiMode);
+  status = zigbee_protocol_executeAT(obj, txFrame, size, &result);
+  if ((status != ZB_CMD_SUCCESS) || (apiMode == previousApiMode))
+  {
+    return status;
+  }
 
-  handle_status = zigbee_handle(obj);
-  if ((handle_status == ZB_AT_REPLY_RECEIVED) &&
-      (obj->decodedData.atCmd.status == 0))
+  zigbee_parser_flush(&obj->parser);
+  zigbee_protocol_setApiMode(obj, apiMode);
+  status = zigbee_protocol_probe(obj, ZIGBEE_AT_PROBE_TIMEOUT);
+  if (status == ZB_CMD_SUCCESS)
   {
-    status = ZB_CMD_SUCCESS;
-    for (index = 0; index < 8; index++)
-    {
-      (*panID)[index] = obj->decodedData.atCmd.data[index];
-    }
+    syslog(LOG_INFO, "API mode switched from %d to %d", previousApiMode, apiMode);
+    return status;
   }
 
-  return status;
+  //the radio acknowledged AP: it goes back with AP sent in the new framing, then the parser follows
+  syslog(LOG_WARNING, "radio doesn't answer in API mode %d, back to %d", apiMode, previousApiMode);
+  size = zigbee_encode_setApiMode(txFrame, sizeof(txFrame), zigbee_protocol_nextFrameID(obj), previousApiMode);
+  zigbee_protocol_executeAT(obj, txFrame, size, &result);
+  zigbee_protocol_setApiMode(obj, previousApiMode);
+  zigbee_parser_flush(&obj->parser);
+  if (zigbee_protocol_probe(obj, ZIGBEE_AT_PROBE_TIMEOUT) != ZB_CMD_SUCCESS)
+  {
+    syslog(LOG_ERR, "radio lost after the API mode change to %d", apiMode);
+  }
+  return ZB_CMD_FAILED;
 }
 
-
-zb_status zigbee_protocol_getOperatingChannel(zigbee_obj* obj, uint8_t* operatingChannel)
+static zb_status zigbee_protocol_setD5State(zigbee_obj* obj, uint8_t state)
 {
-  zb_handle_status handle_status;
+  uint8_t txFrame[ZIGBEE_TX_FRAME_SIZE];
+  zigbee_atResult result;
+  uint32_t size;
   zb_status status;
 
   assert(obj != NULL);
   status = ZB_CMD_FAILED;
 
-  zigbee_protocol_incrementFrameID(obj);
-  obj->sizeOfFrameToSend = zigbee_encode_getOperatingChannel(obj->frame, 50, obj->frameID);
-  obj->atReplyExpected = true;
-
-  handle_status = zigbee_handle(obj);
-  if ((handle_status == ZB_AT_REPLY_RECEIVED) &&
-      (obj->decodedData.atCmd.status == 0))
+  size = zigbee_encode_D5(txFrame, sizeof(txFrame), zigbee_protocol_nextFrameID(obj), state);
+  if (zigbee_protocol_executeAT(obj, txFrame, size, &result) == ZB_CMD_SUCCESS)
   {
     status = ZB_CMD_SUCCESS;
-    *operatingChannel = obj->decodedData.atCmd.data[0];
   }
 
   return status;
 }
 
-
-zb_status zigbee_protocol_getMaxRFPayloadBytes(zigbee_obj* obj, uint16_t* maxRFPayloadBytes)
+static zb_status zigbee_protocol_setPWM0RRSI(zigbee_obj* obj, uint8_t state)
 {
-  zb_handle_status handle_status;
+  uint8_t txFrame[ZIGBEE_TX_FRAME_SIZE];
+  zigbee_atResult result;
+  uint32_t size;
   zb_status status;
 
   assert(obj != NULL);
   status = ZB_CMD_FAILED;
 
-  zigbee_protocol_incrementFrameID(obj);
-  obj->sizeOfFrameToSend = zigbee_encode_getRFPayloadBytes(obj->frame, 50, obj->frameID);
-  obj->atReplyExpected = true;
-
-  handle_status = zigbee_handle(obj);
-  if ((handle_status == ZB_AT_REPLY_RECEIVED) &&
-      (obj->decodedData.atCmd.status == 0))
+  size = zigbee_encode_P0(txFrame, sizeof(txFrame), zigbee_protocol_nextFrameID(obj), state);
+  if (zigbee_protocol_executeAT(obj, txFrame, size, &result) == ZB_CMD_SUCCESS)
   {
     status = ZB_CMD_SUCCESS;
-    *maxRFPayloadBytes = ((uint16_t) obj->decodedData.atCmd.data[0]) << 8  |
-                         obj->decodedData.atCmd.data[1];
   }
 
   return status;
 }
 
-zb_status zigbee_protocol_getReceivedSignalStrength(zigbee_obj* obj, uint8_t* signalStrenght)
+static zb_status zigbee_protocol_setPWM0RRSI_Timer(zigbee_obj* obj, uint8_t value)
 {
-  zb_handle_status handle_status;
+  uint8_t txFrame[ZIGBEE_TX_FRAME_SIZE];
+  zigbee_atResult result;
+  uint32_t size;
   zb_status status;
 
   assert(obj != NULL);
   status = ZB_CMD_FAILED;
 
-  zigbee_protocol_incrementFrameID(obj);
-  obj->sizeOfFrameToSend = zigbee_encode_getReceivedSignalStrenght(obj->frame, 50, obj->frameID);
-  obj->atReplyExpected = true;
-
-  handle_status = zigbee_handle(obj);
-  if ((handle_status == ZB_AT_REPLY_RECEIVED) &&
-      (obj->decodedData.atCmd.status == 0))
+  size = zigbee_encode_RSSI_PWM_Timer(txFrame, sizeof(txFrame), zigbee_protocol_nextFrameID(obj), value);
+  if (zigbee_protocol_executeAT(obj, txFrame, size, &result) == ZB_CMD_SUCCESS)
   {
     status = ZB_CMD_SUCCESS;
-    *signalStrenght = obj->decodedData.atCmd.data[0];
   }
 
   return status;
 }
 
-
-
-static zb_status zigbee_protocol_setScanChannelBitmask(zigbee_obj* obj, uint16_t chanBitmask)
+zb_status zigbee_protocol_nodeDiscover(zigbee_obj* obj)
 {
-  zb_handle_status handle_status;
+  uint8_t txFrame[ZIGBEE_TX_FRAME_SIZE];
+  zigbee_atResult result;
+  uint32_t size;
   zb_status status;
 
   assert(obj != NULL);
   status = ZB_CMD_FAILED;
 
-  zigbee_protocol_incrementFrameID(obj);
-  obj->sizeOfFrameToSend = zigbee_encode_setScanChannelBitmask(obj->frame, obj->frameSize, obj->frameID, chanBitmask);
-  obj->atReplyExpected = true;
-
-  handle_status = zigbee_handle(obj);
-  if ((handle_status == ZB_AT_REPLY_RECEIVED) &&
-      (obj->decodedData.atCmd.status == 0))
+  size = zigbee_encode_nodeDiscover(txFrame, sizeof(txFrame), zigbee_protocol_nextFrameID(obj));
+  if (zigbee_protocol_executeAT(obj, txFrame, size, &result) == ZB_CMD_SUCCESS)
   {
     status = ZB_CMD_SUCCESS;
   }
@@ -661,122 +1588,90 @@ static zb_status zigbee_protocol_setScanChannelBitmask(zigbee_obj* obj, uint16_t
   return status;
 }
 
-static zb_status zigbee_protocol_setScanDurationExponent(zigbee_obj* obj, uint8_t duration)
+
+//TODO return the pan ID
+zb_status zigbee_protocol_getPanID(zigbee_obj* obj, zigbee_panID* panID)
 {
-  zb_handle_status handle_status;
+  uint8_t txFrame[ZIGBEE_TX_FRAME_SIZE];
+  zigbee_atResult result;
+  uint32_t size;
   zb_status status;
+  uint32_t index;
 
   assert(obj != NULL);
   status = ZB_CMD_FAILED;
 
-  zigbee_protocol_incrementFrameID(obj);
-  obj->sizeOfFrameToSend = zigbee_encode_setScanDurationExponent(obj->frame, obj->frameSize, obj->frameID, duration);
-  obj->atReplyExpected = true;
-
-  handle_status = zigbee_handle(obj);
-  if ((handle_status == ZB_AT_REPLY_RECEIVED) &&
-      (obj->decodedData.atCmd.status == 0))
+  size = zigbee_encode_getPanID(txFrame, sizeof(txFrame), zigbee_protocol_nextFrameID(obj));
+  if (zigbee_protocol_executeAT(obj, txFrame, size, &result) == ZB_CMD_SUCCESS)
   {
     status = ZB_CMD_SUCCESS;
+    for (index = 0; index < 8; index++)
+    {
+      (*panID)[index] = result.data[index];
+    }
   }
 
   return status;
 }
 
-static zb_status zigbee_protocol_setStackProfile(zigbee_obj* obj, uint8_t stackProfile)
+
+zb_status zigbee_protocol_getOperatingChannel(zigbee_obj* obj, uint8_t* operatingChannel)
 {
-  zb_handle_status handle_status;
+  uint8_t txFrame[ZIGBEE_TX_FRAME_SIZE];
+  zigbee_atResult result;
+  uint32_t size;
   zb_status status;
 
   assert(obj != NULL);
   status = ZB_CMD_FAILED;
 
-  zigbee_protocol_incrementFrameID(obj);
-  obj->sizeOfFrameToSend = zigbee_encode_setStackProfile(obj->frame, obj->frameSize, obj->frameID, stackProfile);
-  obj->atReplyExpected = true;
-
-  handle_status = zigbee_handle(obj);
-  if ((handle_status == ZB_AT_REPLY_RECEIVED) &&
-      (obj->decodedData.atCmd.status == 0))
+  size = zigbee_encode_getOperatingChannel(txFrame, sizeof(txFrame), zigbee_protocol_nextFrameID(obj));
+  if (zigbee_protocol_executeAT(obj, txFrame, size, &result) == ZB_CMD_SUCCESS)
   {
     status = ZB_CMD_SUCCESS;
+    *operatingChannel = result.data[0];
   }
 
   return status;
 }
 
 
-static zb_status zigbee_protocol_disableEncryption(zigbee_obj* obj)
+zb_status zigbee_protocol_getMaxRFPayloadBytes(zigbee_obj* obj, uint16_t* maxRFPayloadBytes)
 {
-  zb_handle_status handle_status;
+  uint8_t txFrame[ZIGBEE_TX_FRAME_SIZE];
+  zigbee_atResult result;
+  uint32_t size;
   zb_status status;
 
   assert(obj != NULL);
   status = ZB_CMD_FAILED;
 
-  zigbee_protocol_incrementFrameID(obj);
-  obj->sizeOfFrameToSend = zigbee_encode_setEncryptionEnabled(obj->frame, obj->frameSize, obj->frameID, false);
-  obj->atReplyExpected = true;
-
-  handle_status = zigbee_handle(obj);
-  if ((handle_status == ZB_AT_REPLY_RECEIVED) &&
-      (obj->decodedData.atCmd.status == 0))
+  size = zigbee_encode_getRFPayloadBytes(txFrame, sizeof(txFrame), zigbee_protocol_nextFrameID(obj));
+  if (zigbee_protocol_executeAT(obj, txFrame, size, &result) == ZB_CMD_SUCCESS)
   {
     status = ZB_CMD_SUCCESS;
+    *maxRFPayloadBytes = ((uint16_t) result.data[0]) << 8  |
+                         result.data[1];
   }
+
   return status;
 }
 
-static zb_status zigbee_protocol_enableEncryption(zigbee_obj* obj, zigbee_encryptionKey* encryptKey,
-    zigbee_linkKey* linkKey)
+zb_status zigbee_protocol_getReceivedSignalStrength(zigbee_obj* obj, uint8_t* signalStrenght)
 {
-  zb_handle_status handle_status;
+  uint8_t txFrame[ZIGBEE_TX_FRAME_SIZE];
+  zigbee_atResult result;
+  uint32_t size;
   zb_status status;
 
   assert(obj != NULL);
   status = ZB_CMD_FAILED;
 
-  zigbee_protocol_incrementFrameID(obj);
-  obj->sizeOfFrameToSend = zigbee_encode_setEncryptionEnabled(obj->frame, obj->frameSize, obj->frameID, true);
-  obj->atReplyExpected = true;
-
-  handle_status = zigbee_handle(obj);
-  if ((handle_status == ZB_AT_REPLY_RECEIVED) &&
-      (obj->decodedData.atCmd.status == 0))
-  {
-    status = ZB_CMD_SUCCESS;
-  }
-
-  if (status != ZB_CMD_SUCCESS)
-  {
-    return status;
-  }
-
-  zigbee_protocol_incrementFrameID(obj);
-  obj->sizeOfFrameToSend = zigbee_encode_setNetworkEncryptionKey(obj->frame, obj->frameSize, obj->frameID, encryptKey);
-  obj->atReplyExpected = true;
-
-  handle_status = zigbee_handle(obj);
-  if ((handle_status == ZB_AT_REPLY_RECEIVED) &&
-      (obj->decodedData.atCmd.status == 0))
-  {
-    status = ZB_CMD_SUCCESS;
-  }
-
-  if (status != ZB_CMD_SUCCESS)
-  {
-    return status;
-  }
-
-  zigbee_protocol_incrementFrameID(obj);
-  obj->sizeOfFrameToSend = zigbee_encode_setLinkKey(obj->frame, obj->frameSize, obj->frameID, linkKey);
-  obj->atReplyExpected = true;
-
-  handle_status = zigbee_handle(obj);
-  if ((handle_status == ZB_AT_REPLY_RECEIVED) &&
-      (obj->decodedData.atCmd.status == 0))
+  size = zigbee_encode_getReceivedSignalStrenght(txFrame, sizeof(txFrame), zigbee_protocol_nextFrameID(obj));
+  if (zigbee_protocol_executeAT(obj, txFrame, size, &result) == ZB_CMD_SUCCESS)
   {
     status = ZB_CMD_SUCCESS;
+    *signalStrenght = result.data[0];
   }
 
   return status;
@@ -784,19 +1679,16 @@ static zb_status zigbee_protocol_enableEncryption(zigbee_obj* obj, zigbee_encryp
 
 zb_status zigbee_protocol_setSleepMode(zigbee_obj* obj, zigbee_sleepMode sleepMode)
 {
-  zb_handle_status handle_status;
+  uint8_t txFrame[ZIGBEE_TX_FRAME_SIZE];
+  zigbee_atResult result;
+  uint32_t size;
   zb_status status;
 
   assert(obj != NULL);
   status = ZB_CMD_FAILED;
 
-  zigbee_protocol_incrementFrameID(obj);
-  obj->sizeOfFrameToSend = zigbee_encode_setSleepMode(obj->frame, obj->frameSize, obj->frameID, sleepMode);
-  obj->atReplyExpected = true;
-
-  handle_status = zigbee_handle(obj);
-  if ((handle_status == ZB_AT_REPLY_RECEIVED) &&
-      (obj->decodedData.atCmd.status == 0))
+  size = zigbee_encode_setSleepMode(txFrame, sizeof(txFrame), zigbee_protocol_nextFrameID(obj), sleepMode);
+  if (zigbee_protocol_executeAT(obj, txFrame, size, &result) == ZB_CMD_SUCCESS)
   {
     status = ZB_CMD_SUCCESS;
   }
@@ -806,19 +1698,16 @@ zb_status zigbee_protocol_setSleepMode(zigbee_obj* obj, zigbee_sleepMode sleepMo
 
 zb_status zigbee_protocol_setNumberOfSleepPeriod(zigbee_obj* obj, uint16_t nbSleepPeriod)
 {
-  zb_handle_status handle_status;
+  uint8_t txFrame[ZIGBEE_TX_FRAME_SIZE];
+  zigbee_atResult result;
+  uint32_t size;
   zb_status status;
 
   assert(obj != NULL);
   status = ZB_CMD_FAILED;
 
-  zigbee_protocol_incrementFrameID(obj);
-  obj->sizeOfFrameToSend = zigbee_encode_setNumberOfSleepPeriod(obj->frame, obj->frameSize, obj->frameID, nbSleepPeriod);
-  obj->atReplyExpected = true;
-
-  handle_status = zigbee_handle(obj);
-  if ((handle_status == ZB_AT_REPLY_RECEIVED) &&
-      (obj->decodedData.atCmd.status == 0))
+  size = zigbee_encode_setNumberOfSleepPeriod(txFrame, sizeof(txFrame), zigbee_protocol_nextFrameID(obj), nbSleepPeriod);
+  if (zigbee_protocol_executeAT(obj, txFrame, size, &result) == ZB_CMD_SUCCESS)
   {
     status = ZB_CMD_SUCCESS;
   }
@@ -827,19 +1716,16 @@ zb_status zigbee_protocol_setNumberOfSleepPeriod(zigbee_obj* obj, uint16_t nbSle
 
 zb_status zigbee_protocol_setSleepPeriod(zigbee_obj* obj, uint16_t sleepPeriod)
 {
-  zb_handle_status handle_status;
+  uint8_t txFrame[ZIGBEE_TX_FRAME_SIZE];
+  zigbee_atResult result;
+  uint32_t size;
   zb_status status;
 
   assert(obj != NULL);
   status = ZB_CMD_FAILED;
 
-  zigbee_protocol_incrementFrameID(obj);
-  obj->sizeOfFrameToSend = zigbee_encode_setSleepPeriod(obj->frame, obj->frameSize, obj->frameID, sleepPeriod);
-  obj->atReplyExpected = true;
-
-  handle_status = zigbee_handle(obj);
-  if ((handle_status == ZB_AT_REPLY_RECEIVED) &&
-      (obj->decodedData.atCmd.status == 0))
+  size = zigbee_encode_setSleepPeriod(txFrame, sizeof(txFrame), zigbee_protocol_nextFrameID(obj), sleepPeriod);
+  if (zigbee_protocol_executeAT(obj, txFrame, size, &result) == ZB_CMD_SUCCESS)
   {
     status = ZB_CMD_SUCCESS;
   }
@@ -848,19 +1734,16 @@ zb_status zigbee_protocol_setSleepPeriod(zigbee_obj* obj, uint16_t sleepPeriod)
 
 zb_status zigbee_protocol_applyChanges(zigbee_obj* obj)
 {
-  zb_handle_status handle_status;
+  uint8_t txFrame[ZIGBEE_TX_FRAME_SIZE];
+  zigbee_atResult result;
+  uint32_t size;
   zb_status status;
 
   assert(obj != NULL);
   status = ZB_CMD_FAILED;
 
-  zigbee_protocol_incrementFrameID(obj);
-  obj->sizeOfFrameToSend = zigbee_encode_applyChanges(obj->frame, obj->frameSize, obj->frameID);
-  obj->atReplyExpected = true;
-
-  handle_status = zigbee_handle(obj);
-  if ((handle_status == ZB_AT_REPLY_RECEIVED) &&
-      (obj->decodedData.atCmd.status == 0))
+  size = zigbee_encode_applyChanges(txFrame, sizeof(txFrame), zigbee_protocol_nextFrameID(obj));
+  if (zigbee_protocol_executeAT(obj, txFrame, size, &result) == ZB_CMD_SUCCESS)
   {
     status = ZB_CMD_SUCCESS;
   }
@@ -869,19 +1752,16 @@ zb_status zigbee_protocol_applyChanges(zigbee_obj* obj)
 
 zb_status zigbee_protocol_write(zigbee_obj* obj)
 {
-  zb_handle_status handle_status;
+  uint8_t txFrame[ZIGBEE_TX_FRAME_SIZE];
+  zigbee_atResult result;
+  uint32_t size;
   zb_status status;
 
   assert(obj != NULL);
   status = ZB_CMD_FAILED;
 
-  zigbee_protocol_incrementFrameID(obj);
-  obj->sizeOfFrameToSend = zigbee_encode_write(obj->frame, obj->frameSize, obj->frameID);
-  obj->atReplyExpected = true;
-
-  handle_status = zigbee_handle(obj);
-  if ((handle_status == ZB_AT_REPLY_RECEIVED) &&
-      (obj->decodedData.atCmd.status == 0))
+  size = zigbee_encode_write(txFrame, sizeof(txFrame), zigbee_protocol_nextFrameID(obj));
+  if (zigbee_protocol_executeAT(obj, txFrame, size, &result) == ZB_CMD_SUCCESS)
   {
     status = ZB_CMD_SUCCESS;
   }
@@ -891,19 +1771,16 @@ zb_status zigbee_protocol_write(zigbee_obj* obj)
 
 zb_status zigbee_protocol_startJoinNetwork(zigbee_obj* obj, uint8_t joinTime)
 {
-  zb_handle_status handle_status;
+  uint8_t txFrame[ZIGBEE_TX_FRAME_SIZE];
+  zigbee_atResult result;
+  uint32_t size;
   zb_status status;
 
   assert(obj != NULL);
   status = ZB_CMD_FAILED;
 
-  zigbee_protocol_incrementFrameID(obj);
-  obj->sizeOfFrameToSend = zigbee_encode_SetJoinTime(obj->frame, obj->frameSize, obj->frameID, joinTime);
-  obj->atReplyExpected = true;
-
-  handle_status = zigbee_handle(obj);
-  if ((handle_status == ZB_AT_REPLY_RECEIVED) &&
-      (obj->decodedData.atCmd.status == 0))
+  size = zigbee_encode_SetJoinTime(txFrame, sizeof(txFrame), zigbee_protocol_nextFrameID(obj), joinTime);
+  if (zigbee_protocol_executeAT(obj, txFrame, size, &result) == ZB_CMD_SUCCESS)
   {
     status = ZB_CMD_SUCCESS;
   }
@@ -911,49 +1788,126 @@ zb_status zigbee_protocol_startJoinNetwork(zigbee_obj* obj, uint8_t joinTime)
 }
 
 
-zb_status zigbee_protocol_waitEndOfAssociation(zigbee_obj* obj, uint8_t* indicationStatus)
+void zigbee_protocol_armHardwareReset(zigbee_obj* obj)
+{
+  assert(obj != NULL);
+
+  //anything received before the reset is meaningless
+  serial_flushInput(obj->fd);
+  zigbee_parser_flush(&obj->parser);
+  obj->nbModemStatusAtReset = obj->nbModemStatus;
+}
+
+zb_status zigbee_protocol_waitHardwareReset(zigbee_obj* obj, uint32_t timeout)
 {
   zb_status status;
+  uint64_t startTime;
+  uint32_t nbModemStatus;
 
   assert(obj != NULL);
-  assert(indicationStatus != NULL);
-  status = ZB_CMD_FAILED;
 
-  *indicationStatus = -1;
-  do
+  startTime = monotonic_getTimeNs();
+  obj->resetDeadline = startTime + timeout * MONOTONIC_NS_PER_MS;
+  nbModemStatus = obj->nbModemStatusAtReset;
+  status = ZB_CMD_TIMEOUT;
+
+  while (monotonic_getTimeNs() < obj->resetDeadline)
   {
-    status = zigbee_protocol_getAssociationIndication(obj, indicationStatus);
-    if ((status == ZB_CMD_SUCCESS) && (*indicationStatus == 0xFF))
+    if (obj->nbModemStatus != nbModemStatus)
     {
-      sleep(1);
+      nbModemStatus = obj->nbModemStatus;
+      if ((obj->modemStatus == ZIGBEE_MODEM_HW_RESET) || (obj->modemStatus == ZIGBEE_MODEM_WATCHDOG_RESET))
+      {
+        status = ZB_CMD_SUCCESS;
+        break;
+      }
     }
+    zigbee_handle(obj);
+  }
+  obj->resetDeadline = 0;
 
+  if (status == ZB_CMD_SUCCESS)
+  {
+    syslog(LOG_INFO, "radio ready %llu ms after reset",
+           (unsigned long long) ((monotonic_getTimeNs() - startTime) / MONOTONIC_NS_PER_MS));
+  }
+  else
+  {
+    syslog(LOG_WARNING, "no reset status from radio within %d ms", timeout);
   }
-  while ((status == 0) && (*indicationStatus == 0xFF));
 
   return status;
 }
 
+zb_status zigbee_protocol_waitEndOfAssociation(zigbee_obj* obj, uint8_t* indicationStatus)
+{
+  zb_status status;
+  uint32_t nbModemStatus;
+  uint64_t nextPoll;
+  bool bQuery;
+
+  assert(obj != NULL);
+  assert(indicationStatus != NULL);
+
+  *indicationStatus = 0xFF;
+  nbModemStatus = obj->nbModemStatus;
+  nextPoll = 0; //the association may already be done, first query at once
+
+  while (true)
+  {
+    bQuery = false;
+    if (obj->nbModemStatus != nbModemStatus)
+    {
+      nbModemStatus = obj->nbModemStatus;
+      if ((obj->modemStatus == ZIGBEE_MODEM_JOINED) || (obj->modemStatus == ZIGBEE_MODEM_COORDINATOR_STARTED))
+      {
+        bQuery = true;
+      }
+      else if ((obj->modemStatus >= ZIGBEE_MODEM_STACK_ERROR) && (obj->modemStatus != ZIGBEE_MODEM_NONE))
+      {
+        syslog(LOG_ERR, "association failed, modem status = 0x%x", obj->modemStatus);
+        return ZB_CMD_FAILED;
+      }
+    }
+
+    if (monotonic_getTimeNs() >= nextPoll)
+    {
+      bQuery = true;
+    }
+
+    if (bQuery == true)
+    {
+      status = zigbee_protocol_getAssociationIndication(obj, indicationStatus);
+      if ((status != ZB_CMD_SUCCESS) || (*indicationStatus != 0xFF))
+      {
+        return status;
+      }
+      nextPoll = monotonic_getTimeNs() + ZIGBEE_ASSOCIATION_POLL * MONOTONIC_NS_PER_MS;
+    }
+    else
+    {
+      zigbee_handle(obj);
+    }
+  }
+}
+
 
 static uint32_t zigbee_protocol_getAssociationIndication(zigbee_obj* obj, uint8_t* associationIndication)
 {
-  zb_handle_status handle_status;
+  uint8_t txFrame[ZIGBEE_TX_FRAME_SIZE];
+  zigbee_atResult result;
+  uint32_t size;
   zb_status status;
 
   assert(obj != NULL);
   assert(associationIndication != NULL);
   status = ZB_CMD_FAILED;
 
-  zigbee_protocol_incrementFrameID(obj);
-  obj->sizeOfFrameToSend = zigbee_encode_getAssociationIndication(obj->frame, obj->frameSize, obj->frameID);
-  obj->atReplyExpected = true;
-
-  handle_status = zigbee_handle(obj);
-  if ((handle_status == ZB_AT_REPLY_RECEIVED) &&
-      (obj->decodedData.atCmd.status == 0))
+  size = zigbee_encode_getAssociationIndication(txFrame, sizeof(txFrame), zigbee_protocol_nextFrameID(obj));
+  if (zigbee_protocol_executeAT(obj, txFrame, size, &result) == ZB_CMD_SUCCESS)
   {
     status = ZB_CMD_SUCCESS;
-    *associationIndication = obj->decodedData.atCmd.data[0];
+    *associationIndication = result.data[0];
   }
 
   return status;
@@ -962,20 +1916,17 @@ static uint32_t zigbee_protocol_getAssociationIndication(zigbee_obj* obj, uint8_
 
 zb_status zigbee_protocol_setNodeIdentifier(zigbee_obj* obj, char* string)
 {
-  zb_handle_status handle_status;
+  uint8_t txFrame[ZIGBEE_TX_FRAME_SIZE];
+  zigbee_atResult result;
+  uint32_t size;
   zb_status status;
 
   assert(obj != NULL);
   assert(string != NULL);
   status = ZB_CMD_FAILED;
 
-  zigbee_protocol_incrementFrameID(obj);
-  obj->sizeOfFrameToSend = zigbee_encode_SetNodeIdentifier(obj->frame, 50, obj->frameID, string);
-  obj->atReplyExpected = true;
-
-  handle_status = zigbee_handle(obj);
-  if ((handle_status == ZB_AT_REPLY_RECEIVED) &&
-      (obj->decodedData.atCmd.status == 0))
+  size = zigbee_encode_SetNodeIdentifier(txFrame, sizeof(txFrame), zigbee_protocol_nextFrameID(obj), string);
+  if (zigbee_protocol_executeAT(obj, txFrame, size, &result) == ZB_CMD_SUCCESS)
   {
     status = ZB_CMD_SUCCESS;
   }
@@ -985,24 +1936,19 @@ zb_status zigbee_protocol_setNodeIdentifier(zigbee_obj* obj, char* string)
 zb_status zigbee_protocol_sendData(zigbee_obj* obj, zigbee_64bDestAddr* destAddr64b, uint16_t destAddr16b,
                                    uint8_t* payload, uint8_t size)
 {
-  //   zb_handle_status handle_status;
+  uint8_t txFrame[ZIGBEE_TX_FRAME_SIZE];
+  uint32_t frameSize;
   zb_status status;
 
   assert(obj != NULL);
   assert(destAddr64b != NULL);
   assert(payload != NULL);
-  status = ZB_CMD_FAILED;
 
-  zigbee_protocol_incrementFrameID(obj);
-  obj->sizeOfFrameToSend = zigbee_encode_transmitRequest(obj->frame, obj->frameSize, obj->frameID, destAddr64b,
-                           destAddr16b, payload, size);
+  frameSize = zigbee_encode_transmitRequest(txFrame, sizeof(txFrame), zigbee_protocol_nextFrameID(obj), destAddr64b,
+              destAddr16b, payload, size);
 
-  /*handle_status =*/ zigbee_handle(obj);
-  // if ((handle_status == ZB_AT_REPLY_RECEIVED) &&
-  //     (obj->decodedData.atCmd.status == 0))
-  {
-    status = ZB_CMD_SUCCESS;
-  }
+  //only queued, the frame goes out as soon as the serial line is writable
+  status = zigbee_protocol_queueFrame(obj, txFrame, frameSize);
   return status;
 }
 
@@ -3,23 +3,119 @@
 
 #include <stdint.h>
 #include "zigbee.h"
+#include "capture.h"
 
 typedef enum
 {
   ZB_CMD_SUCCESS,
-  ZB_CMD_FAILED
+  ZB_CMD_FAILED,
+  ZB_CMD_TIMEOUT
 } zb_status;
 
+#define ZIGBEE_TX_QUEUE_SIZE    (16)
+#define ZIGBEE_TX_FRAME_SIZE    (128)
+#define ZIGBEE_TX_SLOT_SIZE     (2 * ZIGBEE_TX_FRAME_SIZE) //worst case once escaped
+
+typedef struct
+{
+  uint8_t data[ZIGBEE_TX_SLOT_SIZE]; //as written on the line
+  uint32_t size;
+  uint8_t apiID; //kept unescaped for the statistics and probes
+  uint8_t frameID;
+} zigbee_txFrame;
+
+typedef struct
+{
+  zigbee_txFrame frames[ZIGBEE_TX_QUEUE_SIZE];
+  uint32_t indexRead;
+  uint32_t indexWrite;
+  uint32_t nbItems;
+  uint32_t offset; //bytes of the oldest frame already written
+} zigbee_txQueue;
+
+#define ZIGBEE_CTS_RETRY_PERIOD     (5) //in ms, CTS changes are not notified
+#define ZIGBEE_NB_API_IDS           (256) //frame counters are indexed by API identifier
+
+typedef struct
+{
+  uint32_t nbFrames;
+  uint32_t nbQueued[ZIGBEE_NB_API_IDS]; //by API identifier, when queued
+  uint32_t nbWrites; //system calls, each one carries all the queued frames
+  uint32_t nbPartialWrites;
+  uint32_t nbWouldBlock;
+  uint32_t nbStalls; //transmission paused by CTS
+  uint64_t stallTime; //in ns, total time paused by CTS
+  uint64_t stallStart; //0 when not paused
+} zigbee_txStats;
+
+typedef struct
+{
+  uint32_t nbFrames[ZIGBEE_NB_API_IDS]; //by API identifier, checksum verified
+  uint32_t nbDecodeErrors;
+  uint32_t nbIncompleteFrames; //dropped after ZIGBEE_RX_FRAME_TIMEOUT_NS without their end
+  uint32_t nbAtTimeouts;
+} zigbee_rxStats;
+
+#define ZIGBEE_AT_MAX_PENDING       (16)
+#define ZIGBEE_AT_DEFAULT_TIMEOUT   (2000) //in ms
+#define ZIGBEE_AT_PROBE_TIMEOUT     (250)  //in ms
+#define ZIGBEE_AT_DETECT_TIMEOUT    (100)  //in ms, for each speed tried
+#define ZIGBEE_ASSOCIATION_POLL     (5000) //in ms, fallback when no modem status is received
+#define ZIGBEE_DEFAULT_SERIAL_SPEED (115200)
+#define ZIGBEE_AT_MAX_DATA_SIZE     (64)
+
+struct zigbee_obj_s;
+
+/**
+ * AT command completion, status is ZB_CMD_SUCCESS when the radio replied OK,
+ * ZB_CMD_FAILED on an error reply and ZB_CMD_TIMEOUT without reply (response is NULL).
+ * response is only valid during the call.
+ */
+typedef void (*zigbee_atCallBack)(struct zigbee_obj_s* obj, zb_status status, zigbee_atCommandResponse* response,
+                                  void* userData);
+
+typedef struct
+{
+  bool bUsed;
+  uint8_t frameID;
+  uint8_t ATcmd[2];
+  uint64_t deadline;
+  zigbee_atCallBack onComplete;
+  void* userData;
+} zigbee_atRequest;
+
+typedef struct
+{
+  bool bDone;
+  zb_status status;
+  uint8_t data[ZIGBEE_AT_MAX_DATA_SIZE];
+  uint32_t size;
+} zigbee_atResult;
+
 struct zigbee_obj_s
 {
   uint32_t fd;
-  uint16_t frameID;
+  uint32_t baudRate; //local serial speed
+  uint8_t apiMode; //local framing, ZIGBEE_API_MODE_xxx
+  uint8_t frameID;
   uint32_t frameSize;
-  uint8_t* frame;
-  uint32_t sizeOfFrameToSend;
-  bool atReplyExpected;
+  uint8_t* frame; //reception only
+  zigbee_txQueue txQueue;
+  zigbee_txStats txStats;
+  zigbee_rxStats rxStats;
+  bool bFlowControl; //RTS/CTS
+  uint64_t ctsRetryDeadline; //0 when CTS is not awaited
+  zigbee_atRequest atRequests[ZIGBEE_AT_MAX_PENDING];
+  uint32_t nbAtPending;
   zigbee_decodedFrame decodedData;
-  uint8_t modemStatus;
+  zigbee_parser parser;
+  uint64_t lastRxTime;
+  uint64_t rxFrameStart; //arrival of the first byte of the next frame in the parser
+  uint8_t modemStatus; //last one received
+  uint32_t nbModemStatus; //incremented on each modem status frame
+  uint32_t nbModemStatusAtReset;
+  uint64_t resetDeadline; //0 when no reset is awaited
+  capture_ring* capture; //every API frame sent or received, NULL when not configured
   void (*onDataFrameReception)(struct zigbee_obj_s* obj, zigbee_decodedFrame* frame);
 };
 
@@ -28,6 +124,9 @@ typedef struct zigbee_obj_s zigbee_obj;
 typedef struct
 {
   zigbee_panID panID;
+  uint32_t baudRate; //negotiated before the other parameters
+  bool rtscts; //hardware flow control, D6/D7 on the radio side
+  uint8_t apiMode; //AP, negotiated with the baudrate
   uint16_t channelBitMask;
   uint8_t scanDuration;
   uint8_t stackProfile;
@@ -36,9 +135,19 @@ typedef struct
   zigbee_encryptionKey networkKey;
   uint16_t nbSleepPeriod;
   uint16_t sleepPeriod;
+  char* nodeIdentifier; //not set when NULL
+  uint8_t joinTime;
   bool writeData;
 } zigbee_config;
 
+typedef struct
+{
+  uint16_t hwVersion;
+  uint16_t fwVersion;
+  uint32_t serialHigh;
+  uint32_t serialLow;
+} zigbee_hwInfo;
+
 typedef enum
 {
   ZB_NO_REPLY,
@@ -46,9 +155,30 @@ typedef enum
   ZB_RX_FRAME_RECEIVED,
 } zb_handle_status;
 
-extern void zigbee_protocol_initialize(zigbee_obj* obj, uint32_t fd, uint8_t* buffer, uint32_t bufferSize,
+extern void zigbee_protocol_initialize(zigbee_obj* obj, uint32_t fd, uint32_t baudRate, uint8_t* buffer,
+                                       uint32_t bufferSize,
                                        void (*onDataCallBack)(struct zigbee_obj_s*, zigbee_decodedFrame*) );
-extern zb_status zigbee_protocol_configure(zigbee_obj* obj, zigbee_config* config);
+extern void zigbee_protocol_setFlowControl(zigbee_obj* obj, bool bFlowControl);
+extern void zigbee_protocol_setApiMode(zigbee_obj* obj, uint8_t apiMode);
+extern void zigbee_protocol_setCapture(zigbee_obj* obj, capture_ring* capture);
+extern zb_status zigbee_protocol_configure(zigbee_obj* obj, zigbee_config* config, zigbee_hwInfo* hwInfo);
+/**
+ * read back the parameters set by zigbee_protocol_configure() and the association indication, in one batch.
+ * bUpToDate is true when the radio already runs with this configuration (never when encryption is enabled,
+ * since the keys can't be read back). Returns ZB_CMD_SUCCESS only if the radio answered every read.
+ */
+extern zb_status zigbee_protocol_checkConfiguration(zigbee_obj* obj, zigbee_config* config, zigbee_hwInfo* hwInfo,
+    bool* bUpToDate, uint8_t* associationIndication);
+
+/**
+ * Asynchronous AT commands: the frame is encoded by the caller with the ID given by
+ * zigbee_protocol_nextFrameID(), up to ZIGBEE_AT_MAX_PENDING commands are in flight,
+ * replies are matched by frame ID. zigbee_protocol_executeAT() is the blocking form.
+ */
+extern uint8_t   zigbee_protocol_nextFrameID(zigbee_obj* obj);
+extern zb_status zigbee_protocol_submitAT(zigbee_obj* obj, uint8_t* frame, uint32_t size, uint32_t timeout,
+    zigbee_atCallBack onComplete, void* userData);
+extern zb_status zigbee_protocol_executeAT(zigbee_obj* obj, uint8_t* frame, uint32_t size, zigbee_atResult* result);
 extern zb_status zigbee_protocol_configureIO(zigbee_obj* obj);
 
 extern zb_status zigbee_protocol_retrieveHwVersion(zigbee_obj* obj, uint16_t* hwVersion);
@@ -60,7 +190,20 @@ extern zb_status zigbee_protocol_setNumberOfSleepPeriod(zigbee_obj* obj, uint16_
 extern zb_status zigbee_protocol_setSleepPeriod(zigbee_obj* obj, uint16_t sleepPeriod);
 
 extern zb_status zigbee_protocol_startJoinNetwork(zigbee_obj* obj, uint8_t joinTime);
+/**
+ * wait for the "joined" or "coordinator started" modem status, confirmed by AI.
+ * AI is also polled every ZIGBEE_ASSOCIATION_POLL ms in case the status frame is missed,
+ * a stack error reported by the radio ends the wait at once.
+ */
 extern zb_status zigbee_protocol_waitEndOfAssociation(zigbee_obj* obj, uint8_t* indicationStatus);
+
+/**
+ * hardware reset handshake: arm drops the pending input before the reset pulse,
+ * wait returns as soon as the "hardware reset" modem status is received,
+ * or ZB_CMD_TIMEOUT after timeout ms.
+ */
+extern void      zigbee_protocol_armHardwareReset(zigbee_obj* obj);
+extern zb_status zigbee_protocol_waitHardwareReset(zigbee_obj* obj, uint32_t timeout);
 extern zb_status zigbee_protocol_applyChanges(zigbee_obj* obj);
 extern zb_status zigbee_protocol_write(zigbee_obj* obj);
 
@@ -73,7 +216,40 @@ extern zb_status zigbee_protocol_sendData(zigbee_obj* obj, zigbee_64bDestAddr* d
     uint8_t* payload, uint8_t size);
 extern zb_handle_status zigbee_handle(zigbee_obj* zigbee);
 
+/**
+ * Non blocking entry points, for an external event loop:
+ * - zigbee_handleInput() when the serial fd is readable,
+ * - zigbee_handleOutput() when the serial fd is writable and zigbee_hasPendingOutput() is true,
+ * - zigbee_handleTimeout() when the deadline given by zigbee_getNextTimeout() is reached
+ *   (absolute CLOCK_MONOTONIC time in ns, 0 when nothing is pending).
+ */
+extern zb_handle_status zigbee_handleInput(zigbee_obj* zigbee);
+extern void zigbee_handleOutput(zigbee_obj* zigbee);
+extern bool zigbee_hasPendingOutput(zigbee_obj* zigbee);
+extern uint64_t zigbee_getNextTimeout(zigbee_obj* zigbee);
+extern void zigbee_handleTimeout(zigbee_obj* zigbee);
+
 extern zb_status zigbee_protocol_nodeDiscover(zigbee_obj* obj);
 extern zb_status zigbee_protocol_setBaudRate(zigbee_obj* obj, uint32_t baudRate);
+/**
+ * raise the speed of both ends: BD is sent at the current speed, then the new one is checked
+ * with a probe. If the radio doesn't answer, BD back to the previous speed is sent at the new
+ * one before the local port returns to it, and the radio speed is detected again when the
+ * two ends still disagree.
+ */
+extern zb_status zigbee_protocol_negotiateBaudRate(zigbee_obj* obj, uint32_t baudRate);
+/**
+ * AP is sent with the current framing, the local side follows once the radio acknowledged it.
+ * If the radio doesn't answer in the new framing, AP back to the previous mode is sent in it
+ * before the local side returns.
+ */
+extern zb_status zigbee_protocol_negotiateApiMode(zigbee_obj* obj, uint8_t apiMode);
+/// cheap AT query, ZB_CMD_SUCCESS when the radio answers at the current speed within timeout ms
+extern zb_status zigbee_protocol_probe(zigbee_obj* obj, uint32_t timeout);
+/**
+ * find the radio speed: the preferred speeds are probed first, then all the usual XBee speeds.
+ * On success, the local port is left at the detected speed.
+ */
+extern zb_status zigbee_protocol_detectBaudRate(zigbee_obj* obj, const uint32_t* preferred, uint32_t nbPreferred);
 
 #endif /* ZIGBEE_PROTOCOL_H */